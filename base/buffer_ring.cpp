@@ -0,0 +1,47 @@
+#include "buffer_ring.h"
+#include <algorithm>
+#include <cassert>
+
+buffer_ring::buffer_ring(const buffer_ring_config& config)
+    : config_(config)
+    , num_slots_(config.adaptive ? std::max(config.max_buffers, config.num_buffers) : config.num_buffers)
+    , data_(num_slots_ * config.buffer_frames * 2)
+    , target_(config.num_buffers) {
+    assert(config_.buffer_frames > 0 && config_.num_buffers > 0);
+    assert(!config_.adaptive || (config_.min_buffers > 0 && config_.min_buffers <= config_.num_buffers && config_.shrink_after > 0));
+}
+
+int buffer_ring::begin_fill() {
+    assert(can_fill());
+    const int slot = next_fill_;
+    next_fill_ = (next_fill_ + 1) % num_slots_;
+    ++num_queued_;
+    filling_ = true;
+    return slot;
+}
+
+void buffer_ring::end_fill() {
+    assert(filling_);
+    filling_ = false;
+    ++num_submitted_;
+}
+
+int buffer_ring::buffer_returned() {
+    assert(num_submitted_ > 0);
+    const int slot = next_return_;
+    next_return_ = (next_return_ + 1) % num_slots_;
+    --num_queued_;
+    if (--num_submitted_ == 0) {
+        ++underruns_;
+        stable_count_ = 0;
+        if (config_.adaptive && target_ < num_slots_) {
+            ++target_;
+        }
+    } else if (config_.adaptive && ++stable_count_ >= config_.shrink_after) {
+        stable_count_ = 0;
+        if (target_ > config_.min_buffers) {
+            --target_;
+        }
+    }
+    return slot;
+}
@@ -0,0 +1,64 @@
+#ifndef SAMPEDIT_BASE_BUFFER_RING_H
+#define SAMPEDIT_BASE_BUFFER_RING_H
+
+#include <vector>
+#include <stdint.h>
+
+struct buffer_ring_config {
+    int  buffer_frames = 2048;  // Stereo frames per buffer
+    int  num_buffers   = 2;     // Buffers queued to the device (initially, when adaptive)
+    // Adaptive mode: Add a buffer after each underrun and remove one after shrink_after stable buffers
+    bool adaptive      = false;
+    int  min_buffers   = 2;
+    int  max_buffers   = 8;
+    int  shrink_after  = 2000;
+};
+
+// Ring of interleaved 16-bit stereo buffers between a producer (the render thread) and a consumer (the sound device),
+// which returns the buffers in the order they were queued. The storage for every slot (max_buffers when adaptive)
+// is allocated up front.
+// Not synchronized: The device callbacks and the render thread must share a lock around calls.
+class buffer_ring {
+public:
+    explicit buffer_ring(const buffer_ring_config& config);
+
+    int buffer_frames() const { return config_.buffer_frames; }
+    // Number of buffer slots, i.e. the largest number of buffers that can ever be queued
+    int num_slots() const { return num_slots_; }
+    short* data(int slot) { return &data_[slot * config_.buffer_frames * 2]; }
+
+    // Buffers to keep queued
+    int target() const { return target_; }
+    // Buffers being filled or played
+    int queued() const { return num_queued_; }
+    // Frames handed to the consumer and not returned yet, i.e. how far ahead of the playback the next buffer starts
+    // (counting the buffer being played in full)
+    int frames_ahead() const { return num_submitted_ * config_.buffer_frames; }
+    uint32_t underruns() const { return underruns_; }
+
+    bool can_fill() const { return !filling_ && num_queued_ < target_; }
+
+    // Producer: Returns the slot to fill next. It counts as queued from now on.
+    int begin_fill();
+    // Producer: The slot from begin_fill has been handed to the consumer.
+    void end_fill();
+
+    // Consumer: The oldest buffer handed over has been played. Returns its slot.
+    // Running out of buffers to play means the producer didn't keep up, which is counted as an underrun.
+    int buffer_returned();
+
+private:
+    const buffer_ring_config config_;
+    const int                num_slots_;
+    std::vector<short>       data_;
+    int                      target_;
+    int                      num_queued_ = 0;
+    int                      num_submitted_ = 0;
+    int                      next_fill_ = 0;
+    int                      next_return_ = 0;
+    bool                     filling_ = false;
+    int                      stable_count_ = 0;
+    uint32_t                 underruns_ = 0;
+};
+
+#endif
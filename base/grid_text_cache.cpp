@@ -0,0 +1,72 @@
+#include "grid_text_cache.h"
+#include <cassert>
+
+const char* grid_text_cache::text(const virtual_grid& grid) {
+    update_layout(grid);
+    const int key = grid.content_key();
+    if (key < 0) {
+        format(grid, uncached_);
+        return uncached_.data();
+    }
+    if (key >= static_cast<int>(texts_.size())) {
+        texts_.resize(key + 1);
+    }
+    auto& text = texts_[key];
+    if (text.empty()) {
+        format(grid, text);
+    }
+    assert(text.size() == static_cast<size_t>(grid.rows() * row_stride()));
+    return text.data();
+}
+
+void grid_text_cache::invalidate(int key) {
+    if (key >= 0 && key < static_cast<int>(texts_.size())) {
+        std::vector<char>{}.swap(texts_[key]);
+    }
+}
+
+void grid_text_cache::clear() {
+    texts_.clear();
+    uncached_.clear();
+}
+
+size_t grid_text_cache::memory_used() const {
+    size_t size = uncached_.capacity();
+    for (const auto& t : texts_) {
+        size += t.capacity();
+    }
+    return size;
+}
+
+void grid_text_cache::update_layout(const virtual_grid& grid) {
+    // Everything cached was formatted with the current layout, start over if it has changed
+    const int columns = grid.columns();
+    bool changed = static_cast<int>(column_offsets_.size()) != columns + 1;
+    if (changed) {
+        column_offsets_.resize(columns + 1);
+        column_offsets_[0] = 0;
+    }
+    for (int c = 0; c < columns; ++c) {
+        const int end = column_offsets_[c] + grid.column_width(c);
+        if (column_offsets_[c + 1] != end) {
+            column_offsets_[c + 1] = end;
+            changed = true;
+        }
+    }
+    if (changed) {
+        clear();
+    }
+}
+
+void grid_text_cache::format(const virtual_grid& grid, std::vector<char>& text) const {
+    const int rows    = grid.rows();
+    const int columns = static_cast<int>(column_offsets_.size()) - 1;
+    const int stride  = row_stride();
+    text.resize(rows * stride);
+    for (int r = 0; r < rows; ++r) {
+        char* row = text.data() + r * stride;
+        for (int c = 0; c < columns; ++c) {
+            grid.format_cell(r, c, row + column_offsets_[c]);
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef SAMPEDIT_BASE_GRID_TEXT_CACHE_H
+#define SAMPEDIT_BASE_GRID_TEXT_CACHE_H
+
+#include <base/virtual_grid.h>
+#include <vector>
+#include <stddef.h>
+
+// Fully formatted text of virtual_grid contents, one flat array per content key (e.g. the pattern index).
+// The text is formatted the first time a key is shown and kept until invalidated, so showing it again doesn't format anything.
+// Rows are stored back to back with every cell at the same offset in each row.
+class grid_text_cache {
+public:
+    // Text of the grid's current content. Stays valid until the next call to text, invalidate or clear.
+    const char* text(const virtual_grid& grid);
+
+    // Layout of the text returned by the last call to text
+    int row_stride() const { return column_offsets_.empty() ? 0 : column_offsets_.back(); }
+    int column_offset(int column) const { return column_offsets_[column]; }
+
+    // Call when the content with the key has changed
+    void invalidate(int key);
+    void clear();
+
+    size_t memory_used() const;
+
+private:
+    std::vector<int>               column_offsets_; // One per column followed by the row length
+    std::vector<std::vector<char>> texts_;          // Indexed by key, empty when not formatted
+    std::vector<char>              uncached_;       // Content without a key
+
+    void update_layout(const virtual_grid& grid);
+    void format(const virtual_grid& grid, std::vector<char>& text) const;
+};
+
+#endif
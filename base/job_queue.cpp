@@ -1,6 +1,7 @@
 #include "job_queue.h"
 
 #include <queue>
+#include <atomic>
 #include <mutex>
 #include <thread>
 #include <cassert>
@@ -15,6 +16,7 @@ public:
     void post(const job_type& job) {
         std::lock_guard<std::mutex> lock{mutex_};
         jobs_.push(job);
+        size_.store(static_cast<int>(jobs_.size()), std::memory_order_relaxed);
     }
 
     void dispatch(const job_type& job) {
@@ -33,6 +35,7 @@ public:
                 }
                 sync_cv.notify_one();
             });
+            size_.store(static_cast<int>(jobs_.size()), std::memory_order_relaxed);
         }
         std::unique_lock<std::mutex> sync_lock{sync_mutex};
         sync_cv.wait(sync_lock, [&] { return sync; });
@@ -50,6 +53,7 @@ public:
             }
 
             jobs = std::move(jobs_);
+            size_.store(0, std::memory_order_relaxed);
         }
         while (!jobs.empty()) {
             jobs.front()();
@@ -57,6 +61,10 @@ public:
         }
     }
 
+    int size() const {
+        return size_.load(std::memory_order_relaxed);
+    }
+
 #ifndef NDEBUG
     void assert_in_queue_thread() const {
         std::lock_guard<std::mutex> lock{mutex_};
@@ -67,6 +75,7 @@ public:
 private:
     mutable std::mutex   mutex_;
     std::queue<job_type> jobs_;
+    std::atomic<int>     size_{0};
     std::thread::id      thread_id_;
 };
 
@@ -87,6 +96,10 @@ void job_queue::perform_all() {
     impl_->perform_all();
 }
 
+int job_queue::size() const {
+    return impl_->size();
+}
+
 #ifndef NDEBUG
 void job_queue::assert_in_queue_thread() const {
     impl_->assert_in_queue_thread();
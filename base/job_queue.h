@@ -15,6 +15,9 @@ public:
     void dispatch(const job_type& job);
     void perform_all();
 
+    // Number of jobs waiting to be performed, can be called from any thread
+    int size() const;
+
 #ifndef NDEBUG
     void assert_in_queue_thread() const;
 #else
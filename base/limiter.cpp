@@ -0,0 +1,99 @@
+#include "limiter.h"
+#include "simd.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+constexpr int limiter::chunk_size;
+
+limiter::limiter(int sample_rate, float threshold, float release_seconds)
+    : threshold_(threshold)
+    , release_step_(1.0f / (release_seconds * sample_rate)) {
+    assert(threshold_ > 0 && release_step_ > 0);
+    for (auto& s : work_) s = 0.0f;
+    for (auto& g : box_) g = 1.0f;
+}
+
+void limiter::process(float* stereo_buffer, int num_stereo_samples, float scale) {
+    while (num_stereo_samples) {
+        const int now = std::min(num_stereo_samples, chunk_size);
+        process_chunk(stereo_buffer, now, scale);
+        stereo_buffer      += 2 * now;
+        num_stereo_samples -= now;
+    }
+}
+
+float limiter::next_gain(float peak) {
+    const float required = peak > threshold_ ? threshold_ / peak : 1.0f;
+
+    // Trailing minimum over the last look_ahead frames
+    while (min_count_ && min_gain_[(min_head_ + min_count_ - 1) % look_ahead] >= required) {
+        --min_count_;
+    }
+    if (min_count_ && min_frame_[min_head_] <= frame_ - look_ahead) {
+        min_head_ = (min_head_ + 1) % look_ahead;
+        --min_count_;
+    }
+    assert(min_count_ < look_ahead);
+    const int tail = (min_head_ + min_count_) % look_ahead;
+    min_frame_[tail] = frame_;
+    min_gain_[tail]  = required;
+    ++min_count_;
+    ++frame_;
+
+    held_gain_ = std::min(min_gain_[min_head_], held_gain_ + release_step_);
+
+    box_sum_      += held_gain_ - box_[box_pos_];
+    box_[box_pos_] = held_gain_;
+    box_pos_       = (box_pos_ + 1) % look_ahead;
+    return static_cast<float>(box_sum_ / look_ahead);
+}
+
+void limiter::process_chunk(float* stereo_buffer, int num_stereo_samples, float scale) {
+    assert(num_stereo_samples > 0 && num_stereo_samples <= chunk_size);
+    const int n = num_stereo_samples * 2;
+    float* const in = &work_[2 * latency];
+
+    //
+    // Scale into the work buffer (behind the delayed frames) and find the per frame peaks
+    //
+    int i = 0;
+#ifdef SAMPEDIT_HAVE_SSE2
+    const __m128 vscale   = _mm_set1_ps(scale);
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    for (; i + 4 <= n; i += 4) {
+        const __m128 v = _mm_mul_ps(_mm_loadu_ps(stereo_buffer + i), vscale);
+        _mm_storeu_ps(in + i, v);
+        const __m128 a = _mm_and_ps(v, abs_mask);
+        // (l0 r0 l1 r1) -> max(l0, r0), max(l1, r1)
+        const __m128 m = _mm_max_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)));
+        float peaks[4];
+        _mm_storeu_ps(peaks, m);
+        gains_[i / 2]     = next_gain(peaks[0]);
+        gains_[i / 2 + 1] = next_gain(peaks[2]);
+    }
+#endif
+    for (; i < n; i += 2) {
+        in[i]     = stereo_buffer[i] * scale;
+        in[i + 1] = stereo_buffer[i + 1] * scale;
+        gains_[i / 2] = next_gain(std::max(std::fabs(in[i]), std::fabs(in[i + 1])));
+    }
+
+    //
+    // Apply the gain envelope to the delayed frames
+    //
+    i = 0;
+#ifdef SAMPEDIT_HAVE_SSE2
+    for (; i + 4 <= n; i += 4) {
+        const __m128 g = _mm_set_ps(gains_[i / 2 + 1], gains_[i / 2 + 1], gains_[i / 2], gains_[i / 2]);
+        _mm_storeu_ps(stereo_buffer + i, _mm_mul_ps(_mm_loadu_ps(work_ + i), g));
+    }
+#endif
+    for (; i < n; ++i) {
+        stereo_buffer[i] = work_[i] * gains_[i / 2];
+    }
+
+    // Keep the last frames as the new delay line
+    memmove(work_, work_ + n, 2 * latency * sizeof(float));
+}
@@ -0,0 +1,50 @@
+#ifndef SAMPEDIT_BASE_LIMITER_H
+#define SAMPEDIT_BASE_LIMITER_H
+
+#include <stdint.h>
+
+// Look-ahead peak limiter for interleaved stereo data.
+// The gain is the minimum required gain over the last look_ahead frames (with a linear release)
+// smoothed by a look_ahead long box filter, so it has reached its target when the peak leaves the delay line.
+// Introduces a fixed latency of look_ahead-1 frames and never allocates.
+class limiter {
+public:
+    static constexpr int look_ahead = 64;
+    static constexpr int latency    = look_ahead - 1;
+
+    explicit limiter(int sample_rate, float threshold = 0.98f, float release_seconds = 0.1f);
+
+    // Limits the num_stereo_samples frames in stereo_buffer (scaled by scale first) in place
+    void process(float* stereo_buffer, int num_stereo_samples, float scale);
+
+    // Current gain reduction (1 = none)
+    float gain() const { return static_cast<float>(box_sum_ / look_ahead); }
+
+private:
+    static constexpr int chunk_size = 256;
+
+    const float threshold_;
+    const float release_step_;
+
+    // Delay line (latency frames) followed by the current chunk
+    float       work_[2 * (latency + chunk_size)];
+    float       gains_[chunk_size];
+
+    // Monotonic queue of (frame, required gain) for the trailing minimum
+    int64_t     min_frame_[look_ahead];
+    float       min_gain_[look_ahead];
+    int         min_head_ = 0;
+    int         min_count_ = 0;
+    int64_t     frame_ = 0;
+    float       held_gain_ = 1.0f;
+
+    // Box filter
+    float       box_[look_ahead];
+    int         box_pos_ = 0;
+    double      box_sum_ = look_ahead;
+
+    void process_chunk(float* stereo_buffer, int num_stereo_samples, float scale);
+    float next_gain(float peak);
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "log_ring.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <cassert>
+#include <cstdarg>
+#include <cwchar>
+#include <cstdio>
+
+class log_ring::impl {
+public:
+    explicit impl() : thread_([this] { drain(); }) {
+        static_assert((num_records & (num_records - 1)) == 0, "num_records must be a power of 2");
+    }
+
+    ~impl() {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+        flush();
+    }
+
+    void write(uint32_t key, bool limited, const wchar_t* format, va_list args) {
+        uint32_t suppressed = 0;
+        if (limited) {
+            auto& slot = find_limit_slot(key);
+            const auto now = std::chrono::steady_clock::now();
+            if (slot.used && now - slot.last < std::chrono::milliseconds(rate_limit_ms)) {
+                ++slot.suppressed;
+                return;
+            }
+            suppressed      = slot.suppressed;
+            slot.used       = true;
+            slot.key        = key;
+            slot.last       = now;
+            slot.suppressed = 0;
+        }
+
+        const uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == num_records) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        auto& text = records_[head % num_records];
+        int len = vswprintf(text, max_message_length, format, args);
+        if (len < 0) {
+            // Truncated
+            len = max_message_length - 1;
+            text[len] = L'\0';
+        }
+        if (suppressed && len < max_message_length - 1) {
+            // Replace the trailing newline (if any) to put the count on the same line
+            if (len && text[len - 1] == L'\n') --len;
+            swprintf(text + len, max_message_length - len, L" (%u similar messages suppressed)\n", suppressed);
+        }
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+private:
+    // Enough for the keys used (the player has about a hundred), keys that don't fit share overflow_slot_
+    static constexpr int num_limit_slots = 256;
+
+    struct limit_slot {
+        bool                                  used = false;
+        uint32_t                              key = 0;
+        uint32_t                              suppressed = 0;
+        std::chrono::steady_clock::time_point last;
+    };
+
+    wchar_t                 records_[num_records][max_message_length];
+    std::atomic<uint32_t>   head_{0};
+    std::atomic<uint32_t>   tail_{0};
+    std::atomic<uint32_t>   dropped_{0};
+    limit_slot              limit_slots_[num_limit_slots];
+    limit_slot              overflow_slot_;
+    std::mutex              mutex_;
+    std::condition_variable cv_;
+    bool                    stop_ = false;
+    // must be last
+    std::thread             thread_;
+
+    static uint32_t hash(uint32_t key) {
+        key ^= key >> 16;
+        key *= 0x45d9f3b;
+        key ^= key >> 16;
+        return key;
+    }
+
+    // The slot of key (linear probing, slots are never freed), unused if the key hasn't been seen before
+    limit_slot& find_limit_slot(uint32_t key) {
+        static_assert((num_limit_slots & (num_limit_slots - 1)) == 0, "num_limit_slots must be a power of 2");
+        uint32_t index = hash(key);
+        for (int i = 0; i < num_limit_slots; ++i, ++index) {
+            auto& slot = limit_slots_[index % num_limit_slots];
+            if (!slot.used || slot.key == key) {
+                return slot;
+            }
+        }
+        return overflow_slot_;
+    }
+
+    void flush() {
+        const uint32_t head = head_.load(std::memory_order_acquire);
+        uint32_t       tail = tail_.load(std::memory_order_relaxed);
+        for (; tail != head; ++tail) {
+            fputws(records_[tail % num_records], stdout);
+        }
+        tail_.store(tail, std::memory_order_release);
+        if (const uint32_t dropped = dropped_.exchange(0, std::memory_order_relaxed)) {
+            wprintf(L"(%u log messages dropped)\n", dropped);
+        }
+    }
+
+    void drain() {
+        std::unique_lock<std::mutex> lock{mutex_};
+        while (!stop_) {
+            // The writer never signals (that could block), so poll
+            cv_.wait_for(lock, std::chrono::milliseconds(20));
+            flush();
+        }
+    }
+};
+
+log_ring::log_ring() : impl_(std::make_unique<impl>()) {
+}
+
+log_ring::~log_ring() = default;
+
+void log_ring::write(const wchar_t* format, ...) {
+    va_list args;
+    va_start(args, format);
+    impl_->write(0, false, format, args);
+    va_end(args);
+}
+
+void log_ring::write_limited(uint32_t key, const wchar_t* format, ...) {
+    va_list args;
+    va_start(args, format);
+    impl_->write(key, true, format, args);
+    va_end(args);
+}
@@ -0,0 +1,33 @@
+#ifndef SAMPEDIT_BASE_LOG_RING_H
+#define SAMPEDIT_BASE_LOG_RING_H
+
+#include <memory>
+#include <stdint.h>
+
+// Console log usable from the audio thread. Messages are formatted into preallocated fixed-size records
+// of a lock-free single producer/single consumer ring and written to the console by a background thread.
+// Writing never blocks or allocates, messages are dropped (and counted) when the ring is full.
+class log_ring {
+public:
+    static constexpr int max_message_length = 128;
+    static constexpr int num_records        = 256;
+    static constexpr int rate_limit_ms      = 1000;
+
+    explicit log_ring();
+    ~log_ring();
+
+    log_ring(const log_ring&) = delete;
+    log_ring& operator=(const log_ring&) = delete;
+
+    // printf-style message, must only be called from one thread
+    void write(const wchar_t* format, ...);
+
+    // As write, but at most one message per key every rate_limit_ms. The number of suppressed messages is added to the next one.
+    void write_limited(uint32_t key, const wchar_t* format, ...);
+
+private:
+    class impl;
+    std::unique_ptr<impl> impl_;
+};
+
+#endif
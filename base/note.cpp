@@ -15,15 +15,28 @@ float piano_key_to_freq(piano_key n, piano_key base_key /*= piano_key::A_4*/, fl
 }
 
 std::string piano_key_to_string(piano_key n)
+{
+    char s[3];
+    format_piano_key(s, n);
+    return std::string(s, sizeof(s));
+}
+
+char* format_piano_key(char* dst, piano_key n)
 {
     assert(n != piano_key::NONE);
-    if (n == piano_key::OFF) return "^^^";
+    if (n == piano_key::OFF) {
+        dst[0] = dst[1] = dst[2] = '^';
+        return dst + 3;
+    }
     const int val    = static_cast<int>(n);
     const int octave = val/12;
     const int note   = val%12;
     assert(octave >= 0 && octave <= 9);
-    static const char* const note_names[12] ={"C-", "C#", "D-", "D#", "E-", "F-", "F#", "G-", "G#", "A-", "A#", "B-"};
-    return note_names[note] + std::to_string(octave);
+    static const char note_names[12][2] ={{'C','-'}, {'C','#'}, {'D','-'}, {'D','#'}, {'E','-'}, {'F','-'}, {'F','#'}, {'G','-'}, {'G','#'}, {'A','-'}, {'A','#'}, {'B','-'}};
+    dst[0] = note_names[note][0];
+    dst[1] = note_names[note][1];
+    dst[2] = static_cast<char>('0' + octave);
+    return dst + 3;
 }
 
 piano_key key_to_note(int vk) {
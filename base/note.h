@@ -38,6 +38,9 @@ float piano_key_to_freq(piano_key n, piano_key base_key = piano_key::A_4, float
 
 std::string piano_key_to_string(piano_key n);
 
+// Writes the 3 character name of n (e.g. "C#5") to dst and returns the position after it
+char* format_piano_key(char* dst, piano_key n);
+
 piano_key key_to_note(int vk);
 
 #endif
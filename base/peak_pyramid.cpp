@@ -0,0 +1,155 @@
+#include "peak_pyramid.h"
+#include <algorithm>
+#include <cassert>
+
+void peak_summary::add(float value) {
+    if (!count) {
+        min = max = value;
+    } else {
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+    sum_squares += value * value;
+    ++count;
+}
+
+void peak_summary::add(const peak_summary& other) {
+    if (!other.count) {
+        return;
+    }
+    if (!count) {
+        *this = other;
+        return;
+    }
+    min          = std::min(min, other.min);
+    max          = std::max(max, other.max);
+    sum_squares += other.sum_squares;
+    count       += other.count;
+}
+
+peak_pyramid::peak_pyramid(const peak_pyramid& other)
+    : length_(other.length_)
+    , own_(other.summaries_, other.summaries_ + other.level_start_.back())
+    , summaries_(own_.data())
+    , level_start_(other.level_start_) {
+}
+
+peak_pyramid& peak_pyramid::operator=(const peak_pyramid& other) {
+    if (this != &other) {
+        length_      = other.length_;
+        own_.assign(other.summaries_, other.summaries_ + other.level_start_.back());
+        summaries_   = own_.data();
+        level_start_ = other.level_start_;
+    }
+    return *this;
+}
+
+int peak_pyramid::num_summaries(int length) {
+    assert(length >= 0);
+    int count = 0;
+    int num_blocks = (length + block_size - 1) >> block_shift;
+    while (num_blocks) {
+        count += num_blocks;
+        if (num_blocks == 1) break;
+        num_blocks = (num_blocks + 1) / 2;
+    }
+    return count;
+}
+
+void peak_pyramid::layout(int length) {
+    assert(length >= 0);
+    length_ = length;
+    level_start_.assign(1, 0);
+    int num_blocks = (length + block_size - 1) >> block_shift;
+    while (num_blocks) {
+        level_start_.push_back(level_start_.back() + num_blocks);
+        if (num_blocks == 1) break;
+        num_blocks = (num_blocks + 1) / 2;
+    }
+}
+
+void peak_pyramid::build(const float* data, int length) {
+    layout(length);
+    own_.assign(level_start_.back(), peak_summary{});
+    summaries_ = own_.data();
+    update(data, 0, length);
+}
+
+void peak_pyramid::view(const peak_summary* summaries, int length) {
+    assert(summaries || !num_summaries(length));
+    layout(length);
+    own_.clear();
+    summaries_ = summaries;
+}
+
+void peak_pyramid::update(const float* data, int first, int last) {
+    assert(first >= 0 && first <= last && last <= length_);
+    assert(summaries_ == own_.data() || !level_start_.back());
+    if (first == last) {
+        return;
+    }
+    int first_block = first >> block_shift;
+    int last_block  = (last - 1) >> block_shift;
+    update_level0(data, first_block, last_block);
+    for (int level = 1; level < num_levels(); ++level) {
+        first_block >>= 1;
+        last_block  >>= 1;
+        update_level(level, first_block, last_block);
+    }
+}
+
+void peak_pyramid::update_level0(const float* data, int first_block, int last_block) {
+    peak_summary* blocks = &own_[level_start_[0]];
+    for (int b = first_block; b <= last_block; ++b) {
+        peak_summary s;
+        const int end = std::min((b + 1) << block_shift, length_);
+        for (int i = b << block_shift; i < end; ++i) {
+            s.add(data[i]);
+        }
+        blocks[b] = s;
+    }
+}
+
+void peak_pyramid::update_level(int level, int first_block, int last_block) {
+    const peak_summary* children = &own_[level_start_[level - 1]];
+    const int num_children       = level_start_[level] - level_start_[level - 1];
+    peak_summary* blocks         = &own_[level_start_[level]];
+    for (int b = first_block; b <= last_block; ++b) {
+        peak_summary s = children[2 * b];
+        if (2 * b + 1 < num_children) {
+            s.add(children[2 * b + 1]);
+        }
+        blocks[b] = s;
+    }
+}
+
+peak_summary peak_pyramid::summarize(const float* data, int first, int last) const {
+    assert(first >= 0 && first <= last && last <= length_);
+    peak_summary s;
+    int pos = first;
+    // Frames before the first whole block
+    for (; pos < last && (pos & (block_size - 1)); ++pos) {
+        s.add(data[pos]);
+    }
+    // The largest aligned blocks that fit (the last block may be short when it ends at length_)
+    while (pos < last) {
+        int level = -1;
+        for (int l = 0; l < num_levels(); ++l) {
+            const int shift = block_shift + l;
+            if ((pos & ((1 << shift) - 1)) || std::min(pos + (1 << shift), length_) > last) {
+                break;
+            }
+            level = l;
+        }
+        if (level < 0) {
+            break;
+        }
+        s.add(summaries_[level_start_[level] + (pos >> (block_shift + level))]);
+        pos = std::min(pos + (1 << (block_shift + level)), length_);
+    }
+    // Frames after the last whole block
+    for (; pos < last; ++pos) {
+        s.add(data[pos]);
+    }
+    return s;
+}
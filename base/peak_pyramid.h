@@ -0,0 +1,63 @@
+#ifndef SAMPEDIT_BASE_PEAK_PYRAMID_H
+#define SAMPEDIT_BASE_PEAK_PYRAMID_H
+
+#include <vector>
+#include <cmath>
+
+struct peak_summary {
+    float min         = 0.0f;
+    float max         = 0.0f;
+    float sum_squares = 0.0f;
+    int   count       = 0;
+
+    float rms() const { return count ? std::sqrt(sum_squares / count) : 0.0f; }
+
+    void add(float value);
+    void add(const peak_summary& other);
+};
+
+// Min/max/RMS summaries of sample data for drawing waveforms.
+// Level 0 summarizes blocks of block_size frames and each following level pairs of blocks from the level below,
+// so any range can be summarized from O(log(range)) blocks and at most 2*block_size frames at the edges.
+// The summaries of all levels are stored one after the other, so they can be saved and used in place (see view).
+class peak_pyramid {
+public:
+    static constexpr int block_shift = 4;
+    static constexpr int block_size  = 1 << block_shift;
+
+    peak_pyramid() = default;
+    // Copies own the summaries, also when copying a view
+    peak_pyramid(const peak_pyramid& other);
+    peak_pyramid& operator=(const peak_pyramid& other);
+
+    // (Re)builds the summaries for length frames of data
+    void build(const float* data, int length);
+
+    // Uses the num_summaries(length) summaries of a pyramid built for length frames (e.g. in a memory mapped file)
+    // instead of building them. The caller keeps them alive, they can't be updated.
+    void view(const peak_summary* summaries, int length);
+
+    // Recomputes the summaries of the blocks containing [first; last[ after the data there changed (not for views)
+    void update(const float* data, int first, int last);
+
+    // Summary of [first; last[, data must be the data the pyramid was built from
+    peak_summary summarize(const float* data, int first, int last) const;
+
+    int num_levels() const { return static_cast<int>(level_start_.size()) - 1; }
+
+    // The summaries of all levels, num_summaries(length) of them
+    const peak_summary* summaries() const { return summaries_; }
+    static int num_summaries(int length);
+
+private:
+    int                       length_ = 0;
+    std::vector<peak_summary> own_;
+    const peak_summary*       summaries_ = nullptr;             // own_.data() or viewed
+    std::vector<int>          level_start_ = std::vector<int>(1, 0); // Index of the first summary of each level and the end
+
+    void layout(int length);
+    void update_level0(const float* data, int first_block, int last_block);
+    void update_level(int level, int first_block, int last_block);
+};
+
+#endif
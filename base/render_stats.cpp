@@ -0,0 +1,187 @@
+#include "render_stats.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <sstream>
+#include <fstream>
+#include <cassert>
+#include <cwchar>
+
+namespace {
+
+constexpr auto relaxed = std::memory_order_relaxed;
+
+// Only the render thread writes the maximums, so there is no need for a compare-exchange loop
+void update_max(std::atomic<uint32_t>& max, uint32_t value) {
+    if (value > max.load(relaxed)) {
+        max.store(value, relaxed);
+    }
+}
+
+uint32_t elapsed_us(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+}
+
+int histogram_bucket(uint32_t us) {
+    int bucket = 0;
+    for (us >>= 1; us && bucket < render_stats_snapshot::num_buckets - 1; us >>= 1) {
+        ++bucket;
+    }
+    return bucket;
+}
+
+}
+
+std::string to_json(const render_stats_snapshot& s) {
+    std::ostringstream oss;
+    oss << "{\n";
+    oss << "  \"buffers\": " << s.buffers << ",\n";
+    oss << "  \"render_time_histogram_us\": [";
+    for (int i = 0; i < render_stats_snapshot::num_buckets; ++i) {
+        oss << (i ? ", " : "") << s.render_time_histogram[i];
+    }
+    oss << "],\n";
+    oss << "  \"last_render_us\": " << s.last_render_us << ",\n";
+    oss << "  \"max_render_us\": " << s.max_render_us << ",\n";
+    oss << "  \"buffer_us\": " << s.buffer_us << ",\n";
+    oss << "  \"cpu_load\": " << s.cpu_load() << ",\n";
+    oss << "  \"max_cpu_load\": " << s.max_cpu_load() << ",\n";
+    oss << "  \"last_interval_us\": " << s.last_interval_us << ",\n";
+    oss << "  \"max_jitter_us\": " << s.max_jitter_us << ",\n";
+    oss << "  \"ticks\": " << s.ticks << ",\n";
+    oss << "  \"last_tick_us\": " << s.last_tick_us << ",\n";
+    oss << "  \"max_tick_us\": " << s.max_tick_us << ",\n";
+    oss << "  \"job_queue_depth\": " << s.job_queue_depth << ",\n";
+    oss << "  \"max_job_queue_depth\": " << s.max_job_queue_depth << ",\n";
+    oss << "  \"active_voices\": " << s.active_voices << ",\n";
+    oss << "  \"underruns\": " << s.underruns << "\n";
+    oss << "}\n";
+    return oss.str();
+}
+
+render_stats::render_stats(int sample_rate) : sample_rate_(sample_rate) {
+    assert(sample_rate_ > 0);
+    for (auto& h : histogram_) h.store(0, relaxed);
+}
+
+void render_stats::buffer_started() {
+    const auto now = clock::now();
+    if (started_) {
+        const uint32_t interval = elapsed_us(buffer_start_, now);
+        const uint32_t expected = buffer_us_.load(relaxed);
+        last_interval_us_.store(interval, relaxed);
+        update_max(max_jitter_us_, interval > expected ? interval - expected : expected - interval);
+    }
+    started_      = true;
+    buffer_start_ = now;
+}
+
+void render_stats::buffer_finished(int num_stereo_samples) {
+    assert(started_ && num_stereo_samples > 0);
+    const uint32_t us = elapsed_us(buffer_start_, clock::now());
+    histogram_[histogram_bucket(us)].fetch_add(1, relaxed);
+    last_render_us_.store(us, relaxed);
+    update_max(max_render_us_, us);
+    buffer_us_.store(static_cast<uint32_t>(num_stereo_samples * 1000000LL / sample_rate_), relaxed);
+    buffers_.fetch_add(1, relaxed);
+}
+
+void render_stats::tick_started(int queued_jobs) {
+    assert(queued_jobs >= 0);
+    tick_start_ = clock::now();
+    job_queue_depth_.store(static_cast<uint32_t>(queued_jobs), relaxed);
+    update_max(max_job_queue_depth_, static_cast<uint32_t>(queued_jobs));
+}
+
+void render_stats::tick_finished() {
+    const uint32_t us = elapsed_us(tick_start_, clock::now());
+    last_tick_us_.store(us, relaxed);
+    update_max(max_tick_us_, us);
+    ticks_.fetch_add(1, relaxed);
+}
+
+void render_stats::active_voices(int count) {
+    assert(count >= 0);
+    active_voices_.store(static_cast<uint32_t>(count), relaxed);
+}
+
+void render_stats::underrun() {
+    underruns_.fetch_add(1, relaxed);
+}
+
+render_stats_snapshot render_stats::snapshot() const {
+    render_stats_snapshot s;
+    s.buffers = buffers_.load(relaxed);
+    for (int i = 0; i < render_stats_snapshot::num_buckets; ++i) {
+        s.render_time_histogram[i] = histogram_[i].load(relaxed);
+    }
+    s.last_render_us      = last_render_us_.load(relaxed);
+    s.max_render_us       = max_render_us_.load(relaxed);
+    s.buffer_us           = buffer_us_.load(relaxed);
+    s.last_interval_us    = last_interval_us_.load(relaxed);
+    s.max_jitter_us       = max_jitter_us_.load(relaxed);
+    s.ticks               = ticks_.load(relaxed);
+    s.last_tick_us        = last_tick_us_.load(relaxed);
+    s.max_tick_us         = max_tick_us_.load(relaxed);
+    s.job_queue_depth     = job_queue_depth_.load(relaxed);
+    s.max_job_queue_depth = max_job_queue_depth_.load(relaxed);
+    s.active_voices       = active_voices_.load(relaxed);
+    s.underruns           = underruns_.load(relaxed);
+    return s;
+}
+
+class render_stats_writer::impl {
+public:
+    explicit impl(const render_stats& stats, const std::string& filename, int interval_ms)
+        : stats_(stats)
+        , filename_(filename)
+        , interval_ms_(interval_ms)
+        , thread_([this] { run(); }) {
+        assert(interval_ms_ > 0);
+    }
+
+    ~impl() {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+        write();
+    }
+
+private:
+    const render_stats&     stats_;
+    const std::string       filename_;
+    const int               interval_ms_;
+    std::mutex              mutex_;
+    std::condition_variable cv_;
+    bool                    stop_ = false;
+    // must be last
+    std::thread             thread_;
+
+    bool write() {
+        std::ofstream out(filename_, std::ofstream::trunc);
+        out << to_json(stats_.snapshot());
+        if (!out) {
+            wprintf(L"Could not write render stats to '%S'\n", filename_.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock{mutex_};
+        while (!cv_.wait_for(lock, std::chrono::milliseconds(interval_ms_), [this] { return stop_; })) {
+            if (!write()) {
+                return;
+            }
+        }
+    }
+};
+
+render_stats_writer::render_stats_writer(const render_stats& stats, const std::string& filename, int interval_ms)
+    : impl_(std::make_unique<impl>(stats, filename, interval_ms)) {
+}
+
+render_stats_writer::~render_stats_writer() = default;
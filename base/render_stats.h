@@ -0,0 +1,97 @@
+#ifndef SAMPEDIT_BASE_RENDER_STATS_H
+#define SAMPEDIT_BASE_RENDER_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+// Copy of the render_stats counters. The fields are read one at a time, so they may come from different buffers.
+struct render_stats_snapshot {
+    // Bucket 0 counts render times below 2 us, bucket i [2^i; 2^(i+1)[ us and the last bucket everything longer
+    static constexpr int num_buckets = 20;
+
+    uint32_t buffers;
+    uint32_t render_time_histogram[num_buckets];
+    uint32_t last_render_us;
+    uint32_t max_render_us;
+    uint32_t buffer_us;           // Duration of the last buffer
+    uint32_t last_interval_us;    // Time between the starts of the last two callbacks
+    uint32_t max_jitter_us;       // Largest difference between a callback interval and the buffer duration
+    uint32_t ticks;
+    uint32_t last_tick_us;
+    uint32_t max_tick_us;
+    uint32_t job_queue_depth;     // Jobs performed by the last tick
+    uint32_t max_job_queue_depth;
+    uint32_t active_voices;
+    uint32_t underruns;
+
+    // Render time of the last buffer relative to its duration
+    float cpu_load() const { return buffer_us ? static_cast<float>(last_render_us) / buffer_us : 0.0f; }
+    float max_cpu_load() const { return buffer_us ? static_cast<float>(max_render_us) / buffer_us : 0.0f; }
+};
+
+std::string to_json(const render_stats_snapshot& s);
+
+// Render thread instrumentation. Updated by the render thread (except underrun which may be called from any thread)
+// through relaxed atomics, so snapshot can be called from any thread without ever blocking the audio.
+class render_stats {
+public:
+    explicit render_stats(int sample_rate);
+
+    render_stats(const render_stats&) = delete;
+    render_stats& operator=(const render_stats&) = delete;
+
+    // Render thread: around each buffer
+    void buffer_started();
+    void buffer_finished(int num_stereo_samples);
+
+    // Render thread: around each tick
+    void tick_started(int queued_jobs);
+    void tick_finished();
+
+    void active_voices(int count);
+    void underrun();
+
+    render_stats_snapshot snapshot() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    const int             sample_rate_;
+    clock::time_point     buffer_start_;
+    clock::time_point     tick_start_;
+    bool                  started_ = false;
+
+    std::atomic<uint32_t> buffers_{0};
+    std::atomic<uint32_t> histogram_[render_stats_snapshot::num_buckets];
+    std::atomic<uint32_t> last_render_us_{0};
+    std::atomic<uint32_t> max_render_us_{0};
+    std::atomic<uint32_t> buffer_us_{0};
+    std::atomic<uint32_t> last_interval_us_{0};
+    std::atomic<uint32_t> max_jitter_us_{0};
+    std::atomic<uint32_t> ticks_{0};
+    std::atomic<uint32_t> last_tick_us_{0};
+    std::atomic<uint32_t> max_tick_us_{0};
+    std::atomic<uint32_t> job_queue_depth_{0};
+    std::atomic<uint32_t> max_job_queue_depth_{0};
+    std::atomic<uint32_t> active_voices_{0};
+    std::atomic<uint32_t> underruns_{0};
+};
+
+// Periodically overwrites a file with the JSON representation of the stats from a background thread
+class render_stats_writer {
+public:
+    explicit render_stats_writer(const render_stats& stats, const std::string& filename, int interval_ms = 1000);
+    ~render_stats_writer();
+
+    render_stats_writer(const render_stats_writer&) = delete;
+    render_stats_writer& operator=(const render_stats_writer&) = delete;
+
+private:
+    class impl;
+    std::unique_ptr<impl> impl_;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include "s16_converter.h"
+#include "sample.h"
+#include "simd.h"
+
+s16_converter::s16_converter(s16_conversion mode) : mode_(mode) {
+    // Any non-zero seeds will do for xorshift32
+    rng_state_[0] = 0x12345678;
+    rng_state_[1] = 0x9abcdef1;
+    rng_state_[2] = 0x2468ace0;
+    rng_state_[3] = 0x13579bdf;
+}
+
+void s16_converter::convert(short* dst, const float* src, int count, float scale) {
+    assert(count >= 0);
+    switch (mode_) {
+    case s16_conversion::scalar:
+        convert_scalar(dst, src, count, scale);
+        return;
+    case s16_conversion::simd:
+        convert_simd(dst, src, count, scale, false);
+        return;
+    case s16_conversion::simd_dither:
+        convert_simd(dst, src, count, scale, true);
+        return;
+    }
+    assert(false);
+}
+
+void s16_converter::convert_scalar(short* dst, const float* src, int count, float scale) {
+    for (int i = 0; i < count; ++i) {
+        dst[i] = sample_to_s16(src[i]*scale);
+    }
+}
+
+#ifdef SAMPEDIT_HAVE_SSE2
+
+namespace {
+
+// xorshift32 on 4 independent lanes
+inline __m128i next_random(__m128i x) {
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    return x;
+}
+
+// Triangular PDF noise in ]-1; 1[ LSB: The difference of the two 16-bit halves of each random lane
+inline __m128 tpdf_noise(__m128i x) {
+    const __m128i lo = _mm_and_si128(x, _mm_set1_epi32(0xffff));
+    const __m128i hi = _mm_srli_epi32(x, 16);
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(lo, hi)), _mm_set1_ps(1.0f / 65536.0f));
+}
+
+}
+
+void s16_converter::convert_simd(short* dst, const float* src, int count, float scale, bool dither) {
+    const __m128 vscale = _mm_set1_ps(scale * 32767.0f);
+    const __m128 vmin   = _mm_set1_ps(-32768.0f);
+    const __m128 vmax   = _mm_set1_ps(32767.0f);
+    __m128i rng = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rng_state_));
+
+    auto convert4 = [&](const float* s) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(s), vscale);
+        if (dither) {
+            rng = next_random(rng);
+            v   = _mm_add_ps(v, tpdf_noise(rng));
+        }
+        // Clamp before converting, out of range values would otherwise become 0x80000000
+        v = _mm_min_ps(_mm_max_ps(v, vmin), vmax);
+        return _mm_cvtps_epi32(v);
+    };
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i a = convert4(src + i);
+        const __m128i b = convert4(src + i + 4);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(a, b));
+    }
+    if (i < count) {
+        // Pad the remaining (at most 7) samples to a full vector
+        float in[8] = { 0, };
+        short out[8];
+        for (int j = 0; j < count - i; ++j) in[j] = src[i + j];
+        const __m128i a = convert4(in);
+        const __m128i b = convert4(in + 4);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packs_epi32(a, b));
+        for (int j = 0; j < count - i; ++j) dst[i + j] = out[j];
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rng_state_), rng);
+}
+
+#else
+
+void s16_converter::convert_simd(short* dst, const float* src, int count, float scale, bool dither) {
+    if (!dither) {
+        convert_scalar(dst, src, count, scale);
+        return;
+    }
+    uint32_t x = rng_state_[0];
+    for (int i = 0; i < count; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        const float noise = (static_cast<int>(x & 0xffff) - static_cast<int>(x >> 16)) / 65536.0f;
+        dst[i] = sample_to_s16(src[i]*scale + noise / 32767.0f);
+    }
+    rng_state_[0] = x;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef SAMPEDIT_BASE_S16_CONVERTER_H
+#define SAMPEDIT_BASE_S16_CONVERTER_H
+
+#include <stdint.h>
+
+enum class s16_conversion {
+    scalar,      // sample_to_s16 per sample (reference)
+    simd,        // SSE2 convert and saturate, 4 samples at a time
+    simd_dither, // As simd, but with TPDF dither added before rounding
+};
+
+constexpr const char* const s16_conversion_name[] = { "scalar", "simd", "simd+dither" };
+
+// Converts floating point samples in [-1; 1] to signed 16-bit samples.
+// The dither state is kept between calls so consecutive buffers continue the same noise sequence.
+class s16_converter {
+public:
+    explicit s16_converter(s16_conversion mode = s16_conversion::simd);
+
+    s16_conversion mode() const { return mode_; }
+    void mode(s16_conversion mode) { mode_ = mode; }
+
+    void convert(short* dst, const float* src, int count, float scale);
+
+private:
+    s16_conversion mode_;
+    uint32_t       rng_state_[4];
+
+    void convert_scalar(short* dst, const float* src, int count, float scale);
+    void convert_simd(short* dst, const float* src, int count, float scale, bool dither);
+};
+
+#endif
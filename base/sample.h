@@ -5,6 +5,9 @@
 #include <cassert>
 #include <algorithm>
 #include <string>
+#include <memory>
+#include <atomic>
+#include <base/peak_pyramid.h>
 
 std::vector<float> convert_sample_data(const std::vector<signed char>& d);
 std::vector<float> convert_sample_data(const std::vector<unsigned char>& d);
@@ -12,15 +15,81 @@ std::vector<float> convert_sample_data(const std::vector<short>& d);
 
 enum class loop_type { none, forward, pingpong };
 
+// Frames of a sample, shared by copies of the sample until one of them is written to
+struct sample_frames {
+    std::vector<float>          data;
+    // Keeps read-only frames (and possibly peaks) outside this object alive, e.g. a memory mapped module cache or
+    // frames in the sample_store
+    std::shared_ptr<const void> storage;
+    const float*                frames = nullptr; // data.data() or in storage
+    const peak_pyramid*         peaks  = nullptr; // &own_peaks or in storage
+    peak_pyramid                own_peaks;
+    std::atomic<bool>           ready{false}; // Set once the frames and peaks are filled in
+};
+
 class sample {
 public:        
     explicit sample(const std::vector<float>& data, float c5_rate, const std::string& name)
-        : data_(data)
+        : frames_(std::make_shared<sample_frames>())
+        , length_(static_cast<int>(data.size()))
+        , c5_rate_(c5_rate)
+        , name_(name)
+        , loop_type_(loop_type::none)
+        , loop_start_(0)
+        , loop_length_(0) {
+        frames_->data   = data;
+        frames_->frames = frames_->data.data();
+        frames_->own_peaks.build(frames_->frames, length_);
+        frames_->peaks  = &frames_->own_peaks;
+        frames_->ready.store(true, std::memory_order_release);
+    }
+
+    // Sample using length read-only frames kept alive by storage, and the peak_pyramid summaries of them in peaks if not
+    // nullptr (see peak_pyramid::view). They are copied the first time the sample is written to.
+    explicit sample(const std::shared_ptr<const void>& storage, const float* frames, int length, float c5_rate, const std::string& name, const peak_summary* peaks = nullptr)
+        : frames_(std::make_shared<sample_frames>())
+        , length_(length)
         , c5_rate_(c5_rate)
         , name_(name)
         , loop_type_(loop_type::none)
         , loop_start_(0)
         , loop_length_(0) {
+        assert(storage && frames && length_ >= 0);
+        frames_->storage = storage;
+        frames_->frames  = frames;
+        if (peaks) {
+            frames_->own_peaks.view(peaks, length_);
+        } else {
+            frames_->own_peaks.build(frames_->frames, length_);
+        }
+        frames_->peaks   = &frames_->own_peaks;
+        frames_->ready.store(true, std::memory_order_release);
+    }
+
+    // Sample using the (ready) frames and peaks of shared, e.g. from the sample_store. They are copied the first time the
+    // sample is written to.
+    explicit sample(const std::shared_ptr<const sample_frames>& shared, float c5_rate, const std::string& name)
+        : frames_(std::make_shared<sample_frames>())
+        , length_(static_cast<int>(shared->data.size()))
+        , c5_rate_(c5_rate)
+        , name_(name)
+        , loop_type_(loop_type::none)
+        , loop_start_(0)
+        , loop_length_(0) {
+        use_shared(shared);
+    }
+
+    // Deferred sample: The length frames are filled in later with set_data (possibly from another thread).
+    // Until then the sample isn't ready() and nothing must read its frames.
+    explicit sample(int length, float c5_rate, const std::string& name)
+        : frames_(std::make_shared<sample_frames>())
+        , length_(length)
+        , c5_rate_(c5_rate)
+        , name_(name)
+        , loop_type_(loop_type::none)
+        , loop_start_(0)
+        , loop_length_(0) {
+        assert(length_ >= 0);
     }
 
     template<typename SampleType>
@@ -32,7 +101,25 @@ public:
 
     const std::string& name() const { return name_; }
 
-    int length() const { return static_cast<int>(data_.size()); }
+    int length() const { return length_; }
+
+    bool ready() const { return frames_->ready.load(std::memory_order_acquire); }
+
+    // Fills in the frames of a deferred sample, which is shared with all copies of it
+    void set_data(std::vector<float>&& data) {
+        assert(!ready() && static_cast<int>(data.size()) == length_);
+        frames_->data   = std::move(data);
+        frames_->frames = frames_->data.data();
+        frames_->own_peaks.build(frames_->frames, length_);
+        frames_->peaks  = &frames_->own_peaks;
+        frames_->ready.store(true, std::memory_order_release);
+    }
+
+    // Fills in the frames of a deferred sample with the frames and peaks of shared
+    void set_data(const std::shared_ptr<const sample_frames>& shared) {
+        assert(!ready() && static_cast<int>(shared->data.size()) == length_);
+        use_shared(shared);
+    }
     
     ::loop_type loop_type() const { return loop_type_; }
     int loop_start() const { return loop_start_; }
@@ -48,22 +135,55 @@ public:
     }
 
     float get(int pos) const {
-        return data_[pos];
+        assert(ready());
+        return frames_->frames[pos];
+    }
+
+    // Overwrites count frames starting at pos (copying the frames first if they are shared or read-only)
+    void write(int pos, const float* src, int count) {
+        assert(ready() && pos >= 0 && count >= 0 && pos + count <= length());
+        if (frames_.use_count() > 1 || frames_->storage) {
+            auto frames = std::make_shared<sample_frames>();
+            frames->data.assign(frames_->frames, frames_->frames + length_);
+            frames->frames    = frames->data.data();
+            frames->own_peaks = *frames_->peaks;
+            frames->peaks     = &frames->own_peaks;
+            frames->ready.store(true, std::memory_order_relaxed);
+            frames_ = std::move(frames);
+        }
+        std::copy(src, src + count, frames_->data.begin() + pos);
+        frames_->own_peaks.update(frames_->frames, pos, pos + count);
+    }
+
+    // Min/max/RMS of the frames in [first; last[ (from the peak pyramid rather than by visiting every frame)
+    peak_summary peaks(int first, int last) const {
+        assert(ready());
+        return frames_->peaks->summarize(frames_->frames, first, last);
     }
 
     float get_linear(float pos) const {
-        const int ipos   = static_cast<int>(pos);
-        const float frac = pos - static_cast<float>(ipos);
-        return data_[ipos]*(1.0f-frac) + data_[std::min(ipos+1, length()-1)]*frac;
+        const float* data = frames_->frames;
+        const int ipos    = static_cast<int>(pos);
+        const float frac  = pos - static_cast<float>(ipos);
+        return data[ipos]*(1.0f-frac) + data[std::min(ipos+1, length_-1)]*frac;
     }
 
 private:
-    std::vector<float> data_;
-    float              c5_rate_;
-    std::string        name_;
-    ::loop_type        loop_type_;
-    int                loop_start_;
-    int                loop_length_;
+    std::shared_ptr<sample_frames> frames_;
+    int                            length_;
+    float                          c5_rate_;
+    std::string                    name_;
+    ::loop_type                    loop_type_;
+    int                            loop_start_;
+    int                            loop_length_;
+
+    void use_shared(const std::shared_ptr<const sample_frames>& shared) {
+        assert(shared->ready.load(std::memory_order_acquire));
+        frames_->storage = shared;
+        frames_->frames  = shared->frames;
+        frames_->peaks   = shared->peaks;
+        frames_->ready.store(true, std::memory_order_release);
+    }
 };
 
 inline short sample_to_s16(float s) {
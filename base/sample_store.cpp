@@ -0,0 +1,115 @@
+#include "sample_store.h"
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <stdint.h>
+
+namespace {
+
+// FNV-1a over 64-bit words in four interleaved lanes (so the multiplications don't all wait on each other)
+uint64_t hash_frames(const std::vector<float>& data) {
+    constexpr uint64_t prime = 0x100000001b3ULL;
+    uint64_t lanes[4] = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL, 0xcbf29ce4cbf29ce4ULL, 0x8422232584222325ULL };
+    const auto* bytes = reinterpret_cast<const uint8_t*>(data.data());
+    const size_t size = data.size() * sizeof(float);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int l = 0; l < 4; ++l) {
+            uint64_t word;
+            memcpy(&word, bytes + i + l * 8, sizeof(word));
+            lanes[l] = (lanes[l] ^ word) * prime;
+        }
+    }
+    uint64_t h = (lanes[0] ^ (lanes[1] >> 1) ^ (lanes[2] >> 2) ^ (lanes[3] >> 3)) * prime;
+    for (; i < size; ++i) {
+        h = (h ^ bytes[i]) * prime;
+    }
+    return (h ^ size) * prime;
+}
+
+bool same_frames(const sample_frames& frames, const std::vector<float>& data) {
+    return frames.data.size() == data.size() && (data.empty() || !memcmp(frames.data.data(), data.data(), data.size() * sizeof(float)));
+}
+
+}
+
+class sample_store::impl {
+public:
+    std::shared_ptr<const sample_frames> intern(std::vector<float>&& data) {
+        const uint64_t hash = hash_frames(data);
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (auto frames = find(hash, data)) return frames;
+        }
+
+        // Build the peaks without holding the lock, another thread may add the same frames in the meantime
+        auto frames = std::make_shared<sample_frames>();
+        frames->data   = std::move(data);
+        frames->frames = frames->data.data();
+        frames->own_peaks.build(frames->frames, static_cast<int>(frames->data.size()));
+        frames->peaks  = &frames->own_peaks;
+        frames->ready.store(true, std::memory_order_release);
+
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (auto existing = find(hash, frames->data)) return existing;
+        entries_.emplace(hash, frames);
+        // Forget freed frames whenever the number of entries has doubled since the last time
+        if (entries_.size() >= 2 * live_after_sweep_) {
+            for (auto it = entries_.begin(); it != entries_.end();) {
+                it = it->second.expired() ? entries_.erase(it) : std::next(it);
+            }
+            live_after_sweep_ = std::max<size_t>(entries_.size(), 16);
+        }
+        return frames;
+    }
+
+    sample_store_stats stats() const {
+        sample_store_stats s;
+        std::lock_guard<std::mutex> lock{mutex_};
+        for (const auto& e : entries_) {
+            const auto frames = e.second.lock();
+            if (!frames || frames.use_count() < 2) continue; // Freed (or being freed)
+            const long users   = frames.use_count() - 1;
+            const size_t bytes = frames->data.size() * sizeof(float);
+            ++s.num_frames;
+            s.num_users += static_cast<int>(users);
+            (users > 1 ? s.shared_bytes : s.unique_bytes) += bytes;
+            s.saved_bytes += (users - 1) * bytes;
+        }
+        return s;
+    }
+
+private:
+    mutable std::mutex                                                      mutex_;
+    std::unordered_multimap<uint64_t, std::weak_ptr<const sample_frames>> entries_;
+    size_t                                                                  live_after_sweep_ = 16;
+
+    std::shared_ptr<const sample_frames> find(uint64_t hash, const std::vector<float>& data) const {
+        const auto range = entries_.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            auto frames = it->second.lock();
+            if (frames && same_frames(*frames, data)) return frames;
+        }
+        return nullptr;
+    }
+};
+
+sample_store& sample_store::instance() {
+    static sample_store store;
+    return store;
+}
+
+sample_store::sample_store() : impl_(std::make_unique<impl>()) {
+}
+
+sample_store::~sample_store() = default;
+
+std::shared_ptr<const sample_frames> sample_store::intern(std::vector<float>&& data) {
+    return impl_->intern(std::move(data));
+}
+
+sample_store_stats sample_store::stats() const {
+    return impl_->stats();
+}
@@ -0,0 +1,37 @@
+#ifndef SAMPEDIT_BASE_SAMPLE_STORE_H
+#define SAMPEDIT_BASE_SAMPLE_STORE_H
+
+#include <memory>
+#include <vector>
+#include <base/sample.h>
+
+struct sample_store_stats {
+    int    num_frames   = 0; // Distinct frames in the store
+    int    num_users    = 0; // Samples (not counting copies of the same sample) using them
+    size_t shared_bytes = 0; // Bytes in frames used by more than one sample
+    size_t unique_bytes = 0; // Bytes in frames used by a single sample
+    size_t saved_bytes  = 0; // Bytes the samples would use on top of shared_bytes without sharing
+};
+
+// Process-wide store of decoded sample frames by content, so identical samples (in different modules or loaded more
+// than once) share one copy of their frames and peaks. The store doesn't keep frames alive, they're freed when the
+// last sample using them is, and a sample copies its frames the first time it's written to.
+// Can be called from any thread.
+class sample_store {
+public:
+    static sample_store& instance();
+
+    // Frames equal to data (bitwise), from the store if they're already there and otherwise added
+    std::shared_ptr<const sample_frames> intern(std::vector<float>&& data);
+
+    sample_store_stats stats() const;
+
+private:
+    class impl;
+    const std::unique_ptr<impl> impl_;
+
+    explicit sample_store();
+    ~sample_store();
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "sample_voice.h"
+#include <base/simd.h>
 
 class sample_voice::impl {
 public:
@@ -10,11 +11,27 @@ public:
         state_ = state::not_playing;
     }
 
+    void fade_out(int num_stereo_samples) {
+        assert(num_stereo_samples > 0);
+        fade_left_   = num_stereo_samples;
+        fade_length_ = num_stereo_samples;
+    }
+
+    bool playing() const {
+        return state_ != state::not_playing;
+    }
+
+    float current_volume() const {
+        if (!playing()) return 0.0f;
+        return fade_left_ ? volume_ * fade_left_ / fade_length_ : volume_;
+    }
+
     void play(const ::sample& s, int pos) {
         assert(pos >= 0 && pos <= s.length());
         sample_ = &s;
         pos_    = static_cast<float>(pos);
         state_  = state::playing_forward;
+        fade_left_ = 0;
 
         // bergborr!.xm uses 9xy to start a looping sample at the very end?
         if (pos_ >= current_end()) {
@@ -28,6 +45,11 @@ public:
         incr_ = f / sample_rate_;
     }
 
+    void increment(float incr) {
+        assert(incr > 0);
+        incr_ = incr;
+    }
+
     void volume(float volume) {
         volume_ = volume;
     }
@@ -45,9 +67,52 @@ public:
         paused_ = pause;
     }
 
+    void tap(voice_tap* t) {
+        tap_ = t;
+    }
+
     void mix(float* stero_buffer, int num_stereo_samples) {
+        if (!tap_) {
+            mix_voice(stero_buffer, num_stereo_samples);
+            return;
+        }
+        // Mix through the scratch buffer of the tap, so it sees this voice alone
+        float* scratch = tap_->scratch();
+        while (num_stereo_samples) {
+            const int now = std::min(num_stereo_samples, voice_tap::scratch_frames);
+            std::fill(scratch, scratch + now * 2, 0.0f);
+            mix_voice(scratch, now);
+            tap_->process(scratch, now);
+            add_buffer(stero_buffer, scratch, now * 2);
+            stero_buffer       += now * 2;
+            num_stereo_samples -= now;
+        }
+    }
+
+private:
+    const int       sample_rate_;
+    const ::sample* sample_ = nullptr;
+    float           pos_;
+    float           incr_;
+    float           volume_;
+    float           panl_;
+    float           panr_;
+    bool            paused_ = false;
+    int             fade_left_ = 0;
+    int             fade_length_ = 0;
+    voice_tap*      tap_ = nullptr;
+    enum class state {
+        not_playing,
+        playing_forward,
+        playing_backward,
+    } state_ = state::not_playing;
+
+    void mix_voice(float* stero_buffer, int num_stereo_samples) {
         if (paused_ || state_ == state::not_playing) return;
         assert(sample_);
+        // Deferred samples play silently until their frames have been decoded (or for good if they never are), so the
+        // position and any fade out move on as if they were heard
+        const bool audible = sample_->ready();
 
         while (num_stereo_samples) {
             const int end = current_end();
@@ -79,30 +144,27 @@ public:
                 }
             }
 
-            const int now = std::min(samples_till_end, num_stereo_samples);
+            int now = std::min(samples_till_end, num_stereo_samples);
             assert(now > 0);
-            do_mix_sample(stero_buffer, now, *sample_, pos_, real_incr, volume_ * panl_, volume_ * panr_);
+            if (fade_left_) {
+                now = std::min(now, fade_left_);
+                const float start = volume_ * fade_left_ / fade_length_;
+                const float step  = -volume_ / fade_length_;
+                if (audible) do_mix_sample_ramp(stero_buffer, now, *sample_, pos_, real_incr, start * panl_, start * panr_, step * panl_, step * panr_);
+                fade_left_ -= now;
+                if (!fade_left_) {
+                    state_ = state::not_playing;
+                    break;
+                }
+            } else if (audible) {
+                do_mix_sample(stero_buffer, now, *sample_, pos_, real_incr, volume_ * panl_, volume_ * panr_);
+            }
             num_stereo_samples -= now;
             stero_buffer       += 2* now;
             pos_               += real_incr * now;
         }
     }
 
-private:
-    const int       sample_rate_;
-    const ::sample* sample_ = nullptr;
-    float           pos_;
-    float           incr_;
-    float           volume_;
-    float           panl_;
-    float           panr_;
-    bool            paused_ = false;
-    enum class state {
-        not_playing,
-        playing_forward,
-        playing_backward,
-    } state_ = state::not_playing;
-
     int current_end() const {
         if (sample_->loop_type() != loop_type::none) {
             return state_ == state::playing_backward ? sample_->loop_start() : sample_->loop_start() + sample_->loop_length();
@@ -111,6 +173,18 @@ private:
         }
     }
 
+    static void add_buffer(float* dst, const float* src, int count) {
+        int i = 0;
+#ifdef SAMPEDIT_HAVE_SSE2
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+        }
+#endif
+        for (; i < count; ++i) {
+            dst[i] += src[i];
+        }
+    }
+
     static void do_mix_sample(float* stero_buffer, int num_stereo_samples, const sample& samp, float pos, float incr, float lvol, float rvol) {
         for (int i = 0; i < num_stereo_samples; ++i) {
             const auto s = samp.get_linear(pos + i * incr);
@@ -118,6 +192,14 @@ private:
             stero_buffer[i*2+1] += s * rvol;
         }
     }
+
+    static void do_mix_sample_ramp(float* stero_buffer, int num_stereo_samples, const sample& samp, float pos, float incr, float lvol, float rvol, float lstep, float rstep) {
+        for (int i = 0; i < num_stereo_samples; ++i) {
+            const auto s = samp.get_linear(pos + i * incr);
+            stero_buffer[i*2+0] += s * (lvol + i * lstep);
+            stero_buffer[i*2+1] += s * (rvol + i * rstep);
+        }
+    }
 };
 
 sample_voice::sample_voice(int sample_rate) : impl_(std::make_unique<impl>(sample_rate)) {
@@ -139,6 +221,10 @@ void sample_voice::freq(float f) {
     impl_->freq(f);
 }
 
+void sample_voice::increment(float incr) {
+    impl_->increment(incr);
+}
+
 void sample_voice::volume(float volume) {
     impl_->volume(volume);
 }
@@ -151,6 +237,22 @@ void sample_voice::paused(bool pause) {
     impl_->paused(pause);
 }
 
+void sample_voice::tap(voice_tap* t) {
+    impl_->tap(t);
+}
+
+void sample_voice::fade_out(int num_stereo_samples) {
+    impl_->fade_out(num_stereo_samples);
+}
+
+bool sample_voice::playing() const {
+    return impl_->playing();
+}
+
+float sample_voice::current_volume() const {
+    return impl_->current_volume();
+}
+
 void sample_voice::do_mix(float* stero_buffer, int num_stereo_samples) {
     impl_->mix(stero_buffer, num_stereo_samples);
 }
\ No newline at end of file
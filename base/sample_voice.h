@@ -3,6 +3,7 @@
 
 #include <base/voice.h>
 #include <base/sample.h>
+#include <base/voice_tap.h>
 #include <memory>
 
 class sample_voice : public voice {
@@ -15,11 +16,22 @@ public:
 
     void play(const ::sample& s, int pos);
     void freq(float f);
+    void increment(float incr);
     void volume(float volume);
     void pan(float pan);
 
     void paused(bool pause);
 
+    // Mixer thread: Feeds what the voice mixes (silence when it isn't playing) to t, nullptr to detach.
+    // The tap must outlive the attachment.
+    void tap(voice_tap* t);
+
+    // Ramps the volume down to zero over num_stereo_samples and then stops
+    void fade_out(int num_stereo_samples);
+    bool playing() const;
+    // Volume including any fade out in progress
+    float current_volume() const;
+
 private:
     class impl;
     std::unique_ptr<impl> impl_;
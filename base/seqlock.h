@@ -0,0 +1,72 @@
+#ifndef SAMPEDIT_BASE_SEQLOCK_H
+#define SAMPEDIT_BASE_SEQLOCK_H
+
+#include <atomic>
+#include <thread>
+#include <type_traits>
+#include <cstring>
+#include <stdint.h>
+
+// "Latest value" slot with a single writer and any number of readers. Writing never blocks or allocates, so it can be
+// done from the audio thread. Readers retry if they overlap a write and only ever see complete values.
+// Readers that fall behind simply miss the intermediate values.
+template<typename T>
+class seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "seqlock values are copied word by word");
+public:
+    explicit seqlock(const T& value = T{}) {
+        store_words(value);
+    }
+
+    seqlock(const seqlock&) = delete;
+    seqlock& operator=(const seqlock&) = delete;
+
+    // Writer thread only
+    void store(const T& value) {
+        const uint32_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed); // odd while writing
+        std::atomic_thread_fence(std::memory_order_release);
+        store_words(value);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    // Copies the latest value to value and returns the number of stores so far, so callers can tell whether it
+    // has changed since they last looked
+    uint32_t load(T& value) const {
+        uint32_t words[num_words];
+        for (;;) {
+            const uint32_t seq = seq_.load(std::memory_order_acquire);
+            if (!(seq & 1)) {
+                for (int i = 0; i < num_words; ++i) {
+                    words[i] = words_[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq_.load(std::memory_order_relaxed) == seq) {
+                    std::memcpy(&value, words, sizeof(T));
+                    return seq / 2;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    uint32_t version() const {
+        return seq_.load(std::memory_order_acquire) / 2;
+    }
+
+private:
+    static constexpr int num_words = static_cast<int>((sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+
+    std::atomic<uint32_t> seq_{0};
+    std::atomic<uint32_t> words_[num_words];
+
+    void store_words(const T& value) {
+        uint32_t words[num_words] = {};
+        std::memcpy(words, &value, sizeof(T));
+        for (int i = 0; i < num_words; ++i) {
+            words_[i].store(words[i], std::memory_order_relaxed);
+        }
+    }
+};
+
+#endif
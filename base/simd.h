@@ -0,0 +1,10 @@
+#ifndef SAMPEDIT_BASE_SIMD_H
+#define SAMPEDIT_BASE_SIMD_H
+
+// SSE2 is always available on x64 and the default target for MSVC on x86
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define SAMPEDIT_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef SAMPEDIT_BASE_SPSC_RING_H
+#define SAMPEDIT_BASE_SPSC_RING_H
+
+#include <atomic>
+#include <vector>
+#include <cassert>
+#include <stddef.h>
+
+// Fixed capacity queue between exactly one producer thread and one consumer thread.
+// All storage is allocated up front and neither side ever blocks: push fails when the consumer has fallen
+// behind and the queue is full, pop fails when it's empty.
+template<typename T>
+class spsc_ring {
+public:
+    // The capacity is rounded up to a power of two
+    explicit spsc_ring(size_t capacity) : data_(round_up_pow2(capacity)), mask_(data_.size() - 1) {
+    }
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+    size_t capacity() const { return data_.size(); }
+
+    // Number of elements queued, exact only when called from the producer or consumer thread
+    size_t size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    // Producer
+    bool push(const T& value) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == data_.size()) {
+            return false;
+        }
+        data_[head & mask_] = value;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer
+    bool pop(T& value) {
+        return pop(&value, 1) == 1;
+    }
+
+    // Consumer: Pops up to max_count elements, returns the number popped
+    size_t pop(T* values, size_t max_count) {
+        const size_t tail  = tail_.load(std::memory_order_relaxed);
+        const size_t avail = head_.load(std::memory_order_acquire) - tail;
+        const size_t count = avail < max_count ? avail : max_count;
+        for (size_t i = 0; i < count; ++i) {
+            values[i] = data_[(tail + i) & mask_];
+        }
+        tail_.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    std::vector<T>      data_;
+    const size_t        mask_;
+    // Keep the producer and consumer positions on separate cache lines
+    char                pad0_[64];
+    std::atomic<size_t> head_{0}; // Written by the producer
+    char                pad1_[64];
+    std::atomic<size_t> tail_{0}; // Written by the consumer
+
+    static size_t round_up_pow2(size_t n) {
+        assert(n > 0);
+        size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef SAMPEDIT_BASE_TEXT_FORMAT_H
+#define SAMPEDIT_BASE_TEXT_FORMAT_H
+
+#include <cassert>
+
+// Fixed width formatting into character buffers without allocating or using iostreams.
+// Each function writes exactly the number of characters asked for and returns the position after them.
+
+// Hexadecimal (upper case unless asked otherwise), zero padded to digits (the value must fit)
+inline char* format_hex(char* dst, unsigned value, int digits, bool upper_case = true) {
+    assert(digits > 0 && (digits >= 8 || value < (1U << (4 * digits))));
+    const char* hex_digits = upper_case ? "0123456789ABCDEF" : "0123456789abcdef";
+    for (int i = digits - 1; i >= 0; --i) {
+        dst[i] = hex_digits[value & 0xf];
+        value >>= 4;
+    }
+    return dst + digits;
+}
+
+// Decimal, zero padded to digits (the value must fit)
+inline char* format_dec(char* dst, unsigned value, int digits) {
+    assert(digits > 0);
+    for (int i = digits - 1; i >= 0; --i) {
+        dst[i] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    assert(value == 0);
+    return dst + digits;
+}
+
+inline char* format_repeat(char* dst, char c, int count) {
+    for (int i = 0; i < count; ++i) {
+        dst[i] = c;
+    }
+    return dst + count;
+}
+
+#endif
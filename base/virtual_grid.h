@@ -1,28 +1,46 @@
 #ifndef SAMPEDIT_BASE_VIRTUAL_GRID_H
 #define SAMPEDIT_BASE_VIRTUAL_GRID_H
 
-#include <string>
+#include <cassert>
 
 class virtual_grid {
 public:
+    static constexpr int max_column_width = 32;
+
     virtual ~virtual_grid() {}
 
     int rows() const {
         return do_rows();
     }
 
-    std::vector<int> column_widths() const {
-        return do_column_widths();
+    int columns() const {
+        return do_columns();
+    }
+
+    // Every cell in a column is formatted to exactly this many characters
+    int column_width(int column) const {
+        const int width = do_column_width(column);
+        assert(width > 0 && width <= max_column_width);
+        return width;
+    }
+
+    // Identifies what the grid currently shows (e.g. the pattern index), cells with the same key format the same until
+    // the content is edited. Negative if the content can't be cached.
+    int content_key() const {
+        return do_content_key();
     }
 
-    std::string cell_value(int row, int column) const {
-        return do_cell_value(row, column);
+    // Writes the column_width(column) characters of the cell (no terminator) to buffer without allocating
+    void format_cell(int row, int column, char* buffer) const {
+        do_format_cell(row, column, buffer);
     }
 
 private:
     virtual int do_rows() const = 0;
-    virtual std::vector<int> do_column_widths() const = 0;
-    virtual std::string do_cell_value(int row, int column) const = 0;
+    virtual int do_columns() const = 0;
+    virtual int do_column_width(int column) const = 0;
+    virtual void do_format_cell(int row, int column, char* buffer) const = 0;
+    virtual int do_content_key() const { return -1; }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,29 @@
+#include "voice_command.h"
+#include "sample_voice.h"
+#include <cassert>
+
+void voice_command::perform() const {
+    assert(voice);
+    switch (what) {
+    case type::play:
+        assert(samp);
+        voice->play(*samp, param);
+        return;
+    case type::freq:
+        voice->freq(value);
+        return;
+    case type::volume:
+        voice->volume(value);
+        return;
+    case type::pan:
+        voice->pan(value);
+        return;
+    case type::key_off:
+        voice->key_off();
+        return;
+    case type::fade_out:
+        voice->fade_out(param);
+        return;
+    }
+    assert(false);
+}
@@ -0,0 +1,27 @@
+#ifndef SAMPEDIT_BASE_VOICE_COMMAND_H
+#define SAMPEDIT_BASE_VOICE_COMMAND_H
+
+class sample;
+class sample_voice;
+
+// A sample_voice parameter change as plain data, so commands can be queued and timestamped without allocating
+struct voice_command {
+    enum class type { play, freq, volume, pan, key_off, fade_out };
+
+    sample_voice*  voice;
+    type           what;
+    const sample*  samp;   // play
+    float          value;  // freq, volume, pan
+    int            param;  // play: position, fade_out: number of frames
+
+    static voice_command play(sample_voice& v, const sample& s, int pos) { return { &v, type::play, &s, 0.0f, pos }; }
+    static voice_command freq(sample_voice& v, float f) { return { &v, type::freq, nullptr, f, 0 }; }
+    static voice_command volume(sample_voice& v, float vol) { return { &v, type::volume, nullptr, vol, 0 }; }
+    static voice_command pan(sample_voice& v, float pan) { return { &v, type::pan, nullptr, pan, 0 }; }
+    static voice_command key_off(sample_voice& v) { return { &v, type::key_off, nullptr, 0.0f, 0 }; }
+    static voice_command fade_out(sample_voice& v, int num_stereo_samples) { return { &v, type::fade_out, nullptr, 0.0f, num_stereo_samples }; }
+
+    void perform() const;
+};
+
+#endif
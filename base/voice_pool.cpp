@@ -0,0 +1,66 @@
+#include "voice_pool.h"
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+voice_pool::voice_pool(int sample_rate, int num_voices, int release_stereo_samples)
+    : owned_(num_voices)
+    , age_(num_voices)
+    , release_stereo_samples_(release_stereo_samples) {
+    assert(num_voices > 0 && release_stereo_samples > 0);
+    voices_.reserve(num_voices);
+    for (int i = 0; i < num_voices; ++i) {
+        voices_.emplace_back(sample_rate);
+    }
+}
+
+sample_voice& voice_pool::allocate() {
+    int   best     = -1;
+    float best_vol = 0;
+    for (int i = 0; i < size(); ++i) {
+        if (owned_[i]) {
+            continue;
+        }
+        if (!voices_[i].playing()) {
+            best = i;
+            break;
+        }
+        const float vol = voices_[i].current_volume();
+        if (best < 0 || vol < best_vol || (vol == best_vol && age_[i] < age_[best])) {
+            best     = i;
+            best_vol = vol;
+        }
+    }
+    if (best < 0) {
+        assert(false);
+        throw std::runtime_error("Voice pool exhausted");
+    }
+    auto& v = voices_[best];
+    if (v.playing()) {
+        v.key_off(); // Steal
+    }
+    owned_[best] = true;
+    age_[best]   = allocations_++;
+    return v;
+}
+
+void voice_pool::release(sample_voice& v) {
+    release(v, release_stereo_samples_);
+}
+
+void voice_pool::release(sample_voice& v, int fade_stereo_samples) {
+    const auto index = &v - voices_.data();
+    assert(index >= 0 && index < size() && owned_[index]);
+    owned_[index] = false;
+    if (v.playing()) {
+        v.fade_out(std::max(fade_stereo_samples, release_stereo_samples_));
+    }
+}
+
+int voice_pool::active_voices() const {
+    int count = 0;
+    for (const auto& v : voices_) {
+        if (v.playing()) ++count;
+    }
+    return count;
+}
@@ -0,0 +1,40 @@
+#ifndef SAMPEDIT_BASE_VOICE_POOL_H
+#define SAMPEDIT_BASE_VOICE_POOL_H
+
+#include <base/sample_voice.h>
+#include <vector>
+#include <stdint.h>
+
+// Fixed set of voices shared by a number of owners (e.g. tracker channels).
+// An owner keeps its voice until it releases it, after which the voice fades out in the background.
+// All voices are allocated up front, allocate/release never allocate memory.
+class voice_pool {
+public:
+    // num_voices must be at least the number of voices owned at the same time
+    explicit voice_pool(int sample_rate, int num_voices, int release_stereo_samples);
+    voice_pool(const voice_pool&) = delete;
+    voice_pool& operator=(const voice_pool&) = delete;
+
+    int size() const { return static_cast<int>(voices_.size()); }
+    sample_voice& operator[](int index) { return voices_[index]; }
+
+    // Returns an unowned voice, preferring idle voices and otherwise stealing the quietest (then oldest) fading voice
+    sample_voice& allocate();
+
+    // Fades v out in the background and makes it available for allocation
+    void release(sample_voice& v);
+    // As release, but fading out over fade_stereo_samples (at least the pool's release time) e.g. for instrument tails
+    void release(sample_voice& v, int fade_stereo_samples);
+
+    // Number of voices that are playing (owned or fading)
+    int active_voices() const;
+
+private:
+    std::vector<sample_voice> voices_;
+    std::vector<uint8_t>      owned_;
+    std::vector<uint32_t>     age_;     // Allocation number
+    const int                 release_stereo_samples_;
+    uint32_t                  allocations_ = 0;
+};
+
+#endif
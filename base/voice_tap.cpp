@@ -0,0 +1,93 @@
+#include "voice_tap.h"
+#include <base/simd.h>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+namespace {
+
+// Peak and sum of squares of each channel of interleaved stereo frames
+void measure(const float* s, int num_stereo_samples, float peak[2], float sum_squares[2]) {
+    int i = 0;
+    float pl = 0.0f, pr = 0.0f, sl = 0.0f, sr = 0.0f;
+#ifdef SAMPEDIT_HAVE_SSE2
+    // Two frames (LRLR) per vector
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 vpeak = _mm_setzero_ps();
+    __m128 vsum  = _mm_setzero_ps();
+    for (; i + 2 <= num_stereo_samples; i += 2) {
+        const __m128 v = _mm_loadu_ps(s + i * 2);
+        vpeak = _mm_max_ps(vpeak, _mm_and_ps(v, abs_mask));
+        vsum  = _mm_add_ps(vsum, _mm_mul_ps(v, v));
+    }
+    alignas(16) float p[4], q[4];
+    _mm_store_ps(p, vpeak);
+    _mm_store_ps(q, vsum);
+    pl = std::max(p[0], p[2]);
+    pr = std::max(p[1], p[3]);
+    sl = q[0] + q[2];
+    sr = q[1] + q[3];
+#endif
+    for (; i < num_stereo_samples; ++i) {
+        const float l = s[i * 2], r = s[i * 2 + 1];
+        pl = std::max(pl, std::fabs(l));
+        pr = std::max(pr, std::fabs(r));
+        sl += l * l;
+        sr += r * r;
+    }
+    peak[0]        = std::max(peak[0], pl);
+    peak[1]        = std::max(peak[1], pr);
+    sum_squares[0] += sl;
+    sum_squares[1] += sr;
+}
+
+}
+
+voice_tap::voice_tap(int level_frames, int decimation, int level_capacity, int waveform_capacity)
+    : level_frames_(level_frames)
+    , decimation_(decimation)
+    , levels_(level_capacity)
+    , waveform_(waveform_capacity)
+    , scratch_(scratch_frames * 2) {
+    assert(level_frames_ > 0 && decimation_ > 0);
+}
+
+void voice_tap::process(const float* stereo_buffer, int num_stereo_samples) {
+    while (num_stereo_samples) {
+        const int now = std::min(num_stereo_samples, level_frames_ - level_count_);
+        measure(stereo_buffer, now, peak_, sum_squares_);
+        level_count_ += now;
+        if (level_count_ == level_frames_) {
+            tap_levels levels;
+            for (int ch = 0; ch < 2; ++ch) {
+                levels.peak[ch] = peak_[ch];
+                levels.rms[ch]  = std::sqrt(sum_squares_[ch] / level_frames_);
+                peak_[ch] = sum_squares_[ch] = 0.0f;
+            }
+            if (!levels_.push(levels)) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+            level_count_ = 0;
+        }
+
+        for (; next_waveform_ < now; next_waveform_ += decimation_) {
+            const float* frame = stereo_buffer + next_waveform_ * 2;
+            if (!waveform_.push(0.5f * (frame[0] + frame[1]))) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        next_waveform_ -= now;
+
+        stereo_buffer      += now * 2;
+        num_stereo_samples -= now;
+    }
+}
+
+bool voice_tap::pop_levels(tap_levels& levels) {
+    return levels_.pop(levels);
+}
+
+int voice_tap::pop_waveform(float* samples, int max_count) {
+    assert(max_count >= 0);
+    return static_cast<int>(waveform_.pop(samples, static_cast<size_t>(max_count)));
+}
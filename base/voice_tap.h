@@ -0,0 +1,55 @@
+#ifndef SAMPEDIT_BASE_VOICE_TAP_H
+#define SAMPEDIT_BASE_VOICE_TAP_H
+
+#include <base/spsc_ring.h>
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+// Levels of one block of level_frames frames, index 0 is the left channel
+struct tap_levels {
+    float peak[2];
+    float rms[2];
+};
+
+// Monitoring tap for scopes and level meters. The render thread feeds it the signal of a voice (or the whole mix)
+// and another thread reads the block levels and the decimated (mono) waveform at its own pace.
+// Everything is preallocated, if the reader falls behind new values are dropped and counted.
+class voice_tap {
+public:
+    // Larger than any buffer the mixer renders, so voices mixing through the scratch buffer don't have to split the mix
+    static constexpr int scratch_frames = 4096;
+
+    explicit voice_tap(int level_frames = 512, int decimation = 16, int level_capacity = 64, int waveform_capacity = 4096);
+
+    voice_tap(const voice_tap&) = delete;
+    voice_tap& operator=(const voice_tap&) = delete;
+
+    // Render thread: Measures num_stereo_samples interleaved frames
+    void process(const float* stereo_buffer, int num_stereo_samples);
+
+    // Render thread: Room for scratch_frames frames to separate the monitored signal in before calling process
+    float* scratch() { return scratch_.data(); }
+
+    // Reader thread
+    bool pop_levels(tap_levels& levels);
+    int pop_waveform(float* samples, int max_count);
+
+    // Values the reader didn't make room for in time
+    uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    const int             level_frames_;
+    const int             decimation_;
+    spsc_ring<tap_levels> levels_;
+    spsc_ring<float>      waveform_;
+    std::atomic<uint32_t> dropped_{0};
+    std::vector<float>    scratch_;
+    // Render thread state
+    int                   level_count_ = 0;     // Frames measured for the current block
+    float                 peak_[2] = {};
+    float                 sum_squares_[2] = {};
+    int                   next_waveform_ = 0;   // Frames until the next waveform sample
+};
+
+#endif
@@ -12,9 +12,11 @@
 
 #include <base/job_queue.h>
 #include <base/sample_voice.h>
+#include <base/sample_store.h>
 #include "module.h"
 #include "mixer.h"
 #include "mod_player.h"
+#include "module_loader.h"
 
 std::vector<float> create_sample(int len, float freq, int rate=44100)
 {
@@ -31,8 +33,7 @@ public:
     virtual void do_order_change(int order) = 0;
 };
 
-#include <iomanip>
-#include <sstream>
+#include <base/text_format.h>
 
 class test_grid : public mod_like_grid {
 public:
@@ -43,14 +44,26 @@ private:
     virtual int do_rows() const override {
         return 64;
     }
-    virtual std::vector<int> do_column_widths() const override {
-        return { 9, 9, 9, 9 };
+    virtual int do_columns() const override {
+        return 4;
     }
-    virtual std::string do_cell_value(int row, int column) const override {
-        std::ostringstream ss;
-        ss << std::hex << std::setfill('0');
-        ss << '(' << std::setw(2) << column << ", " << std::setw(2) << row << ')';
-        return ss.str();
+    virtual int do_column_width(int) const override {
+        return 9;
+    }
+    virtual int do_content_key() const override {
+        return 0;
+    }
+    virtual void do_format_cell(int row, int column, char* buffer) const override {
+        // "(cc, rr)" in lower case hex, padded to the column width
+        char* p = buffer;
+        *p++ = '(';
+        p = format_hex(p, column, 2, false);
+        *p++ = ',';
+        *p++ = ' ';
+        p = format_hex(p, row, 2, false);
+        *p++ = ')';
+        p = format_repeat(p, ' ', column_width(column) - static_cast<int>(p - buffer));
+        assert(p - buffer == column_width(column));
     }
 };
 
@@ -71,29 +84,38 @@ private:
     int order_ = 0;
 
     virtual int do_rows() const override {
-        return 64;
+        return mod_.num_rows(order_);
     }
 
-    virtual std::vector<int> do_column_widths() const override {
-        return std::vector<int>(mod_.num_channels, mod_.type == module_type::mod ? 10 : 13);
+    virtual int do_columns() const override {
+        return mod_.num_channels;
     }
 
-    virtual std::string do_cell_value(int row, int column) const override {
-        assert(row >= 0 && row < mod_player::max_rows);
+    virtual int do_column_width(int) const override {
+        return mod_.type == module_type::mod ? 10 : 13;
+    }
+
+    virtual int do_content_key() const override {
+        return mod_.order[order_];
+    }
+
+    virtual void do_format_cell(int row, int column, char* buffer) const override {
+        assert(row >= 0 && row < mod_.num_rows(order_));
         assert(column >= 0 && column < mod_.num_channels);
-        std::ostringstream ss;
         const auto& note = mod_.at(order_, row)[column];
-        ss << std::setfill('0') << std::uppercase;
+        char* p = buffer;
         if (note.note != piano_key::NONE) {
-            ss << piano_key_to_string(note.note) << ' ';
+            p = format_piano_key(p, note.note);
         } else {
-            ss << "... ";
+            p = format_repeat(p, '.', 3);
         }
+        *p++ = ' ';
         if (note.instrument) {
-            ss << std::setw(2) << (int)note.instrument << ' ';
+            p = format_dec(p, note.instrument, 2);
         } else {
-            ss << ".. ";
+            p = format_repeat(p, '.', 2);
         }
+        *p++ = ' ';
         if (mod_.type != module_type::mod) {
             if (note.volume != volume_command::none) {
                 int vol = static_cast<int>(note.volume);
@@ -101,33 +123,28 @@ private:
                     assert(note.volume >= volume_command::set_00 && note.volume <= volume_command::set_40);
                     vol -= static_cast<int>(volume_command::set_00);
                 }
-                ss << std::setw(2) << std::hex << (int)vol << ' ';
+                p = format_hex(p, vol, 2);
             } else {
-                ss << ".. ";
+                p = format_repeat(p, '.', 2);
             }
+            *p++ = ' ';
         }
         if (note.effect) {
-            ss << std::hex;
             if (mod_.type == module_type::mod) {
-                ss << std::setw(3) << (int)note.effect;
-            } else if (mod_.type == module_type::s3m) {
-                ss << (char)((note.effect >> 8) + 'A' - 1);
-                ss << std::setw(2) << (int)(note.effect & 0xff);
+                p = format_hex(p, note.effect, 3);
             } else {
-                assert(mod_.type == module_type::xm);
-                const int effect_type = (note.effect >> 8);
-                assert(effect_type < 38);
-                ss << "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[effect_type];
-                ss << std::setw(2) << (int)(note.effect & 0xff);
+                assert(mod_.type == module_type::s3m || mod_.type == module_type::xm);
+                *p++ = effect_type_char(mod_.type, note.effect >> 8);
+                p = format_hex(p, note.effect & 0xff, 2);
             }
         } else {
-            ss << "...";
+            p = format_repeat(p, '.', 3);
         }
-        assert(ss.str().length() == column_widths()[column]);
-        return ss.str();
+        assert(p - buffer == column_width(column));
     }
 };
 
+// Auditions samples. The commands are applied at the frame matching the key press rather than at the next tick.
 class keyboard_voice : public sample_voice {
 public:
     keyboard_voice(mixer& m) : sample_voice(m.sample_rate()), mixer_(m) {
@@ -140,10 +157,11 @@ public:
     void play_sample(const sample& samp, piano_key key) {
         const auto freq = piano_key_to_freq(key, piano_key::C_5, samp.c5_rate());
         wprintf(L"Playing %S at %f Hz\n", piano_key_to_string(key).c_str(), freq);
-        mixer_.tick_queue().post([&, freq] {
-            this->freq(freq);
-            this->play(samp, 0);
-        });
+        mixer_.post_immediate(voice_command::freq(*this, freq));
+        mixer_.post_immediate(voice_command::play(*this, samp, 0));
+    }
+    void release() {
+        mixer_.post_immediate(voice_command::key_off(*this));
     }
 
     keyboard_voice(const keyboard_voice&) = delete;
@@ -157,12 +175,43 @@ int main(int argc, char* argv[])
 {
     try {
         mixer m;
+        // 2.9 ms buffers for auditioning samples, adding a buffer if the device can't keep up. A key press is heard
+        // after the rest of the buffer being played and the queued ones: 2.9 - 5.8 ms with two buffers, up to
+        // 8.7 ms with three. A fourth would take it past 10 ms, so a device that still underruns with three has to
+        // live with the dropouts.
+        buffer_ring_config preview_config;
+        preview_config.buffer_frames = 128;
+        preview_config.num_buffers   = 2;
+        preview_config.adaptive      = true;
+        preview_config.min_buffers   = 2;
+        preview_config.max_buffers   = 3;
+        mixer preview_mixer{preview_config, mixer_mode::monitoring};
+
+        // Set SAMPEDIT_RENDER_STATS to the name of a file to periodically dump the render stats to
+        std::unique_ptr<render_stats_writer> stats_writer;
+        char stats_filename[MAX_PATH];
+        const DWORD stats_filename_len = GetEnvironmentVariableA("SAMPEDIT_RENDER_STATS", stats_filename, MAX_PATH);
+        if (stats_filename_len && stats_filename_len < MAX_PATH) {
+            stats_writer.reset(new render_stats_writer(m.stats(), stats_filename));
+        }
 
         const module* mod_ = nullptr;
+        std::unique_ptr<module_loader> loader;
         std::unique_ptr<mod_player> mod_player_;
         std::unique_ptr<mod_like_grid> grid;
+        const int skip_to = argc > 2 ? std::stoi(argv[2]) : 0;
         if (argc > 1) {
-            mod_player_.reset(new mod_player(load_module(argv[1]), m));
+            // Set SAMPEDIT_MODULE_CACHE to a directory to keep decoded modules in for faster startup
+            char cache_directory[MAX_PATH];
+            const DWORD cache_directory_len = GetEnvironmentVariableA("SAMPEDIT_MODULE_CACHE", cache_directory, MAX_PATH);
+            const bool use_cache = cache_directory_len && cache_directory_len < MAX_PATH;
+            // Start as soon as the samples of the first pattern are decoded. The other samples are decoded in the
+            // background when the player gets close to them or they're displayed, the unused ones never.
+            loader.reset(new module_loader{argv[1], 0, sample_decoding::on_demand, use_cache ? cache_directory : ""});
+            mod_player_.reset(new mod_player(loader->take_playable(skip_to), m));
+            mod_player_->on_instrument_needed([&loader](int instrument) {
+                loader->request(instrument);
+            });
             auto& mod = mod_player_->mod();
             wprintf(L"Loaded '%S' - '%S' %d channels\n", argv[1], mod.name.c_str(), mod.num_channels);
             for (size_t i = 0; i < mod.instruments.size(); ++i) {
@@ -185,11 +234,20 @@ int main(int argc, char* argv[])
         assert(mod_);
         main_wnd.set_module(*mod_);
 
-        keyboard_voice kv{m};
+        if (loader) {
+            main_wnd.on_sample_selected([&](int index) {
+                loader->request(index);
+            });
+            if (main_wnd.current_sample_index() >= 0) {
+                loader->request(main_wnd.current_sample_index());
+            }
+        }
+
+        keyboard_voice kv{preview_mixer};
         main_wnd.on_piano_key_pressed([&](piano_key key) {
             assert(key != piano_key::NONE);
             if (key == piano_key::OFF) {
-                m.tick_queue().post([&] { kv.key_off(); } );
+                kv.release();
                 return;
             }
             const int idx = main_wnd.current_sample_index();
@@ -205,21 +263,8 @@ int main(int argc, char* argv[])
         ShowWindow(main_wnd.hwnd(), SW_SHOW);
         UpdateWindow(main_wnd.hwnd());
 
-        job_queue gui_jobs;
-        const DWORD gui_thread_id = GetCurrentThreadId();
-        auto add_gui_job = [&gui_jobs, gui_thread_id] (const job_queue::job_type& job) {
-            gui_jobs.post(job);
-            PostThreadMessage(gui_thread_id, WM_NULL, 0, 0);
-        };
-
         bool exiting = false;
         if (mod_player_) {
-            mod_player_->on_position_changed([&](const module_position& pos) {
-                add_gui_job([&main_wnd, &grid, pos] {
-                    grid->do_order_change(pos.order);
-                    main_wnd.position_changed(pos);
-                });
-            });
             main_wnd.on_exiting([&]() {
                 wprintf(L"Exiting\n");
                 exiting = true;
@@ -228,18 +273,47 @@ int main(int argc, char* argv[])
             main_wnd.on_order_selected([&](int order) {
                mod_player_->skip_to_order(order);
             });
-            const int skip_to = argc > 2 ? std::stoi(argv[2]) : 0;
             if (skip_to > 0) {
                 mod_player_->skip_to_order(skip_to);
             }
             mod_player_->toggle_playing();
         }
 
+        // Poll the render stats for the info window
+        constexpr UINT render_stats_interval_ms = 250;
+        const UINT_PTR render_stats_timer = SetTimer(nullptr, 0, render_stats_interval_ms, nullptr);
+        int samples_decoded = 0;
+
+        // Poll the player position once per display frame, however many rows have been played since
+        constexpr UINT position_interval_ms = 16;
+        const UINT_PTR position_timer = mod_player_ ? SetTimer(nullptr, 0, position_interval_ms, nullptr) : 0;
+        uint32_t position_version = 0;
+
         MSG msg;
         while (GetMessage(&msg, nullptr, 0, 0)) {
-            if (msg.hwnd == nullptr && msg.message == WM_NULL) {
-                if (!exiting) {
-                    gui_jobs.perform_all();
+            if (msg.hwnd == nullptr && msg.message == WM_TIMER) {
+                if (exiting) {
+                    continue;
+                }
+                if (msg.wParam == render_stats_timer) {
+                    main_wnd.render_stats_changed(m.stats().snapshot());
+                    if (loader) {
+                        const auto progress = loader->progress();
+                        if (progress.samples_decoded != samples_decoded) {
+                            samples_decoded = progress.samples_decoded;
+                            const auto store = sample_store::instance().stats();
+                            wprintf(L"Decoded %d/%d samples (%d KB unique, %d KB shared, %d KB saved by sharing)\n", progress.samples_decoded, progress.num_samples,
+                                static_cast<int>(store.unique_bytes / 1024), static_cast<int>(store.shared_bytes / 1024), static_cast<int>(store.saved_bytes / 1024));
+                        }
+                    }
+                } else if (msg.wParam == position_timer) {
+                    module_position pos;
+                    const uint32_t version = mod_player_->position(pos);
+                    if (version != position_version) {
+                        position_version = version;
+                        grid->do_order_change(pos.order);
+                        main_wnd.position_changed(pos);
+                    }
                 }
             } else {
                 TranslateMessage(&msg);
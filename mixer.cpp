@@ -1,15 +1,36 @@
 #include "mixer.h"
 #include <win32/wavedev.h>
 #include <base/sample.h>
+#include <base/limiter.h>
 
 #include <vector>
+#include <chrono>
+#include <mutex>
 #include <cassert>
 #include <algorithm>
 
+namespace {
+
+template<typename T>
+std::vector<T> reserved(size_t capacity)
+{
+    std::vector<T> v;
+    v.reserve(capacity);
+    return v;
+}
+
+}
+
 class mixer::impl {
 public:
-    explicit impl()
-        : wavedev_(sample_rate_, 4096, [this](short* s, size_t num_stereo_samples) { render(s, static_cast<int>(num_stereo_samples)); }) {
+    explicit impl(const buffer_ring_config& device_config, mixer_mode mode)
+        : mode_(mode)
+        , limiter_(sample_rate_)
+        , stats_(sample_rate_)
+        , immediate_posted_(reserved<immediate_event>(max_timed_commands))
+        , immediate_events_(reserved<immediate_event>(max_timed_commands))
+        , timed_commands_(max_timed_commands)
+        , wavedev_(sample_rate_, device_config, [this](short* s, size_t num_stereo_samples, size_t frames_ahead) { render(s, static_cast<int>(num_stereo_samples), static_cast<int>(frames_ahead)); }, [this] { stats_.underrun(); }) {
     }
 
     int sample_rate() const {
@@ -20,6 +41,32 @@ public:
         return at_next_tick_;
     }
 
+    render_stats& stats() {
+        return stats_;
+    }
+
+    void post_immediate(const voice_command& command) {
+        // Take the time with the lock held to keep the events ordered
+        std::lock_guard<std::mutex> lock{immediate_mutex_};
+        immediate_posted_.push_back(immediate_event{clock::now(), command});
+    }
+
+    bool post_at(int num_stereo_samples, const voice_command& command) {
+        at_next_tick_.assert_in_queue_thread();
+        assert(num_stereo_samples >= 0);
+        if (num_timed_ == max_timed_commands) {
+            return false;
+        }
+        const int64_t frame = frame_ + num_stereo_samples;
+        // Insert from the back (commands are mostly posted in order), after any commands for the same frame to keep the posting order
+        int pos = num_timed_++;
+        for (; pos > 0 && timed_command_at(pos - 1).frame > frame; --pos) {
+            timed_command_at(pos) = timed_command_at(pos - 1);
+        }
+        timed_command_at(pos) = timed_command{frame, command};
+        return true;
+    }
+
     void add_voice(voice& v) {
         at_next_tick_.assert_in_queue_thread();
         voices_.push_back(&v);
@@ -42,23 +89,108 @@ public:
         global_volume_ = vol;
     }
 
+    void output_conversion(s16_conversion conv) {
+        at_next_tick_.assert_in_queue_thread();
+        converter_.mode(conv);
+    }
+
+    void tap(voice_tap* t) {
+        at_next_tick_.assert_in_queue_thread();
+        tap_ = t;
+    }
+
 private:
     static constexpr int sample_rate_ = 44100;
 
+    using clock = std::chrono::steady_clock;
+
+    static_assert((max_timed_commands & (max_timed_commands - 1)) == 0, "max_timed_commands must be a power of two");
+
+    struct immediate_event {
+        clock::time_point    time;
+        voice_command        command;
+    };
+
+    struct timed_command {
+        int64_t              frame;
+        voice_command        command;
+    };
+
+    const mixer_mode     mode_;
     std::vector<voice*>  voices_;
     std::vector<float>   mix_buffer_;
     int                  next_tick_ = 0;
     int                  ticks_per_second_ = 50; // 125 BPM = 125 * 2 / 5 = 50 Hz
     float                global_volume_ = 1.0f;
+    limiter              limiter_;
+    s16_converter        converter_;
     job_queue            at_next_tick_;
+    render_stats         stats_;
+    std::mutex           immediate_mutex_;
+    std::vector<immediate_event> immediate_posted_;
+    // Owned by the render thread, swapped with immediate_posted_ to keep the capacity of both (reserved up front)
+    std::vector<immediate_event> immediate_events_;
+    // Frames from a render to the end of its buffer's playback, the largest seen so far
+    int                  immediate_latency_ = 0;
+    // Ring of max_timed_commands sorted by frame starting at first_timed_, owned by the render thread
+    std::vector<timed_command> timed_commands_;
+    int                  first_timed_ = 0;
+    int                  num_timed_ = 0;
+    int64_t              frame_ = 0; // Absolute position of the next frame to mix
+    voice_tap*           tap_ = nullptr;
     // must be last
     wavedev              wavedev_;
 
     void tick() {
+        stats_.tick_started(at_next_tick_.size());
         at_next_tick_.perform_all();
+        stats_.tick_finished();
     }
 
-    void render(short* s, int num_stereo_samples) {
+    // Schedules the events posted since the last buffer immediate_latency_ frames after they were posted, so they're
+    // heard with their original spacing. The time a frame is heard comes from the device position (the frames_ahead
+    // frames queued before this buffer) rather than from when the buffers are rendered, which happens back to back
+    // whenever the device has more than one free buffer. Events that don't fit in the ring of timed commands are
+    // performed at once.
+    void take_immediate_events(clock::time_point render_start, int num_stereo_samples, int frames_ahead) {
+        assert(immediate_events_.empty());
+        {
+            std::lock_guard<std::mutex> lock{immediate_mutex_};
+            immediate_events_.swap(immediate_posted_);
+        }
+        // Only grows, the events would otherwise be played too early (or bunched up) when the device queue shrinks
+        immediate_latency_ = std::max(immediate_latency_, frames_ahead + num_stereo_samples);
+        const auto play_start = render_start + std::chrono::microseconds(static_cast<int64_t>(frames_ahead) * 1000000 / sample_rate_);
+        for (const auto& e : immediate_events_) {
+            int offset = 0;
+            if (mode_ != mixer_mode::monitoring) {
+                const auto since_play_start = std::chrono::duration_cast<std::chrono::microseconds>(e.time - play_start).count();
+                offset = std::max(0, immediate_latency_ + static_cast<int>(since_play_start * sample_rate_ / 1000000));
+            }
+            if (!post_at(offset, e.command)) {
+                // Too early rather than never, a dropped key release would leave the note playing
+                e.command.perform();
+            }
+        }
+        immediate_events_.clear();
+    }
+
+    timed_command& timed_command_at(int index) {
+        assert(index >= 0 && index < max_timed_commands);
+        return timed_commands_[(first_timed_ + index) & (max_timed_commands - 1)];
+    }
+
+    void perform_due_commands() {
+        while (num_timed_ && timed_command_at(0).frame <= frame_) {
+            timed_command_at(0).command.perform();
+            first_timed_ = (first_timed_ + 1) & (max_timed_commands - 1);
+            --num_timed_;
+        }
+    }
+
+    void render(short* s, int num_stereo_samples, int frames_ahead) {
+        stats_.buffer_started();
+        take_immediate_events(clock::now(), num_stereo_samples, frames_ahead);
         mix_buffer_.resize(num_stereo_samples * 2);
         float* buffer = &mix_buffer_[0];
         memset(buffer, 0, num_stereo_samples * 2 * sizeof(float));
@@ -67,8 +199,14 @@ private:
                 tick();
                 next_tick_ = sample_rate_ / ticks_per_second_;
             }
+            perform_due_commands();
 
-            const auto now = std::min(next_tick_, num_stereo_samples);
+            // Mix up to the next tick or timed command
+            auto now = std::min(next_tick_, num_stereo_samples);
+            if (num_timed_) {
+                assert(timed_command_at(0).frame > frame_);
+                now = static_cast<int>(std::min<int64_t>(now, timed_command_at(0).frame - frame_));
+            }
 
             for (auto v : voices_) {
                 v->mix(buffer, now);
@@ -77,15 +215,28 @@ private:
             buffer             += now * 2;
             num_stereo_samples -= now;
             next_tick_         -= now;
+            frame_             += now;
         }
 
-        for (size_t i = 0; i < mix_buffer_.size(); ++i) {
-            s[i] = sample_to_s16(mix_buffer_[i]*global_volume_);
+        // The limiter applies the global volume and keeps the result below full scale (delaying the output by limiter::latency frames)
+        const int num_frames = static_cast<int>(mix_buffer_.size() / 2);
+        if (mode_ == mixer_mode::monitoring) {
+            // Left to the saturation of the conversion
+            if (global_volume_ != 1.0f) {
+                for (auto& f : mix_buffer_) f *= global_volume_;
+            }
+        } else {
+            limiter_.process(&mix_buffer_[0], num_frames, global_volume_);
+        }
+        if (tap_) {
+            tap_->process(&mix_buffer_[0], num_frames);
         }
+        converter_.convert(s, &mix_buffer_[0], num_frames * 2, 1.0f);
+        stats_.buffer_finished(num_frames);
     }
 };
 
-mixer::mixer() : impl_(std::make_unique<impl>()) {
+mixer::mixer(const buffer_ring_config& device_config, mixer_mode mode) : impl_(std::make_unique<impl>(device_config, mode)) {
 }
 
 mixer::~mixer() = default;
@@ -94,6 +245,18 @@ job_queue& mixer::tick_queue() {
     return impl_->tick_queue();
 }
 
+render_stats& mixer::stats() {
+    return impl_->stats();
+}
+
+void mixer::post_immediate(const voice_command& command) {
+    impl_->post_immediate(command);
+}
+
+bool mixer::post_at(int num_stereo_samples, const voice_command& command) {
+    return impl_->post_at(num_stereo_samples, command);
+}
+
 void mixer::add_voice(voice& v) {
     impl_->add_voice(v);
 }
@@ -108,4 +271,12 @@ void mixer::ticks_per_second(int tps) {
 
 void mixer::global_volume(float vol) {
     impl_->global_volume(vol);
+}
+
+void mixer::output_conversion(s16_conversion conv) {
+    impl_->output_conversion(conv);
+}
+
+void mixer::tap(voice_tap* t) {
+    impl_->tap(t);
 }
\ No newline at end of file
@@ -5,10 +5,22 @@
 
 #include <base/job_queue.h>
 #include <base/voice.h>
+#include <base/s16_converter.h>
+#include <base/render_stats.h>
+#include <base/buffer_ring.h>
+#include <base/voice_tap.h>
+#include <base/voice_command.h>
+
+enum class mixer_mode {
+    playback,
+    // For auditioning with as little latency as possible: The mix is clipped by the output conversion instead of going
+    // through the limiter (saving its look ahead) and immediate events are played at the start of the next buffer.
+    monitoring,
+};
 
 class mixer {
 public:
-    explicit mixer();
+    explicit mixer(const buffer_ring_config& device_config = buffer_ring_config{}, mixer_mode mode = mixer_mode::playback);
     ~mixer();
 
     int sample_rate() const {
@@ -16,11 +28,29 @@ public:
     }
 
     job_queue& tick_queue();
+    render_stats& stats();
+
+    // Maximum number of commands waiting for their frame
+    static constexpr int max_timed_commands = 256;
+
+    // Performs command (in the tick queue thread) at the frame heard a constant latency after it was posted, rather than
+    // at the next tick. Keeps the spacing of the events with a latency of one buffer on top of the device queue
+    // (just the device queue when monitoring, the events of a buffer all play at its start). Never dropped, a command
+    // that finds max_timed_commands waiting is performed at the start of the next buffer.
+    void post_immediate(const voice_command& command);
+
+    // Tick queue thread only: Performs command num_stereo_samples frames from the current mixing position (the start of
+    // the tick when called from a tick job). Voice mixing is split at the frame, so the command takes effect sample
+    // accurately. Never allocates, returns false (dropping the command) when max_timed_commands are already waiting.
+    bool post_at(int num_stereo_samples, const voice_command& command);
 
     void add_voice(voice& v);
     void remove_voice(voice& v);
     void ticks_per_second(int tps);
     void global_volume(float vol);
+    void output_conversion(s16_conversion conv);
+    // Feeds the final mix (after the limiter, if any) to t, nullptr to detach. The tap must outlive the attachment.
+    void tap(voice_tap* t);
 
 private:
     static constexpr int sample_rate_ = 44100;
@@ -1,49 +1,110 @@
 #include "mod_player.h"
 #include "mixer.h"
-#include <base/sample_voice.h>
+#include "module_sequencer.h"
+#include <base/voice_pool.h>
+#include <base/log_ring.h>
+#include <base/seqlock.h>
+#include <cmath>
+#include <array>
+#include <atomic>
 
 constexpr bool is_mod_note_delay(int effect) {
     return effect>>4 == 0xED;
 }
 
+constexpr int effect_x(const module_event& e) {
+    return e.effect_param >> 4;
+}
+
+constexpr int effect_y(const module_event& e) {
+    return e.effect_param & 0xf;
+}
+
+// Keys of the rate limited log messages written from the tick path
+constexpr uint32_t log_key_effect         = 0x000; // + effect op
+constexpr uint32_t log_key_volume_command = 0x100; // + volume command
+constexpr uint32_t log_key_no_sample_trig   = 0x200;
+constexpr uint32_t log_key_no_sample_period = 0x201;
+
+// Rows scanned ahead for instruments whose samples still have to be decoded
+constexpr int prefetch_rows = 32;
+
+template<typename Channel>
+using effect_handler_table = std::array<void (*)(Channel& channel, int tick, const module_event& e), num_effect_ops>;
+
+// The channel classes (mod_channel, s3m_channel and xm_channel) are used through channel_engine<Channel> and
+// implement process_note(note), process_effect(tick, event), process_empty_row() and process_tick(tick)
 class channel_base {
 public:
-    virtual ~channel_base() {}
-    virtual void process_note(const module_note& note) = 0;
-    virtual void process_effect(int tick, const module_note& note) = 0;
+    // Called for every channel at the start of each row, before process_note/process_empty_row
+    void begin_row() {
+        // A note held back by a note delay that never came, the voice gets the channel's pitch and volume after all
+        if (hold_voice_) {
+            hold_voice_ = false;
+            update_voice();
+        }
+    }
+    // Called once per row instead of process_note/process_effect when the channel's cell is empty
+    void process_empty_row() {}
+    // Called for every channel on every tick after the effects have been processed
+    void process_tick(int) {}
 
 protected:
-    explicit channel_base(mod_player::impl& player, sample_voice& voice, uint8_t default_pan) : player_(player), voice_(voice) {
-        voice_.pan(default_pan / 255.0f);
+    explicit channel_base(mod_player::impl& player, voice_pool& voices, uint8_t default_pan) : player_(player), voices_(voices), voice_(&voices.allocate()), pan_(default_pan) {
+        voice_->pan(default_pan / 255.0f);
     }
 
     //
     // Global stuff
     //
     const module& mod() const;
+    const ::pitch_table& pitch_table() const;
     module_position current_position() const;
-    void do_set_speed(int speed);
-    void do_set_tempo(int bpm);
-    void do_pattern_break(int row);
-    void do_pattern_jump(int order);
-    void do_pattern_delay(int delay_notes);
-    void do_pattern_loop(int x);
+    log_ring& log() const;
+    int stereo_samples_per_tick() const;
+
+    // Handler for effect_op_unknown (effect types the format doesn't have) in the effect tables
+    template<typename Channel>
+    static void unknown_effect(Channel& c, int tick, const module_event& e) {
+        if (!tick) c.log().write_limited(log_key_effect + e.effect_op, L"%2.2d: Ignoring unknown effect %03X\n", c.current_position().row, e.note.effect);
+    }
 
     //
     // Trig
     //
+
+    // Called before setting the period and volume of a note that will be trigged (now or after a note delay), so the
+    // playing note keeps its own pitch and volume while it's faded out by trig
+    void hold_voice() {
+        hold_voice_ = voice_->playing();
+    }
+
     void trig(int offset) {
+        const int release_stereo_samples = playing_release_stereo_samples();
         vib_pos_        = 0;
         fadeout_volume_ = max_fadeout_volume;
+        key_off_        = false;
+        volume_envelope_pos_  = 0;
+        panning_envelope_pos_ = 0;
+        hold_voice_     = false;
+        reset_disabled_envelopes();
         if (!instrument_number()) {
-            wprintf(L"Warning: No sample. Ignoring trig offset %d\n", offset);
+            log().write_limited(log_key_no_sample_trig, L"Warning: No sample. Ignoring trig offset %d\n", offset);
+            update_voice();
             return;
         }
         auto& s = sample().data();
+        if (s.length() && voice_->playing()) {
+            // Let the old note fade out in the background and continue on a new voice
+            voices_.release(*voice_, release_stereo_samples);
+            voice_ = &voices_.allocate();
+            set_voice_pan();
+        }
+        update_voice();
         if (s.length()) {
-            set_voice_volume();
-            voice_.play(s, std::min(s.length(), offset));
+            voice_->play(s, std::min(s.length(), offset));
         }
+        playing_fadeout_ = instrument().volume_envelope().enabled() ? instrument().volume_fadeout() : 0;
     }
 
     //
@@ -56,7 +117,7 @@ protected:
     }
 
     void update_fadeout() {
-        if (!instrument_number()) {
+        if (!instrument_number() || instrument().volume_envelope().enabled()) {
             return;
         }
         fadeout_volume_ = std::max(0, fadeout_volume_ - instrument().volume_fadeout());
@@ -76,12 +137,72 @@ protected:
         }
     }
 
+    //
+    // Envelopes (XM)
+    //
+
+    // How long the playing note fades out for in the background when a new note takes over: The rest of its XM
+    // instrument's fadeout, as after a key off (the envelopes stay where they are though), or 0 for the voice pool's
+    // short release
+    int playing_release_stereo_samples() const {
+        if (!playing_fadeout_) {
+            return 0;
+        }
+        const int fadeout_per_tick = 2 * playing_fadeout_; // See update_envelopes
+        const int ticks = (fadeout_volume_ + fadeout_per_tick - 1) / fadeout_per_tick;
+        return ticks * stereo_samples_per_tick();
+    }
+
+    // Releases the sustain point of the envelopes and starts the fadeout, returns false if the instrument has no volume envelope
+    bool key_off() {
+        if (!instrument_number() || !instrument().volume_envelope().enabled()) {
+            return false;
+        }
+        key_off_ = true;
+        return true;
+    }
+
+    // The envelope values are only updated while the envelopes are enabled, so an instrument without them mustn't
+    // keep the volume or pan where the previous instrument's envelopes left them
+    void reset_disabled_envelopes() {
+        if (!instrument_number() || !instrument().volume_envelope().enabled()) {
+            envelope_volume_ = module_envelope::max_value;
+        }
+        if (!instrument_number() || !instrument().panning_envelope().enabled()) {
+            envelope_pan_ = module_envelope::max_value / 2;
+        }
+    }
+
+    void update_envelopes() {
+        if (!instrument_number()) {
+            return;
+        }
+        const auto& inst = instrument();
+        const auto& vol_env = inst.volume_envelope();
+        if (vol_env.enabled()) {
+            envelope_volume_     = vol_env.value(volume_envelope_pos_);
+            volume_envelope_pos_ = vol_env.next(volume_envelope_pos_, key_off_);
+            if (key_off_) {
+                // The fadeout is specified for FT2's 0-32768 range
+                fadeout_volume_ = std::max(0, fadeout_volume_ - 2 * inst.volume_fadeout());
+            }
+            set_voice_volume();
+        }
+        const auto& pan_env = inst.panning_envelope();
+        if (pan_env.enabled()) {
+            envelope_pan_         = pan_env.value(panning_envelope_pos_);
+            panning_envelope_pos_ = pan_env.next(panning_envelope_pos_, key_off_);
+            set_voice_pan();
+        }
+    }
+
     //
     // Panning
     //
     void pan(int amount) {
         assert(amount >= 0 && amount <= 255);
-        voice_.pan(amount / 255.0f);
+        pan_ = amount;
+        set_voice_pan();
     }
 
     //
@@ -91,6 +212,9 @@ protected:
         assert(inst >= 1 && inst <= mod().instruments.size());
         instrument_ = inst;
         sample_     = &empty_sample;
+        volume_envelope_pos_  = 0;
+        panning_envelope_pos_ = 0;
+        reset_disabled_envelopes();
     }
 
     int instrument_number() const {
@@ -124,7 +248,7 @@ protected:
     void do_arpeggio(int tick, int x, int y) {
         if (!tick) return;
         const int amount = (tick % 3 == 0) ? 0 : (tick % 3 == 1) ? x : y;
-        const int res_per = mod().freq_to_period(mod().period_to_freq(period_) * note_difference_to_scale(static_cast<float>(amount)));
+        const int res_per = pitch_table().transpose_period(period_, amount);
         //wprintf(L"Arpeggio base period = %d, amount = %d, resulting period = %d\n", period_, amount, res_per);
         set_voice_period(res_per);
     }
@@ -213,12 +337,24 @@ protected:
 
 private:
     mod_player::impl&       player_;
-    sample_voice&           voice_;
+    voice_pool&             voices_;
+    sample_voice*           voice_;
+    float                   voice_increment_ = 0;
+    bool                    hold_voice_     = false; // The voice doesn't follow the channel's period and volume until the next trig
     int                     volume_         = 0;
     int                     fadeout_volume_ = 0;
+    int                     playing_fadeout_ = 0; // Volume fadeout of the note trigged last, 0 without volume envelope
     int                     instrument_     = 0;
     const module_sample*    sample_         = &empty_sample;
     int                     period_         = 0;
+    int                     pan_;
+
+    // Envelopes
+    bool                    key_off_        = false;
+    int                     volume_envelope_pos_  = 0;
+    int                     panning_envelope_pos_ = 0;
+    int                     envelope_volume_ = module_envelope::max_value;
+    int                     envelope_pan_    = module_envelope::max_value / 2;
 
     // Effect memory
     int                     porta_target_period_ = 0;
@@ -233,47 +369,69 @@ private:
     void set_voice_period(int period) {
         assert(period > 0);
         if (!instrument_number()) {
-            wprintf(L"Warning: No sample. Ignoring period %d\n", period);
+            log().write_limited(log_key_no_sample_period, L"Warning: No sample. Ignoring period %d\n", period);
             return;
         }
         auto& s = sample().data();
         const int adjusted_period = static_cast<int>(0.5 + period * amiga_c5_rate / s.c5_rate());
-        voice_.freq(mod().period_to_freq(adjusted_period));
-    
+        voice_increment_ = pitch_table().period_to_increment(adjusted_period);
+        if (!hold_voice_) voice_->increment(voice_increment_);
+    }
+
+    void update_voice() {
+        if (voice_increment_ > 0) voice_->increment(voice_increment_);
+        set_voice_volume();
     }
 
     void set_voice_volume() {
-        voice_.volume(fadeout_volume_ / static_cast<float>(max_fadeout_volume+1) * static_cast<float>(volume_) / mod_player::max_volume);
+        if (hold_voice_) return;
+        voice_->volume(fadeout_volume_ / static_cast<float>(max_fadeout_volume+1) * static_cast<float>(volume_) / mod_player::max_volume * static_cast<float>(envelope_volume_) / module_envelope::max_value);
+    }
+
+    void set_voice_pan() {
+        // The panning envelope moves the pan towards the side it is furthest from
+        constexpr int center = module_envelope::max_value / 2;
+        const int amount = pan_ + (envelope_pan_ - center) * (128 - std::abs(pan_ - 128)) / center;
+        voice_->pan(std::max(0, std::min(255, amount)) / 255.0f);
     }
 };
 
-std::unique_ptr<channel_base> make_channel(mod_player::impl& player, sample_voice& voice, uint8_t default_pan);
+class channel_engine_base {
+public:
+    virtual ~channel_engine_base() {}
+    virtual void process_row(module_event_range events) = 0;
+    virtual void process_effects(int tick, module_event_range events) = 0;
+};
+
+std::unique_ptr<channel_engine_base> make_channel_engine(mod_player::impl& player, voice_pool& voices);
 
 class mod_player::impl {
 public:
-    explicit impl(module&& mod, mixer& m) : mod_(std::move(mod)), mixer_(m) {
-        for (int i = 0; i < mod_.num_channels; ++i) {
-            voices_.emplace_back(mixer_.sample_rate());
-        }
+    explicit impl(module&& mod, mixer& m, int num_voices)
+        : mod_(std::move(mod))
+        , mixer_(m)
+        , pitch_table_(mod_, mixer_.sample_rate())
+        , voices_(mixer_.sample_rate(), std::max(mod_.num_channels, num_voices ? num_voices : 2 * mod_.num_channels), mixer_.sample_rate() / 50) { // 20 ms release
         for (int i = 0; i < mod_.num_channels; ++i) {
-            channels_.emplace_back(make_channel(*this, voices_[i], static_cast<uint8_t>(mod_.channel_default_pan(i))));
             if (mod_.type == module_type::s3m) wprintf(L"%2d: Pan %d\n", i+1, mod_.channel_default_pan(i));
         }
+        channels_ = make_channel_engine(*this, voices_);
+        instrument_requested_.assign(mod_.instruments.size(), false);
+        instruments_unrequested_ = static_cast<int>(mod_.instruments.size());
         mixer_.tick_queue().post([this] {
-            set_speed(mod_.initial_speed);
-            set_tempo(mod_.initial_tempo);
-            tick_ = mod_.initial_speed+1;
-            for (auto& v : voices_) {
-                mixer_.add_voice(v);
+            set_tempo();
+            for (int i = 0; i < voices_.size(); ++i) {
+                mixer_.add_voice(voices_[i]);
             }
-            mixer_.global_volume(2.0f/mod_.num_channels);
+            // Normalize for the number of (uncorrelated) channels, the mixer's limiter takes care of the peaks
+            mixer_.global_volume(1.0f/std::sqrt(static_cast<float>(mod_.num_channels)));
         });
     }
 
     ~impl() {
         mixer_.tick_queue().dispatch([this] {
-            for (auto& v : voices_) {
-                mixer_.remove_voice(v);
+            for (int i = 0; i < voices_.size(); ++i) {
+                mixer_.remove_voice(voices_[i]);
             }
             mixer_.global_volume(1.0f);
         });
@@ -281,14 +439,14 @@ public:
 
     const module& mod() const { return mod_; }
 
+    int active_voices() const { return active_voices_; }
+
     void skip_to_order(int order) {
         assert(order >= 0 && order < mod_.order.size());
         mixer_.tick_queue().post([order, this] {
             // TODO: Process (some) effects...
-            wprintf(L"Skipping to order %d, cur = %d\n", order, order_);
-            order_ = order;
-            row_   = -1;
-            tick_  = speed_;
+            log_.write(L"Skipping to order %d, cur = %d\n", order, sequencer_.order());
+            sequencer_.skip_to_order(order);
             notify_position_change();
         });
     }
@@ -305,27 +463,36 @@ public:
         });
     }
 
-    void on_position_changed(const callback_function_type<module_position>& cb) {
+    uint32_t position(module_position& pos) const {
+        // Re-arm the wakeup before reading, so a change right after the read isn't missed
+        position_wakeup_pending_.store(false);
+        return position_.load(pos);
+    }
+
+    void on_position_changed(const callback_function_type<>& cb) {
         on_position_changed_.subscribe(cb);
     }
 
+    void on_instrument_needed(const callback_function_type<int>& cb) {
+        on_instrument_needed_.subscribe(cb);
+    }
+
 private:
     module                                      mod_;
     mixer&                                      mixer_;
+    pitch_table                                 pitch_table_;
     bool                                        playing_ = false;
-    int                                         speed_ = 6;     // Number of ticks per row 1..127
-    int                                         order_ = 0;     // Position in order table 0..song length-1
-    int                                         row_ = -1;      // Current row in pattern
-    int                                         tick_ = 6;      // Current tick 0..speed
-    int                                         pattern_jump_ = -1;
-    int                                         pattern_break_row_ = -1;
-    int                                         pattern_delay_ = -1;
-    int                                         pattern_loop_row_ = -1;
-    int                                         pattern_loop_counter_ = -1;
-    bool                                        pattern_loop_ = false;
-    event<module_position>                      on_position_changed_;
-    std::vector<sample_voice>                   voices_;
-    std::vector<std::unique_ptr<channel_base>>  channels_;
+    module_sequencer                            sequencer_{mod_};
+    seqlock<module_position>                    position_{current_position()};
+    mutable std::atomic<bool>                   position_wakeup_pending_{false};
+    event<>                                     on_position_changed_;
+    event<int>                                  on_instrument_needed_;
+    std::vector<bool>                           instrument_requested_;
+    int                                         instruments_unrequested_;
+    voice_pool                                  voices_;
+    log_ring                                    log_;
+    std::atomic<int>                            active_voices_{0};
+    std::unique_ptr<channel_engine_base>        channels_;
 
     friend channel_base;
 
@@ -335,8 +502,8 @@ private:
 
     void set_playing(bool playing) {
         playing_ = playing;
-        for (auto& v : voices_) {
-            v.paused(!playing_);
+        for (int i = 0; i < voices_.size(); ++i) {
+            voices_[i].paused(!playing_);
         }
         if (playing_) {
             schedule();
@@ -344,35 +511,56 @@ private:
     }
 
     module_position current_position() const {
-        return module_position{order_, mod_.order[order_], std::max(0, row_)};
+        return module_position{sequencer_.order(), mod_.order[sequencer_.order()], std::max(0, sequencer_.row())};
     }
 
     void notify_position_change() {
-        on_position_changed_(current_position());
+        position_.store(current_position());
+        if (!position_wakeup_pending_.exchange(true)) {
+            on_position_changed_();
+        }
     }
 
-    void process_row() {
-        pattern_break_row_ = -1;
-        pattern_jump_      = -1;
-        for (int ch = 0; ch < mod_.num_channels; ++ch) {
-            auto& channel = channels_[ch];
-            const auto& note = mod_.at(order_, row_)[ch];
-            channel->process_note(note);
+    static bool instrument_ready(const module_instrument& inst) {
+        for (const auto& s : inst.samples()) {
+            if (!s.data().ready()) return false;
         }
+        return true;
     }
 
-    void next_order() {
-        if (++order_ >= mod_.order.size()) {
-            order_ = 0; // TODO: Use restart pos
+    // Asks for the samples of the instruments used in the current and the next prefetch_rows-1 rows, following the
+    // order list (jumps and loops aren't anticipated, their target row is covered when it's played)
+    void prefetch_samples() {
+        int order = sequencer_.order(), row = sequencer_.row();
+        for (int i = 0; i < prefetch_rows && instruments_unrequested_; ++i) {
+            for (const auto& e : mod_.events_at(order, row)) {
+                const int ins = e.note.instrument - 1;
+                if (ins < 0 || ins >= static_cast<int>(instrument_requested_.size()) || instrument_requested_[ins]) {
+                    continue;
+                }
+                instrument_requested_[ins] = true;
+                --instruments_unrequested_;
+                if (!instrument_ready(mod_.instruments[ins])) {
+                    on_instrument_needed_(ins);
+                }
+            }
+            if (++row >= mod_.num_rows(order)) {
+                row = 0;
+                if (++order >= static_cast<int>(mod_.order.size())) order = 0;
+            }
         }
     }
 
+    void process_row() {
+        prefetch_samples();
+        const auto events = mod_.events_at(sequencer_.order(), sequencer_.row());
+        sequencer_.process_row_effects(events);
+        set_tempo();
+        channels_->process_row(events);
+    }
+
     void process_effects() {
-        for (int ch = 0; ch < mod_.num_channels; ++ch) {
-            auto& channel = channels_[ch];
-            const auto& note = mod_.at(order_, row_)[ch];
-            channel->process_effect(tick_, note);
-        }
+        channels_->process_effects(sequencer_.tick(), mod_.events_at(sequencer_.order(), sequencer_.row()));
     }
 
     void tick() {
@@ -380,92 +568,26 @@ private:
             return;
         }
 
-        if (++tick_ >= speed_) {
-            tick_ = 0;
-            if (pattern_delay_ > 0) {
-                --pattern_delay_;
-            } else {
-                pattern_delay_ = -1;
-                if (pattern_jump_ != -1) {
-                    order_ = pattern_jump_;
-                    row_   = pattern_break_row_ == -1 ? -1 : pattern_break_row_ - 1;
-                } else if (pattern_break_row_ != -1) {
-                    next_order();
-                    row_   = pattern_break_row_ - 1;
-                }
-
-                if (pattern_loop_) {
-                    pattern_loop_ = false;
-                    if (pattern_loop_counter_ > 0) {
-                        assert(pattern_loop_row_ >= 0 && pattern_loop_row_ < max_rows);
-                        //wprintf(L"%2.2d: Looping back to %d (counter %d)\n", row_, pattern_loop_row_, pattern_loop_counter_);
-                        row_ = pattern_loop_row_ -1;
-                        pattern_loop_row_ = -1;
-                        --pattern_loop_counter_;
-                    } else if (pattern_loop_counter_ == 0) {
-                        //wprintf(L"%2.2d: Looping done\n", row_);
-                        pattern_loop_counter_ = -1;
-                        pattern_loop_row_     = -1;
-                    }
-                }
-
-                if (++row_ >= max_rows) {
-                    row_ = 0;
-                    next_order();
-                }
-                process_row();
-                notify_position_change();
-                process_effects();
-            }
-        } else {
-            // Intra-row tick
+        if (sequencer_.next_tick()) {
+            process_row();
+            notify_position_change();
+            process_effects();
+        } else if (sequencer_.tick()) {
+            // Intra-row tick (tick 0 of a row repeated by a pattern delay doesn't process any effects)
             process_effects();
         }
+        active_voices_ = voices_.active_voices();
+        mixer_.stats().active_voices(active_voices_);
         schedule();
     }
 
-    void set_speed(int speed) {
-        speed_ = speed;
-    }
-
-    void set_tempo(int bpm) {
+    void set_tempo() {
         // BPM, 2*bpm/5 ticks per second
-        mixer_.ticks_per_second(bpm*2/5);
-    }
-
-    void pattern_break(int row) {
-        assert(row >= 0 && row < max_rows);
-        assert(pattern_break_row_ == -1);
-        pattern_break_row_ = row;
-    }
-
-    void pattern_jump(int order) {
-        assert(order_ >= 0 && order_ < mod_.order.size());
-        assert(pattern_jump_ == -1);
-        pattern_jump_      = order;
-        pattern_break_row_ = -1; // A pattern jump after a pattern break makes the break have no effect
-    }
-
-    void pattern_delay(int delay_notes) {
-        if (pattern_delay_ == -1) {
-            pattern_delay_ = delay_notes;
-        }
-    }
-
-    void pattern_loop(int x) {
-        if (x == 0) {
-            pattern_loop_row_ = row_;
-        } else {
-            if (pattern_loop_counter_ == -1 && pattern_loop_row_ != -1) {
-                pattern_loop_counter_ = x;
-            }
-            pattern_loop_ = true;
-        }
-        //wprintf(L"%2.2d: Pattern loop x = %d (row =%d, counter = %d)\n", row_, x, pattern_loop_row_, pattern_loop_counter_);
+        mixer_.ticks_per_second(sequencer_.tempo()*2/5);
     }
 };
 
-mod_player::mod_player(module&& mod, mixer& m) : impl_(std::make_unique<impl>(std::move(mod), m)) {
+mod_player::mod_player(module&& mod, mixer& m, int num_voices) : impl_(std::make_unique<impl>(std::move(mod), m, num_voices)) {
 }
 
 mod_player::~mod_player() = default;
@@ -478,6 +600,10 @@ void mod_player::skip_to_order(int order) {
     impl_->skip_to_order(order);
 }
 
+int mod_player::active_voices() const {
+    return impl_->active_voices();
+}
+
 void mod_player::stop() {
     impl_->stop();
 }
@@ -486,10 +612,18 @@ void mod_player::toggle_playing() {
     impl_->toggle_playing();
 }
 
-void mod_player::on_position_changed(const callback_function_type<module_position>& cb) {
+uint32_t mod_player::position(module_position& pos) const {
+    return impl_->position(pos);
+}
+
+void mod_player::on_position_changed(const callback_function_type<>& cb) {
     impl_->on_position_changed(cb);
 }
 
+void mod_player::on_instrument_needed(const callback_function_type<int>& cb) {
+    impl_->on_instrument_needed(cb);
+}
+
 //
 // channel_base
 //
@@ -497,32 +631,20 @@ const module& channel_base::mod() const {
     return player_.mod_;
 }
 
-module_position channel_base::current_position() const {
-    return player_.current_position();
-}
-
-void channel_base::do_set_speed(int speed) {
-    player_.set_speed(speed);
-}
-
-void channel_base::do_set_tempo(int bpm) {
-    player_.set_tempo(bpm);
-}
-
-void channel_base::do_pattern_break(int row) {
-    player_.pattern_break(row);
+const pitch_table& channel_base::pitch_table() const {
+    return player_.pitch_table_;
 }
 
-void channel_base::do_pattern_jump(int order) {
-    player_.pattern_jump(order);
+module_position channel_base::current_position() const {
+    return player_.current_position();
 }
 
-void channel_base::do_pattern_delay(int delay_notes) {
-    player_.pattern_delay(delay_notes);
+log_ring& channel_base::log() const {
+    return player_.log_;
 }
 
-void channel_base::do_pattern_loop(int x) {
-    player_.pattern_loop(x);
+int channel_base::stereo_samples_per_tick() const {
+    return player_.mixer_.sample_rate() / (player_.sequencer_.tempo()*2/5);
 }
 
 //
@@ -530,11 +652,15 @@ void channel_base::do_pattern_loop(int x) {
 //
 class mod_channel : public channel_base {
 public:
-    explicit mod_channel(mod_player::impl& player, sample_voice& voice, uint8_t default_pan) : channel_base(player, voice, default_pan) {
+    explicit mod_channel(mod_player::impl& player, voice_pool& voices, uint8_t default_pan) : channel_base(player, voices, default_pan) {
         assert(mod().type == module_type::mod);
     }
 
-    virtual void process_note(const module_note& note) override {
+    void process_note(const module_note& note) {
+        const auto effect = note.effect>>8;
+        if (note.note != piano_key::NONE && effect != 3 && effect != 5) {
+            hold_voice();
+        }
         if (note.instrument) {
             instrument_number(note.instrument);
             sample(instrument().samp());
@@ -543,7 +669,6 @@ public:
         if (note.note != piano_key::NONE) {
             assert(note.note != piano_key::OFF);
             const int period = mod().note_to_period(note.note);
-            const auto effect = note.effect>>8;
             if (effect == 3 || effect == 5) {
                 set_porta_target(period);
             } else {
@@ -563,138 +688,91 @@ public:
         assert(note.volume == volume_command::none);
     }
 
-    virtual void process_effect(int tick, const module_note& note) override {
-        const int effect = note.effect;
-        if (!effect) return;
-
-        const int xy = effect&0xff;
-        const int x  = xy>>4;
-        const int y  = xy&0xf;
-        switch (effect>>8) {
-        case 0x00: // 0xy Arpeggio
-            do_arpeggio(tick, x, y);
-            return;
-        case 0x01: // 1xy Porta down
-            if (tick) {
-                do_porta(-xy);
-            }
-            return;
-        case 0x02: // 2xy Porta down
-            if (tick) {
-                do_porta(+xy);
-            }
-            return;
-        case 0x3: // 3xy Porta to note
-            if (xy) porta_speed(xy);
-            if (tick) {
-                do_porta_to_note();
-            }
-            return;
-        case 0x4: // 4xy Vibrato
-            do_vibrato(tick, x, y);
-            return;
-        case 0x5: // 5xy Porta + Voume slide (5xy = 300 + Axy)
-            if (tick) {
-                do_porta_to_note();
-                do_volume_slide(x, y);
-            }
-            return;
-        case 0x6: // 6xy Vibrato + Volume slide (6xy = 400 + Axy)
-            if (tick) {
-                do_vibrato(tick, 0, 0);
-                do_volume_slide(x, y);
-            }
-            return;
-        case 0x8: // 8xy
-            return; // ignored
-        case 0x9: // 9xy Sample offset
-            return;
-        case 0xA: // Axy Volume slide
-            if (tick) {
-                do_volume_slide(x, y);
-            }
-            return;
-        case 0xB: // Bxy Pattern jump
-            if (!tick) {
-                do_pattern_jump(xy);
-            }
-            return;
-        case 0xC: // Cxy Set volume
-            if (tick == 0) {
-                volume(xy);
-            }
-            return;
-        case 0xD: // Dxy Pattern break
-            if (tick == 0) {
-                do_pattern_break(x*10 + y);
-            }
-            return;
-        case 0xE:
-            switch (x) {
-            case 0x0: // E0y Set fiter
-                return;
-            case 0x1: // E1y Fine porta down
-                if (!tick) {
-                    do_porta(-y);
-                }
-                return;
-            case 0x2: // E2y Fine porta down
-                if (!tick) {
-                    do_porta(+y);
-                }
-                return;
-            case 0x6: // E6y Pattern loop
-                if (!tick) {
-                    do_pattern_loop(y);
-                }
-                return;
-            case 0x9: // E9x Retrig note
-                assert(y);
-                if (tick && tick % y == 0) {
-                    trig(0);
-                }
-                return;
-            case 0xA: // EAy Fine volume slide up
-                if (!tick)  {
-                    do_volume_slide(+y);
-                }
-                return;
-            case 0xB: // EAy Fine volume slide down
-                if (!tick) {
-                    do_volume_slide(-y);
-                }
-                return;
-            case 0xC: // ECy Cut note
-                if (tick == y) {
-                    volume(0);
-                }
-                return;
-            case 0xD: // EDy Delay note
-                if (tick == y) {
-                    trig(0);
-                }
-                return;
-            case 0xE: // EEy Pattern delay
-                if (!tick) {
-                    do_pattern_delay(y);
-                }
-                return;
-            }
-            break;
-        case 0xF: // Fxy Set speed
-            if (tick) return;
-            if (xy < 0x20) {
-                do_set_speed(xy);
-            } else {
-                do_set_tempo(xy);
-            }
-            return;
-        }
-        if (!tick) wprintf(L"Unhandled effect %03X\n", effect);
+    void process_effect(int tick, const module_event& e) {
+        effects_[e.effect_op](*this, tick, e);
     }
 
 private:
+    using effect_table = effect_handler_table<mod_channel>;
+    const effect_table::value_type* effects_ = get_effect_table().data();
     int  sample_offset_ = 0;
+
+    static const effect_table& get_effect_table() {
+        static const effect_table table = [] {
+            effect_table t;
+            t.fill([](mod_channel& c, int tick, const module_event& e) {
+                if (!tick) c.log().write_limited(log_key_effect + e.effect_op, L"Unhandled effect %03X\n", e.note.effect);
+            });
+            t[effect_op_none] = [](mod_channel&, int, const module_event&) {};
+            t[effect_op_unknown] = unknown_effect<mod_channel>;
+            t[effect_op(0x0)] = [](mod_channel& c, int tick, const module_event& e) { // 0xy Arpeggio
+                c.do_arpeggio(tick, effect_x(e), effect_y(e));
+            };
+            t[effect_op(0x1)] = [](mod_channel& c, int tick, const module_event& e) { // 1xy Porta down
+                if (tick) c.do_porta(-e.effect_param);
+            };
+            t[effect_op(0x2)] = [](mod_channel& c, int tick, const module_event& e) { // 2xy Porta down
+                if (tick) c.do_porta(+e.effect_param);
+            };
+            t[effect_op(0x3)] = [](mod_channel& c, int tick, const module_event& e) { // 3xy Porta to note
+                if (e.effect_param) c.porta_speed(e.effect_param);
+                if (tick) c.do_porta_to_note();
+            };
+            t[effect_op(0x4)] = [](mod_channel& c, int tick, const module_event& e) { // 4xy Vibrato
+                c.do_vibrato(tick, effect_x(e), effect_y(e));
+            };
+            t[effect_op(0x5)] = [](mod_channel& c, int tick, const module_event& e) { // 5xy Porta + Voume slide (5xy = 300 + Axy)
+                if (tick) {
+                    c.do_porta_to_note();
+                    c.do_volume_slide(effect_x(e), effect_y(e));
+                }
+            };
+            t[effect_op(0x6)] = [](mod_channel& c, int tick, const module_event& e) { // 6xy Vibrato + Volume slide (6xy = 400 + Axy)
+                if (tick) {
+                    c.do_vibrato(tick, 0, 0);
+                    c.do_volume_slide(effect_x(e), effect_y(e));
+                }
+            };
+            t[effect_op(0x8)] = [](mod_channel&, int, const module_event&) {}; // 8xy ignored
+            t[effect_op(0x9)] = [](mod_channel&, int, const module_event&) {}; // 9xy Sample offset (handled in process_note)
+            t[effect_op(0xA)] = [](mod_channel& c, int tick, const module_event& e) { // Axy Volume slide
+                if (tick) c.do_volume_slide(effect_x(e), effect_y(e));
+            };
+            t[effect_op(0xB)] = [](mod_channel&, int, const module_event&) {}; // Bxy Pattern jump (handled by module_sequencer)
+            t[effect_op(0xC)] = [](mod_channel& c, int tick, const module_event& e) { // Cxy Set volume
+                if (!tick) c.volume(e.effect_param);
+            };
+            t[effect_op(0xD)] = [](mod_channel&, int, const module_event&) {}; // Dxy Pattern break (handled by module_sequencer)
+            t[extended_effect_op(0x0)] = [](mod_channel&, int, const module_event&) {}; // E0y Set fiter
+            t[extended_effect_op(0x1)] = [](mod_channel& c, int tick, const module_event& e) { // E1y Fine porta down
+                if (!tick) c.do_porta(-effect_y(e));
+            };
+            t[extended_effect_op(0x2)] = [](mod_channel& c, int tick, const module_event& e) { // E2y Fine porta down
+                if (!tick) c.do_porta(+effect_y(e));
+            };
+            t[extended_effect_op(0x6)] = [](mod_channel&, int, const module_event&) {}; // E6y Pattern loop (handled by module_sequencer)
+            t[extended_effect_op(0x9)] = [](mod_channel& c, int tick, const module_event& e) { // E9x Retrig note
+                assert(effect_y(e));
+                if (tick && tick % effect_y(e) == 0) c.trig(0);
+            };
+            t[extended_effect_op(0xA)] = [](mod_channel& c, int tick, const module_event& e) { // EAy Fine volume slide up
+                if (!tick) c.do_volume_slide(+effect_y(e));
+            };
+            t[extended_effect_op(0xB)] = [](mod_channel& c, int tick, const module_event& e) { // EAy Fine volume slide down
+                if (!tick) c.do_volume_slide(-effect_y(e));
+            };
+            t[extended_effect_op(0xC)] = [](mod_channel& c, int tick, const module_event& e) { // ECy Cut note
+                if (tick == effect_y(e)) c.volume(0);
+            };
+            t[extended_effect_op(0xD)] = [](mod_channel& c, int tick, const module_event& e) { // EDy Delay note
+                if (tick == effect_y(e)) c.trig(0);
+            };
+            t[extended_effect_op(0xE)] = [](mod_channel&, int, const module_event&) {}; // EEy Pattern delay (handled by module_sequencer)
+            t[effect_op(0xF)] = [](mod_channel&, int, const module_event&) {}; // Fxy Set speed (handled by module_sequencer)
+            return t;
+        }();
+        return table;
+    }
 };
 
 //
@@ -702,11 +780,15 @@ private:
 //
 class s3m_channel : public channel_base {
 public:
-    explicit s3m_channel(mod_player::impl& player, sample_voice& voice, uint8_t default_pan) : channel_base(player, voice, default_pan) {
+    explicit s3m_channel(mod_player::impl& player, voice_pool& voices, uint8_t default_pan) : channel_base(player, voices, default_pan) {
         assert(mod().type == module_type::s3m);
     }
 
-    virtual void process_note(const module_note& note) override {
+    void process_note(const module_note& note) {
+        const char effchar = static_cast<char>((note.effect>>8)-1+'A');
+        if (note.note != piano_key::NONE && note.note != piano_key::OFF && effchar != 'G') {
+            hold_voice();
+        }
         if (note.instrument) {
             instrument_number(note.instrument);
             sample(instrument().samp());
@@ -718,7 +800,6 @@ public:
                 return;
             }
             const int period = mod().note_to_period(note.note);
-            const char effchar = static_cast<char>((note.effect>>8)-1+'A');
             if (effchar == 'G') {
                 set_porta_target(period);
             } else {
@@ -740,97 +821,76 @@ public:
         }
     }
 
-    virtual void process_effect(int tick, const module_note& note) override {
-        const int effect = note.effect;
-        if (!effect) return;
-
-        const char effchar = static_cast<char>((effect>>8)-1+'A');
-        const int xy = effect&0xff;
-        const int x = xy >> 4;
-        const int y = xy & 0xf;
-        switch (effchar) {
-        case 'A': // Set speed
-            do_set_speed(xy);
-            break;
-        case 'B': // Pattern jump
-            if (!tick) {
-                wprintf(L"Pattern jump! B%02X\n", xy);
-                do_pattern_jump(xy);
-            }
-        case 'C': // Pattern break
-            if (!tick) {
-                do_pattern_break(x*10 + y);
-            }
-            break;
-        case 'D': // Volume slide 
-            do_s3m_volume_slide(tick, xy);
-            break;
-        case 'E': // Portamento down
-            do_s3m_porta(tick, +1, xy);
-            break;
-        case 'F': // Portamento up
-            do_s3m_porta(tick, -1, xy);
-            break;
-        case 'H': // Vibrato
-            do_vibrato(tick, x, y); // TODO: y * 4?
-            break;
-        case 'J': // Arpeggio
-            do_arpeggio(tick, x, y);
-            break;
-        case 'K': // Kxy Vibrato + Volume Slide
-            do_vibrato(tick, 0, 0);
-            do_s3m_volume_slide(tick, xy);
-            break;
-        case 'G': // Gxy Porta to note
-            if (xy) porta_speed(xy * 4);
-            if (tick) {
-                do_porta_to_note();
-            }
-            break;
-        case 'O': // Oxy Sample offset
-            break;
-        case 'Q': // Qxy (Retrig + Volume Slide)
-            do_retrig_and_volume_slide(tick, xy);
-            break;
-        case 'S':
-            switch(x) {
-            case 0x8: // Pan position
-                if (!tick) {
-                    pan(y << 4);
-                }
-                break;
-            case 0xB: // Pattern Loop
-                if (!tick) {
-                    do_pattern_loop(y);
-                }
-                break;
-            case 0xC: // Note cut
-                if (tick == y) {
-                    volume(0);
-                }
-                break;
-            case 0xD: // Note delay
-                if (tick == y) {
-                    trig(0);
-                }
-                break;
-            default:
-                if (!tick) wprintf(L"%2.2d: Ignoring effect %c%02X\n", current_position().row, effchar, xy);
-            }
-            break;
-        case 'T': // Txy Set tempo
-            assert(xy >= 0x20);
-            do_set_tempo(xy);
-            break;
-        default:
-            if (!tick) wprintf(L"%2.2d: Ignoring effect %c%02X\n", current_position().row, effchar, xy);
-        }
+    void process_effect(int tick, const module_event& e) {
+        effects_[e.effect_op](*this, tick, e);
     }
 
 private:
+    using effect_table = effect_handler_table<s3m_channel>;
+    const effect_table::value_type* effects_ = get_effect_table().data();
     int  sample_offset_ = 0;
     int  last_vol_slide_ = 0;
 
+    void ignore_effect(int tick, const module_event& e) {
+        if (!tick) log().write_limited(log_key_effect + e.effect_op, L"%2.2d: Ignoring effect %c%02X\n", current_position().row, effect_type_char(module_type::s3m, e.note.effect >> 8), e.effect_param);
+    }
+
+    static const effect_table& get_effect_table() {
+        static const effect_table table = [] {
+            effect_table t;
+            t.fill([](s3m_channel& c, int tick, const module_event& e) {
+                c.ignore_effect(tick, e);
+            });
+            t[effect_op_none] = [](s3m_channel&, int, const module_event&) {};
+            t[effect_op_unknown] = unknown_effect<s3m_channel>;
+            t[s3m_effect_op('A')] = [](s3m_channel&, int, const module_event&) {}; // Set speed (handled by module_sequencer)
+            t[s3m_effect_op('B')] = [](s3m_channel& c, int tick, const module_event& e) { // Pattern jump (handled by module_sequencer)
+                if (!tick) c.log().write(L"Pattern jump! B%02X\n", e.effect_param);
+            };
+            t[s3m_effect_op('C')] = [](s3m_channel&, int, const module_event&) {}; // Pattern break (handled by module_sequencer)
+            t[s3m_effect_op('D')] = [](s3m_channel& c, int tick, const module_event& e) { // Volume slide
+                c.do_s3m_volume_slide(tick, e.effect_param);
+            };
+            t[s3m_effect_op('E')] = [](s3m_channel& c, int tick, const module_event& e) { // Portamento down
+                c.do_s3m_porta(tick, +1, e.effect_param);
+            };
+            t[s3m_effect_op('F')] = [](s3m_channel& c, int tick, const module_event& e) { // Portamento up
+                c.do_s3m_porta(tick, -1, e.effect_param);
+            };
+            t[s3m_effect_op('G')] = [](s3m_channel& c, int tick, const module_event& e) { // Gxy Porta to note
+                if (e.effect_param) c.porta_speed(e.effect_param * 4);
+                if (tick) c.do_porta_to_note();
+            };
+            t[s3m_effect_op('H')] = [](s3m_channel& c, int tick, const module_event& e) { // Vibrato
+                c.do_vibrato(tick, effect_x(e), effect_y(e)); // TODO: y * 4?
+            };
+            t[s3m_effect_op('J')] = [](s3m_channel& c, int tick, const module_event& e) { // Arpeggio
+                c.do_arpeggio(tick, effect_x(e), effect_y(e));
+            };
+            t[s3m_effect_op('K')] = [](s3m_channel& c, int tick, const module_event& e) { // Kxy Vibrato + Volume Slide
+                c.do_vibrato(tick, 0, 0);
+                c.do_s3m_volume_slide(tick, e.effect_param);
+            };
+            t[s3m_effect_op('O')] = [](s3m_channel&, int, const module_event&) {}; // Oxy Sample offset (handled in process_note)
+            t[s3m_effect_op('Q')] = [](s3m_channel& c, int tick, const module_event& e) { // Qxy (Retrig + Volume Slide)
+                c.do_retrig_and_volume_slide(tick, e.effect_param);
+            };
+            t[extended_effect_op(0x8)] = [](s3m_channel& c, int tick, const module_event& e) { // S8y Pan position
+                if (!tick) c.pan(effect_y(e) << 4);
+            };
+            t[extended_effect_op(0xB)] = [](s3m_channel&, int, const module_event&) {}; // SBy Pattern Loop (handled by module_sequencer)
+            t[extended_effect_op(0xC)] = [](s3m_channel& c, int tick, const module_event& e) { // SCy Note cut
+                if (tick == effect_y(e)) c.volume(0);
+            };
+            t[extended_effect_op(0xD)] = [](s3m_channel& c, int tick, const module_event& e) { // SDy Note delay
+                if (tick == effect_y(e)) c.trig(0);
+            };
+            t[s3m_effect_op('T')] = [](s3m_channel&, int, const module_event&) {}; // Txy Set tempo (handled by module_sequencer)
+            return t;
+        }();
+        return table;
+    }
+
     void do_s3m_volume_slide(int tick, int xy) {
         if (xy) last_vol_slide_ = xy;
         const int x = last_vol_slide_ >> 4;
@@ -872,28 +932,27 @@ private:
 //
 class xm_channel : public channel_base {
 public:
-    explicit xm_channel(mod_player::impl& player, sample_voice& voice, uint8_t default_pan) : channel_base(player, voice, default_pan) {
+    explicit xm_channel(mod_player::impl& player, voice_pool& voices, uint8_t default_pan) : channel_base(player, voices, default_pan) {
     }
-    virtual void process_note(const module_note& note) override {
+    void process_note(const module_note& note) {
         if (note.instrument) {
             instrument_number(note.instrument);
             sample(instrument().samp()); // TODO: Base sample on note
         }
         if (note.note != piano_key::NONE) {
             if (!instrument_number() || note.note == piano_key::OFF) {
-                volume(0);
+                if (!key_off()) volume(0);
                 return;
             }
-            auto& inst = instrument();
             const int xm_note = static_cast<int>(note.note) - xm_octave_offset * 12;
-            assert(xm_note >= 0 && xm_note < module_instrument::sample_mapping_size);
-            sample(inst.samples()[inst.sample_mapping()[xm_note]]);
+            sample(instrument().note_sample(xm_note));
 
             const int effect_type = note.effect >> 8;
             const int period = mod().note_to_period(note.note + sample().relative_note());
             if (effect_type == 3 || effect_type == 5) {
                 set_porta_target(period);
             } else {
+                hold_voice();
                 set_period(period);
 
                 if (!is_mod_note_delay(note.effect)) {
@@ -912,151 +971,120 @@ public:
         }
     }
 
-    virtual void process_effect(int tick, const module_note& note) override {
-        process_xm_volume_command(tick, note);
+    void process_empty_row() {
+        // Same as process_note and process_effect on tick 0 for an empty note
+        update_fadeout();
+        update_fadeout();
+    }
+
+    void process_effect(int tick, const module_event& e) {
+        process_xm_volume_command(tick, e.note);
         if (!tick) update_fadeout();
+        effects_[e.effect_op](*this, tick, e);
+    }
 
-        const int effect      = note.effect;
-        if (!effect) return;
-        const int effect_type = effect >> 8;
-        const int xy          = effect & 0xff;
-        const int x           = xy >> 4;
-        const int y           = xy & 0xf;
-        assert(effect_type < 38);
-        switch (effect_type) {
-        case 0x0: // 0xy Arpeggio
-            do_arpeggio(tick, x, y);
-            return;
-        case 0x01: // 1xy Porta down
-            if (tick) {
-                do_porta(-xy * 4);
-            }
-            return;
-        case 0x02: // 2xy Porta down
-            if (tick) {
-                do_porta(+xy * 4);
-            }
-            return;
-        case 0x3: // 3xy Porta to note
-            if (xy) porta_speed(xy * 4);
-            if (tick) {
-                do_porta_to_note();
-            }
-            return;
-        case 0x4: // 4xy Vibrato
-            do_vibrato(tick, x, y * 4);
-            return;
-        case 0x5: // 5xy Porta + Voume slide (5xy = 300 + Axy)
-            if (tick) {
-                do_porta_to_note();
-                do_volume_slide(x, y);
-            }
-            return;
-        case 0x6: // 6xy Vibrato + Volume slide (6xy = 400 + Axy)
-            if (tick) {
-                do_vibrato(tick, 0, 0);
-                do_volume_slide(x, y);
-            }
-            return;
-        case 0x8: // 8xy Set pan
-            pan(xy);
-            return;
-        case 0x9: // 9xy Sample offset
-            break;
-        case 0xA: // Axy Volume slide
-            if (tick) {
-                do_volume_slide(x, y);
-            }
-            return;
-        case 0xC: // Cxy Set volume
-            if (tick == 0) {
-                volume(xy);
-            }
-            return;
-        case 0xD: // Dxy Pattern break
-            if (tick == 0) {
-                do_pattern_break(x*10 + y);
+    void process_tick(int) {
+        update_envelopes();
+    }
+
+private:
+    using effect_table = effect_handler_table<xm_channel>;
+    const effect_table::value_type* effects_ = get_effect_table().data();
+    int  sample_offset_ = 0;
+
+    static const effect_table& get_effect_table() {
+        static const effect_table table = [] {
+            effect_table t;
+            t.fill([](xm_channel& c, int tick, const module_event& e) {
+                if (!tick) c.log().write_limited(log_key_effect + e.effect_op, L"%2.2d: Ignoring effect %c%02X\n", c.current_position().row, effect_type_char(module_type::xm, e.note.effect >> 8), e.effect_param);
+            });
+            for (int x = 0; x < 16; ++x) {
+                t[extended_effect_op(x)] = [](xm_channel& c, int tick, const module_event& e) {
+                    if (!tick) c.log().write_limited(log_key_effect + e.effect_op, L"%2.2d: Ignoring effect E%02X\n", c.current_position().row, e.effect_param);
+                };
             }
-            return;
-        case 0xE:
-            switch (x) {
-            case 0x0: // E0y Set fiter
-                return;
-            case 0x1: // E1y Fine porta down
-                if (!tick) {
-                    do_porta(-y * 4);
-                }
-                return;
-            case 0x2: // E2y Fine porta down
-                if (!tick) {
-                    do_porta(+y * 4);
-                }
-                return;
-            case 0x6: // E6y Pattern loop
-                if (!tick) {
-                    do_pattern_loop(y);
-                }
-                return;
-            case 0x9: // E9x Retrig note
-                assert(y);
-                if (tick && tick % y == 0) {
-                    trig(0);
-                }
-                return;
-            case 0xA: // EAy Fine volume slide up
-                if (!tick)  {
-                    do_volume_slide(+y);
+            t[effect_op_none] = [](xm_channel&, int, const module_event&) {};
+            t[effect_op_unknown] = unknown_effect<xm_channel>;
+            t[effect_op(0x0)] = [](xm_channel& c, int tick, const module_event& e) { // 0xy Arpeggio
+                c.do_arpeggio(tick, effect_x(e), effect_y(e));
+            };
+            t[effect_op(0x1)] = [](xm_channel& c, int tick, const module_event& e) { // 1xy Porta down
+                if (tick) c.do_porta(-e.effect_param * 4);
+            };
+            t[effect_op(0x2)] = [](xm_channel& c, int tick, const module_event& e) { // 2xy Porta down
+                if (tick) c.do_porta(+e.effect_param * 4);
+            };
+            t[effect_op(0x3)] = [](xm_channel& c, int tick, const module_event& e) { // 3xy Porta to note
+                if (e.effect_param) c.porta_speed(e.effect_param * 4);
+                if (tick) c.do_porta_to_note();
+            };
+            t[effect_op(0x4)] = [](xm_channel& c, int tick, const module_event& e) { // 4xy Vibrato
+                c.do_vibrato(tick, effect_x(e), effect_y(e) * 4);
+            };
+            t[effect_op(0x5)] = [](xm_channel& c, int tick, const module_event& e) { // 5xy Porta + Voume slide (5xy = 300 + Axy)
+                if (tick) {
+                    c.do_porta_to_note();
+                    c.do_volume_slide(effect_x(e), effect_y(e));
                 }
-                return;
-            case 0xB: // EAy Fine volume slide down
-                if (!tick) {
-                    do_volume_slide(-y);
-                }
-                return;            
-            case 0xC: // ECy Cut note
-                if (tick == y) {
-                    volume(0);
+            };
+            t[effect_op(0x6)] = [](xm_channel& c, int tick, const module_event& e) { // 6xy Vibrato + Volume slide (6xy = 400 + Axy)
+                if (tick) {
+                    c.do_vibrato(tick, 0, 0);
+                    c.do_volume_slide(effect_x(e), effect_y(e));
                 }
-                return;
-            case 0xD: // EDy Delay note
-                if (tick == y) {
-                    trig(0);
-                    if (note.volume >= volume_command::set_00 && note.volume <= volume_command::set_40) {
-                        volume(note.volume - volume_command::set_00);
-                    } else {
-                        if (note.volume != volume_command::none) {
-                            wprintf(L"%2.2d: Ignoring volume command %02X on delay note\n", current_position().row, note.volume);
-                        }
+            };
+            t[effect_op(0x8)] = [](xm_channel& c, int, const module_event& e) { // 8xy Set pan
+                c.pan(e.effect_param);
+            };
+            t[effect_op(0x9)] = [](xm_channel&, int, const module_event&) {}; // 9xy Sample offset (handled in process_note)
+            t[effect_op(0xA)] = [](xm_channel& c, int tick, const module_event& e) { // Axy Volume slide
+                if (tick) c.do_volume_slide(effect_x(e), effect_y(e));
+            };
+            t[effect_op(0xC)] = [](xm_channel& c, int tick, const module_event& e) { // Cxy Set volume
+                if (!tick) c.volume(e.effect_param);
+            };
+            t[effect_op(0xD)] = [](xm_channel&, int, const module_event&) {}; // Dxy Pattern break (handled by module_sequencer)
+            t[extended_effect_op(0x0)] = [](xm_channel&, int, const module_event&) {}; // E0y Set fiter
+            t[extended_effect_op(0x1)] = [](xm_channel& c, int tick, const module_event& e) { // E1y Fine porta down
+                if (!tick) c.do_porta(-effect_y(e) * 4);
+            };
+            t[extended_effect_op(0x2)] = [](xm_channel& c, int tick, const module_event& e) { // E2y Fine porta down
+                if (!tick) c.do_porta(+effect_y(e) * 4);
+            };
+            t[extended_effect_op(0x6)] = [](xm_channel&, int, const module_event&) {}; // E6y Pattern loop (handled by module_sequencer)
+            t[extended_effect_op(0x9)] = [](xm_channel& c, int tick, const module_event& e) { // E9x Retrig note
+                assert(effect_y(e));
+                if (tick && tick % effect_y(e) == 0) c.trig(0);
+            };
+            t[extended_effect_op(0xA)] = [](xm_channel& c, int tick, const module_event& e) { // EAy Fine volume slide up
+                if (!tick) c.do_volume_slide(+effect_y(e));
+            };
+            t[extended_effect_op(0xB)] = [](xm_channel& c, int tick, const module_event& e) { // EAy Fine volume slide down
+                if (!tick) c.do_volume_slide(-effect_y(e));
+            };
+            t[extended_effect_op(0xC)] = [](xm_channel& c, int tick, const module_event& e) { // ECy Cut note
+                if (tick == effect_y(e)) c.volume(0);
+            };
+            t[extended_effect_op(0xD)] = [](xm_channel& c, int tick, const module_event& e) { // EDy Delay note
+                if (tick == effect_y(e)) {
+                    c.trig(0);
+                    const auto vol = e.note.volume;
+                    if (vol >= volume_command::set_00 && vol <= volume_command::set_40) {
+                        c.volume(vol - volume_command::set_00);
+                    } else if (vol != volume_command::none) {
+                        c.log().write_limited(log_key_volume_command + (static_cast<int>(vol) >> 4), L"%2.2d: Ignoring volume command %02X on delay note\n", c.current_position().row, static_cast<int>(vol));
                     }
                 }
-                return;
-            default:
-                if (!tick) {
-                    wprintf(L"%2.2d: Ignoring effect E%02X\n", current_position().row, xy);
-                }
-            }
-            break;
-        case 0xF: // Fxy Set speed
-            if (tick) return;
-            if (xy < 0x20) {
-                do_set_speed(xy);
-            } else {
-                do_set_tempo(xy);
-            }
-            return;
-        case 'R'-'A'+10: // Rxy Multi retrig
-            do_retrig_and_volume_slide(tick, xy);
-            break;
-        case 'W'-'A'+10: // Wxy Sync?
-            break;
-        default:
-            if (!tick) {
-                wprintf(L"%2.2d: Ignoring effect %c%02X\n", current_position().row, "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[effect_type], xy);
-            }
-        }
+            };
+            t[effect_op(0xF)] = [](xm_channel&, int, const module_event&) {}; // Fxy Set speed (handled by module_sequencer)
+            t[effect_op('R'-'A'+10)] = [](xm_channel& c, int tick, const module_event& e) { // Rxy Multi retrig
+                c.do_retrig_and_volume_slide(tick, e.effect_param);
+            };
+            t[effect_op('W'-'A'+10)] = [](xm_channel&, int, const module_event&) {}; // Wxy Sync?
+            return t;
+        }();
+        return table;
     }
-private:
-    int  sample_offset_ = 0;
 
     void process_xm_volume_command(int tick, const module_note& note) {
         if (note.volume == volume_command::none) {
@@ -1074,16 +1102,60 @@ private:
         } else if (note.volume >= volume_command::pan_0 && note.volume <= volume_command::pan_f) {
             if (!tick) pan((note.volume - volume_command::pan_0) << 4);
         } else {
-            wprintf(L"%2.2d: Ignoring volume command %02X\n", current_position().row, static_cast<int>(note.volume));
+            log().write_limited(log_key_volume_command + (static_cast<int>(note.volume) >> 4), L"%2.2d: Ignoring volume command %02X\n", current_position().row, static_cast<int>(note.volume));
+        }
+    }
+};
+
+//
+// channel_engine
+//
+template<typename Channel>
+class channel_engine : public channel_engine_base {
+public:
+    explicit channel_engine(mod_player::impl& player, voice_pool& voices) {
+        const auto& mod = player.mod();
+        channels_.reserve(mod.num_channels);
+        for (int i = 0; i < mod.num_channels; ++i) {
+            channels_.emplace_back(player, voices, static_cast<uint8_t>(mod.channel_default_pan(i)));
+        }
+    }
+
+    virtual void process_row(module_event_range events) override {
+        for (auto& c : channels_) {
+            c.begin_row();
+        }
+        // Events are sorted by channel
+        int ch = 0;
+        for (const auto& e : events) {
+            for (; ch < e.channel; ++ch) {
+                channels_[ch].process_empty_row();
+            }
+            channels_[ch++].process_note(e.note);
+        }
+        for (const int num_channels = static_cast<int>(channels_.size()); ch < num_channels; ++ch) {
+            channels_[ch].process_empty_row();
+        }
+    }
+
+    virtual void process_effects(int tick, module_event_range events) override {
+        for (const auto& e : events) {
+            channels_[e.channel].process_effect(tick, e);
+        }
+        for (auto& c : channels_) {
+            c.process_tick(tick);
         }
     }
+
+private:
+    std::vector<Channel> channels_;
 };
 
-std::unique_ptr<channel_base> make_channel(mod_player::impl& player, sample_voice& voice, uint8_t default_pan) {
+std::unique_ptr<channel_engine_base> make_channel_engine(mod_player::impl& player, voice_pool& voices) {
     switch (player.mod().type) {
-    case module_type::mod: return std::make_unique<mod_channel>(player, voice, default_pan);
-    case module_type::s3m: return std::make_unique<s3m_channel>(player, voice, default_pan);
-    case module_type::xm: return std::make_unique<xm_channel>(player, voice, default_pan);
+    case module_type::mod: return std::make_unique<channel_engine<mod_channel>>(player, voices);
+    case module_type::s3m: return std::make_unique<channel_engine<s3m_channel>>(player, voices);
+    case module_type::xm: return std::make_unique<channel_engine<xm_channel>>(player, voices);
     }
     assert(false);
     throw std::runtime_error("Unknown module type");
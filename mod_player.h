@@ -2,6 +2,7 @@
 #define SAMPEDIT_MOD_PLAYER_H
 
 #include <memory>
+#include <stdint.h>
 #include <base/event.h>
 #include "module.h"
 
@@ -9,7 +10,8 @@ class mixer;
 
 class mod_player {
 public:
-    explicit mod_player(module&& mod, mixer& m);
+    // num_voices is the size of the voice pool shared by the channels (at least one per channel, 0 for two per channel)
+    explicit mod_player(module&& mod, mixer& m, int num_voices = 0);
     ~mod_player();
 
     const module& mod() const;
@@ -19,9 +21,23 @@ public:
     void stop();
     void toggle_playing();
 
-    void on_position_changed(const callback_function_type<module_position>& cb);
+    // Latest position published by the player, can be polled from any thread without disturbing the audio.
+    // Returns the number of position changes so far, so pollers can skip the update if nothing has changed.
+    uint32_t position(module_position& pos) const;
 
-    static constexpr int max_rows     = 64;
+    // Coalesced wakeup: Called from the audio thread when the position changes, but only the first time after
+    // the position has been read. Must not block.
+    void on_position_changed(const callback_function_type<>& cb);
+
+    // Called from the audio thread with the index of each instrument (in module::instruments) whose samples
+    // haven't been decoded yet, a few rows before it's first played (or when it's played after a jump). Called
+    // at most once per instrument. Must not block. Subscribe before starting playback.
+    void on_instrument_needed(const callback_function_type<int>& cb);
+
+    // Number of voices currently playing (including notes fading out), updated every tick
+    int active_voices() const;
+
+    static constexpr int max_rows     = module::max_rows;
     static constexpr int max_volume   = 64;
 
     class impl;
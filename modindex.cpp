@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+
+#include <win32/find_files.h>
+#include "module_index.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+double elapsed_ms(clock_type::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+void usage()
+{
+    wprintf(L"Usage: modindex build <directory> <index file> [threads]  Index the modules in directory and its subdirectories\n");
+    wprintf(L"       modindex name <index file> <prefix>                 List the modules with a song name starting with prefix\n");
+    wprintf(L"       modindex search <index file> <text>                 List the modules with text in a file, song, instrument or sample name\n");
+    wprintf(L"       modindex show <index file> <text>                   Same as search with the instrument and sample names\n");
+}
+
+void print_entry(const module_info& info)
+{
+    wprintf(L"%-3S %2dch %3d orders %3d patterns %3d instruments %2d:%02d  %-20S  %S\n",
+        module_type_name[static_cast<int>(info.type)], info.num_channels, info.num_orders, info.num_patterns,
+        static_cast<int>(info.instrument_names.size()), info.duration_ms / 60000, info.duration_ms / 1000 % 60,
+        info.name.c_str(), info.filename.c_str());
+}
+
+void print_names(const module_info& info)
+{
+    for (size_t i = 0; i < info.instrument_names.size(); ++i) {
+        wprintf(L"    Instrument %2d: %S\n", static_cast<int>(i + 1), info.instrument_names[i].c_str());
+    }
+    for (size_t i = 0; i < info.sample_names.size(); ++i) {
+        wprintf(L"    Sample     %2d: %S\n", static_cast<int>(i + 1), info.sample_names[i].c_str());
+    }
+}
+
+int build(const std::string& directory, const std::string& index_filename, int num_threads)
+{
+    // The loaders describe every module they read, which isn't useful for a whole library
+    print_load_messages(false);
+
+    const auto start = clock_type::now();
+    const auto filenames = find_files(directory);
+    const double find_ms = elapsed_ms(start);
+    std::vector<std::string> failed;
+    const auto modules = read_module_infos(filenames, num_threads, failed);
+    const double read_ms = elapsed_ms(start) - find_ms;
+    if (!write_module_index(index_filename, modules)) {
+        throw std::runtime_error("Could not write " + index_filename);
+    }
+
+    for (const auto& f : failed) {
+        fwprintf(stderr, L"Could not load %S\n", f.c_str());
+    }
+    fwprintf(stderr, L"Indexed %d modules of %d files (%d failed) in %.0f ms (finding files %.0f ms, reading %.0f ms)\n",
+        static_cast<int>(modules.size()), static_cast<int>(filenames.size()), static_cast<int>(failed.size()), elapsed_ms(start), find_ms, read_ms);
+    return 0;
+}
+
+std::unique_ptr<module_index> open_index(const std::string& index_filename)
+{
+    auto index = module_index::open(index_filename);
+    if (!index) {
+        throw std::runtime_error(index_filename + " isn't a valid module index");
+    }
+    return index;
+}
+
+int query(const std::string& command, const std::string& index_filename, const std::string& text)
+{
+    const auto start = clock_type::now();
+    const auto index = open_index(index_filename);
+    const double open_ms = elapsed_ms(start);
+    std::vector<int> matches;
+    if (command == "name") {
+        const auto range = index->find_name(text);
+        for (int i = range.first; i < range.second; ++i) {
+            matches.push_back(i);
+        }
+    } else {
+        matches = index->search(text);
+    }
+    const double query_ms = elapsed_ms(start) - open_ms;
+
+    for (int i : matches) {
+        const auto info = index->info(i);
+        print_entry(info);
+        if (command == "show") {
+            print_names(info);
+        }
+    }
+    wprintf(L"%d of %d modules (opening the index %.2f ms, query %.2f ms)\n", static_cast<int>(matches.size()), index->size(), open_ms, query_ms);
+    return 0;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        const std::string command = argc > 1 ? argv[1] : "";
+        if (command == "build" && (argc == 4 || argc == 5)) {
+            return build(argv[2], argv[3], argc == 5 ? std::stoi(argv[4]) : 0);
+        } else if ((command == "name" || command == "search" || command == "show") && argc == 4) {
+            return query(command, argv[2], argv[3]);
+        }
+        usage();
+    } catch (const std::exception& e) {
+        fwprintf(stderr, L"%S\n", e.what());
+    }
+    return 1;
+}
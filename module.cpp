@@ -1,13 +1,37 @@
 #include "module.h"
 #include "xm.h"
+#include "module_cache.h"
 #include <base/stream_util.h>
 #include <base/note.h>
+#include <base/sample_store.h>
 #include <fstream>
 #include <stdint.h>
 #include <stdexcept>
 #include <string>
 #include <algorithm>
+#include <cstring>
 #include <assert.h>
+#include <atomic>
+#include <cstdarg>
+#include <cwchar>
+
+static std::atomic<bool> load_messages_enabled{true};
+
+void print_load_messages(bool print)
+{
+    load_messages_enabled = print;
+}
+
+void load_message(const wchar_t* format, ...)
+{
+    if (!load_messages_enabled) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vwprintf(format, args);
+    va_end(args);
+}
 
 constexpr uint8_t default_pan_value = 0x30;
 constexpr float s3m_clock_rate      = 14317056.0f;
@@ -22,14 +46,164 @@ constexpr int freq_to_amiga_period(float freq) {
     return static_cast<int>(0.5 + amiga_clock_rate / (2 * freq));
 }
 
-const module_note* module::at(int ord, int row) const
+module_envelope::module_envelope(const std::vector<module_envelope_point>& points, int sustain_point, int loop_start, int loop_end)
+{
+    assert(!points.empty() && points[0].x == 0);
+    const int num_points = static_cast<int>(points.size());
+    values_.resize(points.back().x + 1);
+    for (int i = 0; i < num_points; ++i) {
+        const auto& p0 = points[i];
+        const auto& p1 = points[std::min(i + 1, num_points - 1)];
+        assert(p0.y >= 0 && p0.y <= max_value && p1.x >= p0.x);
+        for (int x = p0.x; x < p1.x; ++x) {
+            values_[x] = static_cast<uint8_t>(p0.y + (p1.y - p0.y) * (x - p0.x) / (p1.x - p0.x));
+        }
+    }
+    values_.back() = static_cast<uint8_t>(points.back().y);
+
+    auto point_x = [&](int point) { return point >= 0 && point < num_points ? points[point].x : -1; };
+    sustain_    = point_x(sustain_point);
+    loop_start_ = point_x(loop_start);
+    loop_end_   = point_x(loop_end);
+    if (loop_start_ < 0 || loop_end_ < loop_start_) {
+        loop_start_ = loop_end_ = -1;
+    }
+}
+
+uint64_t hash_column(const packed_note* column, int num_rows)
+{
+    // FNV-1a
+    const uint8_t* const data = reinterpret_cast<const uint8_t*>(column);
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < num_rows * sizeof(packed_note); ++i) {
+        hash = (hash ^ data[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+uint32_t pattern_arena::add_column(const packed_note* column, int num_rows)
+{
+    const uint64_t hash  = hash_column(column, num_rows);
+    const auto     range = column_index_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second + num_rows <= cells_.size() && !memcmp(&cells_[it->second], column, num_rows * sizeof(packed_note))) {
+            return it->second;
+        }
+    }
+    const auto offset = static_cast<uint32_t>(cells_.size());
+    cells_.insert(cells_.end(), column, column + num_rows);
+    column_index_.emplace(hash, offset);
+    return offset;
+}
+
+void pattern_arena::add_pattern(const std::vector<module_note>& notes, int num_rows, int num_channels)
+{
+    assert(num_rows >= 1 && num_rows <= max_rows);
+    assert(num_channels > 0 && (rows_.empty() || num_channels == num_channels_));
+    assert(notes.empty() || static_cast<int>(notes.size()) == num_rows * num_channels);
+    num_channels_ = num_channels;
+    packed_note column[max_rows];
+    for (int ch = 0; ch < num_channels; ++ch) {
+        for (int row = 0; row < num_rows; ++row) {
+            column[row] = pack(notes.empty() ? module_note{} : notes[row * num_channels + ch]);
+        }
+        columns_.push_back(add_column(column, num_rows));
+    }
+    rows_.push_back(static_cast<uint16_t>(num_rows));
+    unpacked_size_ += sizeof(notes) + notes.size() * sizeof(module_note);
+}
+
+void pattern_arena::finish()
+{
+    std::unordered_multimap<uint64_t, uint32_t>{}.swap(column_index_);
+    cells_.shrink_to_fit();
+    columns_.shrink_to_fit();
+    rows_.shrink_to_fit();
+}
+
+void pattern_arena::assign(std::vector<packed_note>&& cells, std::vector<uint32_t>&& columns, std::vector<uint16_t>&& rows, int num_channels, size_t unpacked_size)
+{
+    assert(num_channels > 0 && columns.size() == rows.size() * num_channels);
+    cells_         = std::move(cells);
+    columns_       = std::move(columns);
+    rows_          = std::move(rows);
+    num_channels_  = num_channels;
+    unpacked_size_ = unpacked_size;
+    std::unordered_multimap<uint64_t, uint32_t>{}.swap(column_index_);
+}
+
+int module::num_rows(int ord) const
+{
+    assert(ord < static_cast<int>(order.size()));
+    return patterns.num_rows(order[ord]);
+}
+
+module_row module::at(int ord, int row) const
 {
     assert(ord < order.size());
-    assert(order[ord] < patterns.size());
-    assert(row < 64);
-    const auto& pattern = patterns[order[ord]];
-    assert((row+1) * num_channels - 1 < pattern.size());
-    return &pattern[row * num_channels];
+    return patterns.row(order[ord], row);
+}
+
+module_event_range module::events_at(int ord, int row) const
+{
+    assert(ord < static_cast<int>(order.size()) && order[ord] < pattern_row_events.size());
+    assert(row < patterns.num_rows(order[ord]));
+    const int index = pattern_row_events[order[ord]] + row;
+    assert(index + 1 < static_cast<int>(row_events.size()));
+    const module_event* const first = events.data();
+    return module_event_range{first + row_events[index], first + row_events[index + 1]};
+}
+
+uint8_t decode_effect(module_type type, uint16_t effect)
+{
+    if (!effect) {
+        return effect_op_none;
+    }
+    const int effect_type   = effect >> 8;
+    const int extended_type = type == module_type::s3m ? 'S' - 'A' + 1 : 0xE;
+    if (effect_type == extended_type) {
+        return extended_effect_op((effect >> 4) & 0xf);
+    }
+    if (effect_type > max_effect_type(type)) {
+        return effect_op_unknown;
+    }
+    static_assert(effect_op(max_effect_type(module_type::xm)) < effect_op_unknown && effect_op(max_effect_type(module_type::s3m)) < effect_op_unknown, "");
+    static_assert(effect_op_unknown < extended_effect_op(0), "");
+    return effect_op(effect_type);
+}
+
+char effect_type_char(module_type type, int effect_type)
+{
+    if (effect_type < 0 || effect_type > max_effect_type(type)) {
+        return '?';
+    }
+    if (type == module_type::s3m) {
+        return static_cast<char>(effect_type - 1 + 'A');
+    }
+    return "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[effect_type];
+}
+
+void module::compile_patterns()
+{
+    events.clear();
+    row_events.clear();
+    pattern_row_events.clear();
+    patterns.finish();
+    pattern_row_events.reserve(patterns.size());
+    for (int pattern = 0; pattern < patterns.size(); ++pattern) {
+        pattern_row_events.push_back(static_cast<uint32_t>(row_events.size()));
+        for (int row = 0; row < patterns.num_rows(pattern); ++row) {
+            row_events.push_back(static_cast<uint32_t>(events.size()));
+            const auto cells = patterns.row(pattern, row);
+            for (int ch = 0; ch < num_channels; ++ch) {
+                const auto note = cells[ch];
+                if (!is_empty(note)) {
+                    events.push_back(module_event{static_cast<uint8_t>(ch), note, decode_effect(type, note.effect), static_cast<uint8_t>(note.effect & 0xff)});
+                }
+            }
+        }
+    }
+    row_events.push_back(static_cast<uint32_t>(events.size()));
 }
 
 // XM amiga period table
@@ -108,6 +282,34 @@ float module::period_to_freq(int period) const {
     }
 }
 
+pitch_table::pitch_table(const module& mod, int sample_rate) : mod_(mod), sample_rate_(static_cast<float>(sample_rate)), increment_(num_periods) {
+    assert(sample_rate > 0);
+    increment_[0] = 0;
+    for (int period = 1; period < num_periods; ++period) {
+        increment_[period] = mod.period_to_freq(period) / sample_rate_;
+    }
+    for (int i = 0; i < max_semitones; ++i) {
+        scale_[i] = note_difference_to_scale(static_cast<float>(i));
+    }
+}
+
+float pitch_table::period_to_increment(int period) const {
+    assert(period > 0);
+    if (period < num_periods) {
+        return increment_[period];
+    }
+    return mod_.period_to_freq(period) / sample_rate_;
+}
+
+int pitch_table::transpose_period(int period, int semitones) const {
+    assert(semitones >= 0 && semitones < max_semitones);
+    if (mod_.type == module_type::xm && mod_.xm.use_linear_frequency) {
+        return period - semitones * 16 * 4; // 16*4 units per semitone
+    }
+    // Only divisions for the non-linear tables
+    return mod_.freq_to_period(mod_.period_to_freq(period) * scale_[semitones]);
+}
+
 int module::channel_default_pan(int channel) const
 {
     assert(channel >= 0 && channel < num_channels);
@@ -159,7 +361,7 @@ constexpr uint32_t make_sig(const char (&arr)[5]) {
     return make_sig(arr[0], arr[1], arr[2], arr[3]);
 }
 
-void load_s3m(std::istream& in, const char* filename, module& mod)
+void load_s3m(std::istream& in, const char* filename, module& mod, std::vector<deferred_sample>* deferred)
 {
     assert(is_s3m(in));
     mod.name = read_string(in, 28);
@@ -183,12 +385,17 @@ void load_s3m(std::istream& in, const char* filename, module& mod)
     const int default_pan     = read_le_u8(in); // 252 = default
     skip(in, 10); // Skip expansion (8 bytes) and special (2 bytes)
     assert((int)in.tellg() == 0x40);
-    wprintf(L"S3M tracker version: %4.4X\n", tracker_version);
-    assert(tracker_version == 0x1300 || tracker_version == 0x1301 || tracker_version == 0x1310 || tracker_version == 0x1320 || tracker_version == 0x3212); // 0x1301=ST3.01, 0x1310=ST3.10, 0x1320=ST3.20
+    load_message(L"S3M tracker version: %4.4X\n", tracker_version);
+    if (!(tracker_version == 0x1300 || tracker_version == 0x1301 || tracker_version == 0x1310 || tracker_version == 0x1320 || tracker_version == 0x3212)) { // 0x1301=ST3.01, 0x1310=ST3.10, 0x1320=ST3.20
+        // Saved by another tracker (Impulse Tracker, Schism Tracker, OpenMPT etc.)
+        load_message(L"Untested tracker version %4.4X, playing as Scream Tracker 3.20\n", tracker_version);
+    }
     if (tracker_version == 0x1300) {
-        wprintf(L"Ignoring compatiblity (vol slides process on tick 0 etc..) for tracker_version=%X\n", tracker_version);
+        load_message(L"Ignoring compatiblity (vol slides process on tick 0 etc..) for tracker_version=%X\n", tracker_version);
+    }
+    if (sample_type != 1 && sample_type != 2) {
+        throw std::runtime_error("Invalid sample type in S3M " + std::string(filename));
     }
-    assert(sample_type == 2);
     assert(signature == make_sig("SCRM"));
 
     // Channel settings
@@ -212,15 +419,17 @@ void load_s3m(std::istream& in, const char* filename, module& mod)
     for (int i = 0; i < song_length; ++i) {
         const auto ord = read_le_u8(in);
         if (ord < 254) { // 254 = marker pattern, 255 = end of song
+            if (ord >= num_patterns) {
+                throw std::runtime_error("Invalid order in S3M " + std::string(filename));
+            }
             mod.order.push_back(ord);
-            assert(ord < num_patterns);
         }
     }
     assert(num_patterns > 0);
     const auto instrument_pointers = read_le_u16(in, num_instruments);
     const auto pattern_pointers = read_le_u16(in, num_patterns);
     
-    wprintf(L"Song name: '%S', %d channel(s), len %d, %d instrument(s), %d pattern(s)\n", mod.name.c_str(), num_channels, song_length, num_instruments, num_patterns);
+    load_message(L"Song name: '%S', %d channel(s), len %d, %d instrument(s), %d pattern(s)\n", mod.name.c_str(), num_channels, song_length, num_instruments, num_patterns);
 
     if (default_pan == 252) {
         for (int i = 0; i < max_channels; ++i) {
@@ -233,7 +442,7 @@ void load_s3m(std::istream& in, const char* filename, module& mod)
     }
 
     if (!(master_volume & 0x80)) {
-        wprintf(L"Making song mono!\n");
+        load_message(L"Making song mono!\n");
         for (auto& p : channel_pan) p = 0x80;
     }
 
@@ -250,7 +459,11 @@ void load_s3m(std::istream& in, const char* filename, module& mod)
             mod.instruments.push_back(module_instrument{});
             continue;
         }
-        assert(type == 1); // 1 = instrument
+        if (type != 1) { // 1 = instrument, 2-7 = AdLib
+            load_message(L"%2d: Ignoring AdLib instrument\n", i);
+            mod.instruments.push_back(module_instrument{});
+            continue;
+        }
         char dos_filename[12];
         in.read(dos_filename, sizeof(dos_filename));
         // Read oddball 24-bit memseg value
@@ -268,27 +481,25 @@ void load_s3m(std::istream& in, const char* filename, module& mod)
         skip(in, 12);
         const auto name            = read_string(in, 28);
         const uint32_t samplesig   = read_le_u32(in);
-        wprintf(L"%2d: %-28.28S Len=%6d Loop=(%6d, %6d) c2speed=%d\n", i, name.c_str(), length, loop_start, loop_end, c2spd);
-        assert(packing == 0);
-        assert(length < 0x10000);
-        assert(loop_start < 0x10000);
-        assert(loop_end   < 0x10000);
-        assert(!(sample_flags & ~1));
+        load_message(L"%2d: %-28.28S Len=%6d Loop=(%6d, %6d) c2speed=%d\n", i, name.c_str(), length, loop_start, loop_end, c2spd);
+        // Scream Tracker 3 itself only saves unpacked 8-bit mono samples shorter than 64K
+        if (packing != 0) {
+            throw std::runtime_error("Packed samples are not supported in S3M " + std::string(filename));
+        }
+        if (sample_flags & (2|4)) { // 2 = stereo, 4 = 16-bit
+            throw std::runtime_error("Stereo and 16-bit samples are not supported in S3M " + std::string(filename));
+        }
         assert(samplesig == make_sig("SCRS"));
         assert(in && (int)in.tellg() == instrument_pointers[i]*16 + 0x50);
 
-        std::vector<unsigned char> data(length);
-        if (length) {
-            s3m_seek(in, memseg);
-            in.read(reinterpret_cast<char*>(&data[0]), length);
-        }
-        module_sample samp{sample{data, static_cast<float>(c2spd), name}, volume};
-        if (sample_flags & 1) {
-            assert(loop_start <= loop_end);
-            samp.data().loop(loop_start, loop_end - loop_start, loop_type::forward);
+        const sample_source source{memseg * 16, static_cast<int>(length), sample_type == 1 ? sample_encoding::s8 : sample_encoding::u8};
+        module_sample samp{load_sample(in, mod, source, static_cast<int>(length), static_cast<float>(c2spd), name, deferred), volume};
+        if ((sample_flags & 1) && loop_start < std::min(loop_end, length)) {
+            samp.data().loop(loop_start, std::min(loop_end, length) - loop_start, loop_type::forward);
         }
         module_instrument inst{};
         inst.add_sample(std::move(samp));
+        inst.name(name);
         mod.instruments.push_back(std::move(inst));
     }
 
@@ -297,7 +508,7 @@ void load_s3m(std::istream& in, const char* filename, module& mod)
     for (int i = 0; i < num_patterns; ++i) {
         if (!pattern_pointers[i]) {
             // Push an empty pattern if there is no pattern data
-            mod.patterns.push_back(std::vector<module_note>());
+            mod.patterns.add_pattern(std::vector<module_note>(), rows_per_pattern, num_channels);
             continue;
         }
 
@@ -348,18 +559,19 @@ void load_s3m(std::istream& in, const char* filename, module& mod)
                 const uint8_t note = read_le_u8(in);
                 rd.note       = note == 255 ? piano_key::NONE : note == 254 ? piano_key::OFF : piano_key::C_0 + 12 * (1 + note / 16) + note % 16;
                 rd.instrument = read_le_u8(in);
-                assert(rd.instrument <= num_instruments);
+                if (rd.instrument > num_instruments) {
+                    rd.instrument = 0; // Ignored like Scream Tracker 3 does
+                }
             }
             if (b & 0x40) {
-                int vol = read_le_u8(in);
-                assert(vol <= 64);
+                const int vol = std::min<int>(read_le_u8(in), 64);
                 rd.volume = volume_command::set_00 + vol;
             }
             if (b & 0x80) {
                 const uint8_t effect       = read_le_u8(in);
                 const uint8_t effect_param = read_le_u8(in);
                 if (effect) {
-                    assert(effect <= 26);
+                    // Letters past Z are kept (decode_effect makes them effect_op_unknown)
                     rd.effect = (effect << 8) | effect_param;
                 } else {
                     // 2nd_pm.s3m has 0 effect in order 22 (pattern 13) row 19
@@ -370,7 +582,7 @@ void load_s3m(std::istream& in, const char* filename, module& mod)
 
         assert(in && (int)in.tellg() == pattern_pointers[i]*16 + packed_length);
 
-        mod.patterns.emplace_back(std::move(this_pattern));
+        mod.patterns.add_pattern(this_pattern, rows_per_pattern, num_channels);
     }
 }
 
@@ -432,7 +644,7 @@ bool is_mod(std::istream& in)
     return in.seekg(1080) && in.read(buf, sizeof(buf)) && mod_channels_from_id(buf) > 0;
 }
 
-void load_mod(std::istream& in, const char* filename, module& mod)
+void load_mod(std::istream& in, const char* filename, module& mod, std::vector<deferred_sample>* deferred)
 {
     assert(is_mod(in));
 
@@ -445,7 +657,6 @@ void load_mod(std::istream& in, const char* filename, module& mod)
         int                      volume;
         int                      loop_start;
         int                      loop_length;
-        std::vector<signed char> data;
     };
 
     constexpr int num_instruments = 31;
@@ -478,9 +689,10 @@ void load_mod(std::istream& in, const char* filename, module& mod)
     const int num_patterns = *std::max_element(mod.order.begin(), mod.order.end()) + 1;
 
     // 4 bytes for each channel for each of the 64 rows in each pattern
+    constexpr int rows_per_pattern = 64;
     for (int pat = 0; pat < num_patterns; ++pat) {
         std::vector<module_note> this_pattern;
-        for (int row = 0; row < 64; ++row) {
+        for (int row = 0; row < rows_per_pattern; ++row) {
             for (int ch = 0; ch < mod.num_channels; ++ch) {
                 uint8_t b[4];
                 in.read(reinterpret_cast<char*>(b), sizeof(b));
@@ -499,30 +711,94 @@ void load_mod(std::istream& in, const char* filename, module& mod)
                 this_pattern.push_back(n);
             }
         }
-        mod.patterns.emplace_back(std::move(this_pattern));
+        mod.patterns.add_pattern(this_pattern, rows_per_pattern, mod.num_channels);
     }
 
     for (int i = 0; i < num_instruments; ++i) {
         const auto& s = samples[i];
-        std::vector<signed char> data;
-        if (s.length) {
-            data.resize(s.length);
-            in.read(reinterpret_cast<char*>(&data[0]), s.length);
-        }
-
-        module_sample samp{sample{data, amiga_c5_rate * note_difference_to_scale(s.finetune/8.0f), s.name}, s.volume};
+        const sample_source source{static_cast<uint32_t>(in.tellg()), s.length, sample_encoding::s8};
+        module_sample samp{load_sample(in, mod, source, s.length, amiga_c5_rate * note_difference_to_scale(s.finetune/8.0f), s.name, deferred), s.volume};
         if (s.loop_length > 2) {
             samp.data().loop(s.loop_start, s.loop_length, loop_type::forward);
         }
         module_instrument inst{};
         inst.add_sample(std::move(samp));
+        inst.name(s.name);
         mod.instruments.push_back(std::move(inst));
         assert(in);
     }
 }
 
-module load_module(const char* filename)
+std::vector<float> decode_sample(std::istream& in, const sample_source& source, int length)
+{
+    assert(source.num_frames >= 0 && source.num_frames <= length);
+    in.seekg(source.offset);
+    switch (source.encoding) {
+    case sample_encoding::s8: {
+        std::vector<signed char> data(length);
+        if (source.num_frames) {
+            in.read(reinterpret_cast<char*>(&data[0]), source.num_frames);
+        }
+        return convert_sample_data(data);
+    }
+    case sample_encoding::u8: {
+        std::vector<unsigned char> data(length);
+        if (source.num_frames) {
+            in.read(reinterpret_cast<char*>(&data[0]), source.num_frames);
+        }
+        return convert_sample_data(data);
+    }
+    case sample_encoding::s8_delta:
+    case sample_encoding::s16_delta: {
+        const bool is_16bit = source.encoding == sample_encoding::s16_delta;
+        short last = 0;
+        std::vector<short> data(length);
+        for (int i = 0; i < source.num_frames; ++i) {
+            short cur = 0;
+            if (is_16bit) {
+                cur = static_cast<short>(read_le_u16(in));
+            } else {
+                cur = static_cast<short>(static_cast<signed char>(read_le_u8(in)) << 8);
+            }
+            cur += last;
+            data[i] = cur;
+            last = cur;
+        }
+        return convert_sample_data(data);
+    }
+    }
+    assert(false);
+    return std::vector<float>(length);
+}
+
+sample load_sample(std::istream& in, const module& mod, const sample_source& source, int length, float c5_rate, const std::string& name, std::vector<deferred_sample>* deferred)
 {
+    if (!deferred) {
+        return sample{sample_store::instance().intern(decode_sample(in, source, length)), c5_rate, name};
+    }
+    sample samp{length, c5_rate, name};
+    deferred->push_back(deferred_sample{static_cast<int>(mod.instruments.size()), samp, source});
+    const int frame_size = source.encoding == sample_encoding::s16_delta ? 2 : 1;
+    in.seekg(source.offset + static_cast<std::streamoff>(source.num_frames) * frame_size);
+    return samp;
+}
+
+module load_module(const char* filename, std::vector<deferred_sample>* deferred, const std::string& cache_directory)
+{
+    if (!cache_directory.empty()) {
+        const auto cache_filename = module_cache_filename(cache_directory, filename);
+        if (auto cached = read_module_cache(cache_filename, filename)) {
+            return std::move(*cached);
+        }
+        if (!deferred) {
+            module mod{load_module(filename)};
+            if (!write_module_cache(cache_filename, filename, mod)) {
+                wprintf(L"Could not write module cache '%S'\n", cache_filename.c_str());
+            }
+            return mod;
+        }
+    }
+
     std::ifstream in(filename, std::ifstream::binary);
     if (!in || !in.is_open()) {
         throw std::runtime_error("Could not open " + std::string(filename));
@@ -530,15 +806,18 @@ module load_module(const char* filename)
 
     if (is_xm(in)) {
         module mod{module_type::xm};
-        load_xm(in, filename, mod);
+        load_xm(in, filename, mod, deferred);
+        mod.compile_patterns();
         return mod;
     } else if (is_s3m(in)) {
         module mod{module_type::s3m};
-        load_s3m(in, filename, mod);
+        load_s3m(in, filename, mod, deferred);
+        mod.compile_patterns();
         return mod;
     } else if (is_mod(in)) {
         module mod{module_type::mod};
-        load_mod(in, filename, mod);
+        load_mod(in, filename, mod, deferred);
+        mod.compile_patterns();
         return mod;
     }
     throw std::runtime_error("Unsupported format " + std::string(filename));
@@ -2,8 +2,11 @@
 #define SAMPEDIT_MODULE_H
 
 #include <stdint.h>
+#include <algorithm>
 #include <vector>
 #include <string>
+#include <unordered_map>
+#include <iosfwd>
 #include <base/sample.h>
 #include <base/note.h>
 
@@ -75,13 +78,99 @@ private:
 
 extern const module_sample empty_sample;
 
+// How the frames of a sample are stored in a module file
+enum class sample_encoding {
+    s8,         // MOD
+    u8,         // S3M
+    s8_delta,   // XM 8-bit
+    s16_delta,  // XM 16-bit
+};
+
+struct sample_source {
+    uint32_t        offset;     // File offset of the first frame
+    int             num_frames; // Frames stored in the file (the sample may be longer, the rest is silent)
+    sample_encoding encoding;
+};
+
+// Reads and converts the frames of a sample of length frames, leaving in after the data
+std::vector<float> decode_sample(std::istream& in, const sample_source& source, int length);
+
+// A sample loaded without its frames and where to decode them from
+struct deferred_sample {
+    int           instrument; // Index in module::instruments
+    sample        samp;       // Shares its frames with the sample in the module
+    sample_source source;
+};
+
+struct module_envelope_point {
+    int x; // Tick
+    int y; // Value (0-64)
+};
+
+// XM volume/panning envelope expanded at load time to one value per tick.
+// The player keeps a position (0 when the note is triggered) and advances it with next() once per tick.
+class module_envelope {
+public:
+    static constexpr int max_value = 64;
+
+    module_envelope() = default;
+    // sustain_point, loop_start and loop_end are point indices (-1 when not used)
+    explicit module_envelope(const std::vector<module_envelope_point>& points, int sustain_point, int loop_start, int loop_end);
+    // Already expanded envelope, sustain, loop_start and loop_end are positions (as returned by the accessors below)
+    explicit module_envelope(std::vector<uint8_t>&& values, int sustain, int loop_start, int loop_end)
+        : values_(std::move(values)), sustain_(sustain), loop_start_(loop_start), loop_end_(loop_end) {
+    }
+
+    bool enabled() const { return !values_.empty(); }
+
+    const std::vector<uint8_t>& values() const { return values_; }
+    int sustain() const { return sustain_; }
+    int loop_start() const { return loop_start_; }
+    int loop_end() const { return loop_end_; }
+
+    int value(int pos) const {
+        assert(pos >= 0 && pos < static_cast<int>(values_.size()));
+        return values_[pos];
+    }
+
+    // Position for the next tick, holds at the sustain point until the key is released
+    int next(int pos, bool released) const {
+        if (pos == sustain_ && !released) return pos;
+        if (pos == loop_end_) return loop_start_;
+        return pos + 1 < static_cast<int>(values_.size()) ? pos + 1 : pos;
+    }
+
+private:
+    std::vector<uint8_t> values_;
+    int                  sustain_    = -1;
+    int                  loop_start_ = -1;
+    int                  loop_end_   = -1;
+};
+
 class module_instrument {
 public:
     explicit module_instrument(int volume_fadeout = 0) : volume_fadeout_(volume_fadeout) {
         for (auto& s : sample_mapping_) s = 0;
+        update_note_samples();
+    }
+    // note_samples_ points into samples_, which stays valid when moving but is rebuilt when copying.
+    // Copies share the sample frames.
+    module_instrument(const module_instrument& other)
+        : samples_(other.samples_)
+        , name_(other.name_)
+        , volume_fadeout_(other.volume_fadeout_)
+        , volume_envelope_(other.volume_envelope_)
+        , panning_envelope_(other.panning_envelope_) {
+        std::copy(std::begin(other.sample_mapping_), std::end(other.sample_mapping_), sample_mapping_);
+        update_note_samples();
     }
+    module_instrument(module_instrument&&) = default;
+    module_instrument& operator=(module_instrument&&) = default;
 
-    void add_sample(module_sample&& sample) { samples_.push_back(std::move(sample)); }
+    void add_sample(module_sample&& sample) {
+        samples_.push_back(std::move(sample));
+        update_note_samples();
+    }
     static constexpr int sample_mapping_size = 96;
     const auto& sample_mapping() const { return sample_mapping_; }
     void sample_mapping(const uint8_t (&sample_mapping)[sample_mapping_size]) {
@@ -89,15 +178,38 @@ public:
             assert(sample_mapping[i] < samples_.size());
             sample_mapping_[i] = sample_mapping[i];
         }
+        update_note_samples();
     }
     const std::vector<module_sample>& samples() const { return samples_; }
     const module_sample& samp() const { return samples_.empty() ? empty_sample : samples_[0]; }
+    // Sample played for note (0 = C-0 in the instrument's note range), resolved through the sample mapping at load time
+    const module_sample& note_sample(int note) const {
+        assert(note >= 0 && note < sample_mapping_size);
+        return *note_samples_[note];
+    }
     int volume_fadeout() const { return volume_fadeout_; }
+    // The XM instrument name, for MOD/S3M the name of the (only) sample
+    const std::string& name() const { return name_; }
+    void name(const std::string& name) { name_ = name; }
+    const module_envelope& volume_envelope() const { return volume_envelope_; }
+    void volume_envelope(module_envelope&& env) { volume_envelope_ = std::move(env); }
+    const module_envelope& panning_envelope() const { return panning_envelope_; }
+    void panning_envelope(module_envelope&& env) { panning_envelope_ = std::move(env); }
 
 private:
     std::vector<module_sample> samples_;
+    std::string                name_;
     int                        volume_fadeout_;
     uint8_t                    sample_mapping_[sample_mapping_size];
+    const module_sample*       note_samples_[sample_mapping_size];
+    module_envelope            volume_envelope_;
+    module_envelope            panning_envelope_;
+
+    void update_note_samples() {
+        for (int i = 0; i < sample_mapping_size; ++i) {
+            note_samples_[i] = sample_mapping_[i] < samples_.size() ? &samples_[sample_mapping_[i]] : &empty_sample;
+        }
+    }
 };
 
 struct module_note {
@@ -107,9 +219,144 @@ struct module_note {
     uint16_t          effect      = 0;
 };
 
+inline bool is_empty(const module_note& note) {
+    return note.note == piano_key::NONE && !note.instrument && note.volume == volume_command::none && !note.effect;
+}
+
+// module_note as stored in the pattern arena (5 bytes, no padding)
+struct packed_note {
+    uint8_t           note;
+    uint8_t           instrument;
+    uint8_t           volume;
+    uint8_t           effect_type;
+    uint8_t           effect_param;
+};
+
+inline packed_note pack(const module_note& n) {
+    return packed_note{static_cast<uint8_t>(n.note), n.instrument, static_cast<uint8_t>(n.volume), static_cast<uint8_t>(n.effect >> 8), static_cast<uint8_t>(n.effect & 0xff)};
+}
+
+inline module_note unpack(const packed_note& p) {
+    module_note n;
+    n.note       = static_cast<piano_key>(p.note);
+    n.instrument = p.instrument;
+    n.volume     = static_cast<volume_command>(p.volume);
+    n.effect     = static_cast<uint16_t>((p.effect_type << 8) | p.effect_param);
+    return n;
+}
+
+// One pattern row, the cells are looked up through the column offsets of the pattern
+class module_row {
+public:
+    explicit module_row(const packed_note* cells, const uint32_t* columns) : cells_(cells), columns_(columns) {
+    }
+
+    module_note operator[](int channel) const { return unpack(cells_[columns_[channel]]); }
+
+private:
+    const packed_note* cells_;   // Row offset already applied
+    const uint32_t*    columns_;
+};
+
+// All pattern data in one arena of packed cells stored column by column.
+// Each pattern is a list of column offsets into the arena, identical columns (and so identical patterns) are only stored once.
+class pattern_arena {
+public:
+    static constexpr int max_rows = 256;
+
+    // Adds a pattern of num_rows rows stored row by row (or an empty vector for a pattern without data)
+    void add_pattern(const std::vector<module_note>& notes, int num_rows, int num_channels);
+    // Releases the data only needed while adding patterns
+    void finish();
+    // Replaces the patterns with data previously returned by the accessors below (unpacked_size as returned by unpacked_memory_used)
+    void assign(std::vector<packed_note>&& cells, std::vector<uint32_t>&& columns, std::vector<uint16_t>&& rows, int num_channels, size_t unpacked_size);
+
+    const std::vector<packed_note>& cells() const { return cells_; }
+    const std::vector<uint32_t>& columns() const { return columns_; }
+    const std::vector<uint16_t>& rows() const { return rows_; }
+    int num_channels() const { return num_channels_; }
+
+    int size() const { return static_cast<int>(rows_.size()); }
+
+    int num_rows(int pattern) const {
+        assert(pattern >= 0 && pattern < size());
+        return rows_[pattern];
+    }
+
+    module_row row(int pattern, int row) const {
+        assert(row >= 0 && row < num_rows(pattern));
+        return module_row{cells_.data() + row, columns_.data() + pattern * num_channels_};
+    }
+
+    // Bytes used by the arena and the bytes the same patterns would use as one std::vector<module_note> each
+    size_t memory_used() const { return cells_.size() * sizeof(packed_note) + columns_.size() * sizeof(uint32_t) + rows_.size() * sizeof(uint16_t); }
+    size_t unpacked_memory_used() const { return unpacked_size_; }
+
+private:
+    std::vector<packed_note>                       cells_;
+    std::vector<uint32_t>                          columns_;
+    std::vector<uint16_t>                          rows_;
+    int                                            num_channels_ = 0;
+    size_t                                         unpacked_size_ = 0;
+    std::unordered_multimap<uint64_t, uint32_t>    column_index_; // Content hash -> column offset
+
+    uint32_t add_column(const packed_note* column, int num_rows);
+};
+
+// Effect opcodes stored in module_event: The effect type (MOD/XM hex digit, S3M letter) with the
+// extended effects (MOD/XM Exy, S3M Sxy) split into an opcode per x. Effect types the format doesn't have
+// (only possible in damaged files) all decode to effect_op_unknown.
+constexpr int     num_effect_ops    = 0x40;
+constexpr uint8_t effect_op_none    = 0;
+constexpr uint8_t effect_op_unknown = 0x2F;
+
+constexpr uint8_t effect_op(int effect_type) {
+    return static_cast<uint8_t>(1 + effect_type);
+}
+
+constexpr uint8_t s3m_effect_op(char effect_letter) {
+    return effect_op(effect_letter - 'A' + 1);
+}
+
+constexpr uint8_t extended_effect_op(int x) {
+    return static_cast<uint8_t>(0x30 + x);
+}
+
+// A non-empty pattern cell
+struct module_event {
+    uint8_t           channel;
+    module_note       note;
+    uint8_t           effect_op;    // Decoded from note.effect
+    uint8_t           effect_param; // Low byte of note.effect
+};
+
+// The events of one pattern row
+class module_event_range {
+public:
+    explicit module_event_range(const module_event* begin, const module_event* end) : begin_(begin), end_(end) {
+        assert(begin_ <= end_);
+    }
+
+    const module_event* begin() const { return begin_; }
+    const module_event* end() const { return end_; }
+    bool empty() const { return begin_ == end_; }
+
+private:
+    const module_event* begin_;
+    const module_event* end_;
+};
+
 enum class module_type { mod, s3m, xm };
 constexpr const char* const module_type_name[] = { "MOD", "S3M", "XM" };
 
+// Highest effect type of the format (MOD: F, S3M: Z, XM: Z as in the 0-9A-Z column)
+constexpr int max_effect_type(module_type type) {
+    return type == module_type::mod ? 0xF : type == module_type::s3m ? 'Z' - 'A' + 1 : 35;
+}
+
+// The effect column character for the effect type, '?' past max_effect_type
+char effect_type_char(module_type type, int effect_type);
+
 struct module_position {
     int order, pattern, row;
 };
@@ -129,6 +376,30 @@ struct module {
             break;
         }
     }
+    // Copies share the sample frames (see module_loader)
+    module(const module& mod)
+        : type(mod.type)
+        , initial_speed(mod.initial_speed)
+        , initial_tempo(mod.initial_tempo)
+        , name(mod.name)
+        , instruments(mod.instruments)
+        , order(mod.order)
+        , num_channels(mod.num_channels)
+        , patterns(mod.patterns)
+        , events(mod.events)
+        , row_events(mod.row_events)
+        , pattern_row_events(mod.pattern_row_events) {
+        switch (type) {
+        case module_type::mod:
+            break;
+        case module_type::s3m:
+            new (&s3m) s3m_s(mod.s3m);
+            break;
+        case module_type::xm:
+            new (&xm) xm_s(mod.xm);
+            break;
+        }
+    }
     module(module&& mod)
         : type(mod.type)
         , initial_speed(mod.initial_speed)
@@ -137,7 +408,10 @@ struct module {
         , instruments(std::move(mod.instruments))
         , order(std::move(mod.order))
         , num_channels(mod.num_channels)
-        , patterns(std::move(mod.patterns)) {
+        , patterns(std::move(mod.patterns))
+        , events(std::move(mod.events))
+        , row_events(std::move(mod.row_events))
+        , pattern_row_events(std::move(mod.pattern_row_events)) {
         switch (type) {
         case module_type::mod:
             break;
@@ -170,7 +444,12 @@ struct module {
     std::vector<module_instrument>         instruments;
     std::vector<uint8_t>                   order;
     int                                    num_channels;
-    std::vector<std::vector<module_note>>  patterns;
+    pattern_arena                          patterns;
+    // Sparse copy of patterns built by compile_patterns (row_events has the index of the first event of each pattern row + an end marker,
+    // pattern_row_events the index in row_events of the first row of each pattern)
+    std::vector<module_event>              events;
+    std::vector<uint32_t>                  row_events;
+    std::vector<uint32_t>                  pattern_row_events;
 
     struct s3m_s {
         std::vector<uint8_t> channel_panning;
@@ -183,15 +462,57 @@ struct module {
         xm_s  xm;
     };
 
-    static constexpr int rows_per_pattern = 64;
+    static constexpr int max_rows = pattern_arena::max_rows;
 
     int note_to_period(piano_key note) const;
     int freq_to_period(float freq) const;
     float period_to_freq(int period) const;
-    const module_note* at(int order, int row) const;
+    int num_rows(int order) const;
+    module_row at(int order, int row) const;
+    module_event_range events_at(int order, int row) const;
+    void compile_patterns();
     int channel_default_pan(int channel) const;
 };
 
-module load_module(const char* filename);
+// Lookup tables for the pitch calculations done on every tick (built once per module and output rate)
+class pitch_table {
+public:
+    explicit pitch_table(const module& mod, int sample_rate);
+
+    // Sample position increment per output sample for a period
+    float period_to_increment(int period) const;
+    // Period transposed up by semitones (same result as freq_to_period(period_to_freq(period)*note_difference_to_scale(semitones)))
+    int transpose_period(int period, int semitones) const;
+
+    static constexpr int max_semitones = 16;
+
+private:
+    static constexpr int num_periods = 1 << 15;
+
+    const module&      mod_;
+    const float        sample_rate_;
+    std::vector<float> increment_;
+    float              scale_[max_semitones];
+};
+
+// Decodes the sample frames at source now, or if deferred isn't null creates a deferred sample for the instrument
+// being loaded (the next one added to mod) and adds it to deferred. Either way in is left after the sample data.
+sample load_sample(std::istream& in, const module& mod, const sample_source& source, int length, float c5_rate, const std::string& name, std::vector<deferred_sample>* deferred);
+
+// The loaders describe each module they load (and what they ignore in it) on stdout unless this is turned off.
+// Applies to all threads, tools loading many modules turn it off.
+void print_load_messages(bool print);
+// wprintf for the loaders, does nothing when the messages are turned off
+void load_message(const wchar_t* format, ...);
+
+// Format checks, in is left where it was (see is_xm in xm.h)
+bool is_s3m(std::istream& in);
+bool is_mod(std::istream& in);
+
+// If deferred isn't null, the sample frames are left for the caller to decode (see load_sample).
+// If cache_directory isn't empty the module is loaded from its cache there (see module_cache.h) when it's up to date.
+// Otherwise it's loaded as without a cache, and if deferred is null (all samples decoded) the cache is (re)written.
+// Callers decoding the deferred samples write it themselves once they're all decoded (see module_loader).
+module load_module(const char* filename, std::vector<deferred_sample>* deferred = nullptr, const std::string& cache_directory = std::string{});
 
 #endif
@@ -0,0 +1,410 @@
+#include "module_cache.h"
+#include <win32/mapped_file.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <type_traits>
+#include <algorithm>
+#include <stdexcept>
+#include <cassert>
+
+namespace {
+
+constexpr char   cache_magic[4]  = {'S', 'E', 'M', 'C'};
+constexpr size_t cache_alignment = 32; // Also keeps the size of the module data a multiple of 32 for checksum
+
+struct cache_section {
+    uint64_t offset;
+    uint64_t size;  // Bytes
+};
+
+struct cache_header {
+    char     magic[4];
+    uint32_t version;
+    uint64_t checksum;      // Of the module data
+    uint64_t file_size;
+    uint64_t source_size;
+    int64_t  source_mtime;
+    uint64_t sample_data;   // Offset of the sample data, the module data is everything between the header and it
+    uint64_t reserved[2];
+};
+
+struct cached_module {
+    uint32_t      type;
+    int32_t       initial_speed;
+    int32_t       initial_tempo;
+    int32_t       num_channels;
+    uint32_t      use_linear_frequency;
+    uint32_t      reserved;
+    uint64_t      unpacked_pattern_size;
+    cache_section name;
+    cache_section order;
+    cache_section channel_panning;
+    cache_section cells;
+    cache_section columns;
+    cache_section rows;
+    cache_section instruments;  // cached_instrument records
+    cache_section samples;      // cached_sample records
+};
+
+struct cached_envelope {
+    cache_section values;
+    int32_t       sustain;
+    int32_t       loop_start;
+    int32_t       loop_end;
+    int32_t       reserved;
+};
+
+struct cached_instrument {
+    int32_t         volume_fadeout;
+    uint32_t        first_sample;   // Index in the sample records
+    uint32_t        num_samples;
+    uint8_t         sample_mapping[module_instrument::sample_mapping_size];
+    cached_envelope volume_envelope;
+    cached_envelope panning_envelope;
+    cache_section   name;
+};
+
+struct cached_sample {
+    cache_section name;
+    cache_section frames;       // length floats
+    cache_section peaks;        // peak_pyramid::num_summaries(length) peak_summary
+    int32_t       length;
+    int32_t       volume;
+    int32_t       relative_note;
+    int32_t       loop_type;
+    int32_t       loop_start;
+    int32_t       loop_length;
+    float         c5_rate;
+    int32_t       reserved;
+};
+
+static_assert(std::is_trivially_copyable<packed_note>::value && sizeof(packed_note) == 5, "Pattern cells are stored as is");
+static_assert(std::is_trivially_copyable<peak_summary>::value && sizeof(peak_summary) == 16, "Peak summaries are stored as is");
+static_assert(sizeof(cache_header) % cache_alignment == 0 && sizeof(cached_module) % cache_alignment == 0, "The header and module record must keep the sections aligned");
+
+struct source_key {
+    uint64_t size;
+    int64_t  mtime;
+};
+
+bool get_source_key(const std::string& filename, source_key& key) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return false;
+    }
+    key.size  = static_cast<uint64_t>(st.st_size);
+    key.mtime = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+// FNV-1a style over 64-bit words in four independent lanes, so it runs at memory speed over the sample frames.
+// size must be a multiple of cache_alignment (32).
+uint64_t checksum(const uint8_t* data, size_t size) {
+    assert(size % cache_alignment == 0);
+    constexpr uint64_t prime = 0x100000001b3;
+    uint64_t h[4] = {0xcbf29ce484222325, 0x84222325cbf29ce4, 0x9e3779b97f4a7c15, 0x7f4a7c159e3779b9};
+    for (size_t i = 0; i < size; i += 32) {
+        for (int lane = 0; lane < 4; ++lane) {
+            uint64_t w;
+            memcpy(&w, data + i + lane * 8, sizeof(w));
+            h[lane] = (h[lane] ^ w) * prime;
+        }
+    }
+    return ((h[0] * prime ^ h[1]) * prime ^ h[2]) * prime ^ h[3];
+}
+
+size_t align(size_t size) {
+    return (size + cache_alignment - 1) & ~(cache_alignment - 1);
+}
+
+class cache_writer {
+public:
+    explicit cache_writer() : data_(align(sizeof(cache_header) + sizeof(cached_module))) {
+    }
+
+    cache_section add(const void* src, size_t size) {
+        const cache_section s{data_.size(), size};
+        data_.resize(align(data_.size() + size));
+        if (size) memcpy(&data_[static_cast<size_t>(s.offset)], src, size);
+        return s;
+    }
+
+    template<typename T>
+    cache_section add(const std::vector<T>& v) {
+        static_assert(std::is_trivially_copyable<T>::value, "");
+        return add(v.data(), v.size() * sizeof(T));
+    }
+
+    cache_section add(const std::string& s) {
+        return add(s.data(), s.size());
+    }
+
+    // Valid until the next add
+    template<typename T>
+    T* at(const cache_section& s) { return reinterpret_cast<T*>(&data_[static_cast<size_t>(s.offset)]); }
+
+    cache_header& header() { return *reinterpret_cast<cache_header*>(data_.data()); }
+    cached_module& mod() { return *reinterpret_cast<cached_module*>(data_.data() + sizeof(cache_header)); }
+
+    std::vector<uint8_t>& data() { return data_; }
+
+private:
+    std::vector<uint8_t> data_;
+};
+
+cached_envelope add_envelope(cache_writer& w, const module_envelope& env) {
+    return cached_envelope{w.add(env.values()), env.sustain(), env.loop_start(), env.loop_end(), 0};
+}
+
+// Checked access to the sections of a mapped cache file
+class cache_reader {
+public:
+    explicit cache_reader(const mapped_file& file) : file_(file) {
+    }
+
+    template<typename T>
+    const T* get(const cache_section& s, size_t count) const {
+        if (s.offset % cache_alignment || s.offset > file_.size() || s.size > file_.size() - s.offset || s.size != count * sizeof(T)) {
+            throw std::runtime_error("Invalid section in module cache");
+        }
+        return reinterpret_cast<const T*>(file_.data() + s.offset);
+    }
+
+    template<typename T>
+    std::vector<T> vector(const cache_section& s) const {
+        const T* p = get<T>(s, static_cast<size_t>(s.size / sizeof(T)));
+        return std::vector<T>(p, p + s.size / sizeof(T));
+    }
+
+    std::string string(const cache_section& s) const {
+        const char* p = get<char>(s, static_cast<size_t>(s.size));
+        return std::string(p, p + s.size);
+    }
+
+private:
+    const mapped_file& file_;
+};
+
+module_envelope read_envelope(const cache_reader& r, const cached_envelope& env) {
+    return module_envelope{r.vector<uint8_t>(env.values), env.sustain, env.loop_start, env.loop_end};
+}
+
+std::unique_ptr<module> read_module(const std::shared_ptr<const mapped_file>& file) {
+    const cache_reader r{*file};
+    const auto& m = *reinterpret_cast<const cached_module*>(file->data() + sizeof(cache_header));
+    if (m.type > static_cast<uint32_t>(module_type::xm) || m.num_channels <= 0) {
+        throw std::runtime_error("Invalid module record in module cache");
+    }
+
+    std::unique_ptr<module> mod{new module{static_cast<module_type>(m.type)}};
+    mod->initial_speed = m.initial_speed;
+    mod->initial_tempo = m.initial_tempo;
+    mod->num_channels  = m.num_channels;
+    mod->name          = r.string(m.name);
+    mod->order         = r.vector<uint8_t>(m.order);
+    if (mod->type == module_type::s3m) {
+        mod->s3m.channel_panning = r.vector<uint8_t>(m.channel_panning);
+    } else if (mod->type == module_type::xm) {
+        mod->xm.use_linear_frequency = m.use_linear_frequency != 0;
+    }
+    auto cells   = r.vector<packed_note>(m.cells);
+    auto columns = r.vector<uint32_t>(m.columns);
+    auto rows    = r.vector<uint16_t>(m.rows);
+    if (rows.empty() || columns.size() != rows.size() * m.num_channels) {
+        throw std::runtime_error("Invalid patterns in module cache");
+    }
+    for (size_t i = 0; i < columns.size(); ++i) {
+        const int num_rows = rows[i / m.num_channels];
+        if (num_rows < 1 || num_rows > module::max_rows || columns[i] > cells.size() || static_cast<size_t>(num_rows) > cells.size() - columns[i]) {
+            throw std::runtime_error("Invalid pattern in module cache");
+        }
+    }
+    for (uint8_t pattern : mod->order) {
+        if (pattern >= rows.size()) {
+            throw std::runtime_error("Invalid order list in module cache");
+        }
+    }
+    mod->patterns.assign(std::move(cells), std::move(columns), std::move(rows), m.num_channels, static_cast<size_t>(m.unpacked_pattern_size));
+
+    const size_t num_instruments = static_cast<size_t>(m.instruments.size / sizeof(cached_instrument));
+    const size_t num_samples     = static_cast<size_t>(m.samples.size / sizeof(cached_sample));
+    const auto* instruments      = r.get<cached_instrument>(m.instruments, num_instruments);
+    const auto* samples          = r.get<cached_sample>(m.samples, num_samples);
+    for (size_t i = 0; i < num_instruments; ++i) {
+        const auto& ci = instruments[i];
+        if (ci.first_sample > num_samples || ci.num_samples > num_samples - ci.first_sample) {
+            throw std::runtime_error("Invalid instrument record in module cache");
+        }
+        module_instrument inst{ci.volume_fadeout};
+        inst.name(r.string(ci.name));
+        for (uint32_t j = 0; j < ci.num_samples; ++j) {
+            const auto& cs = samples[ci.first_sample + j];
+            if (cs.length < 0 || (cs.loop_type != static_cast<int32_t>(loop_type::none) && (cs.loop_start < 0 || cs.loop_length <= 0 || cs.loop_start + cs.loop_length > cs.length))) {
+                throw std::runtime_error("Invalid sample record in module cache");
+            }
+            const float* frames       = r.get<float>(cs.frames, static_cast<size_t>(cs.length));
+            const peak_summary* peaks = r.get<peak_summary>(cs.peaks, static_cast<size_t>(peak_pyramid::num_summaries(cs.length)));
+            module_sample samp{sample{file, frames, cs.length, cs.c5_rate, r.string(cs.name), peaks}, cs.volume, cs.relative_note};
+            if (cs.loop_type != static_cast<int32_t>(loop_type::none)) {
+                samp.data().loop(cs.loop_start, cs.loop_length, static_cast<loop_type>(cs.loop_type));
+            }
+            inst.add_sample(std::move(samp));
+        }
+        for (uint8_t s : ci.sample_mapping) {
+            if (s >= std::max(1u, ci.num_samples)) {
+                throw std::runtime_error("Invalid sample mapping in module cache");
+            }
+        }
+        if (ci.num_samples) {
+            inst.sample_mapping(ci.sample_mapping);
+        }
+        inst.volume_envelope(read_envelope(r, ci.volume_envelope));
+        inst.panning_envelope(read_envelope(r, ci.panning_envelope));
+        mod->instruments.push_back(std::move(inst));
+    }
+    mod->compile_patterns();
+    return mod;
+}
+
+}
+
+std::string module_cache_filename(const std::string& cache_directory, const std::string& filename) {
+    // The file name keeps the cache readable, the hash of the full path tells apart modules with the same name
+    uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char c : filename) {
+        hash = (hash ^ c) * 0x100000001b3;
+    }
+    const auto slash = filename.find_last_of("/\\");
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    return cache_directory + "/" + filename.substr(slash == std::string::npos ? 0 : slash + 1) + "." + hex + ".smc";
+}
+
+std::unique_ptr<module> read_module_cache(const std::string& cache_filename, const std::string& filename) {
+    source_key key;
+    if (!get_source_key(filename, key)) {
+        return nullptr;
+    }
+    const auto file = mapped_file::open(cache_filename);
+    if (!file || file->size() < sizeof(cache_header) + sizeof(cached_module)) {
+        return nullptr;
+    }
+    const auto& h = *reinterpret_cast<const cache_header*>(file->data());
+    if (memcmp(h.magic, cache_magic, sizeof(cache_magic)) || h.version != module_cache_version || h.file_size != file->size()
+        || h.source_size != key.size || h.source_mtime != key.mtime) {
+        return nullptr; // Stale, the caller replaces it
+    }
+    if (h.sample_data < sizeof(cache_header) + sizeof(cached_module) || h.sample_data > file->size() || h.sample_data % cache_alignment
+        || h.checksum != checksum(file->data() + sizeof(cache_header), static_cast<size_t>(h.sample_data) - sizeof(cache_header))) {
+        wprintf(L"Ignoring corrupt module cache '%S'\n", cache_filename.c_str());
+        return nullptr;
+    }
+    try {
+        return read_module(file);
+    } catch (const std::runtime_error& e) {
+        wprintf(L"Ignoring module cache '%S': %S\n", cache_filename.c_str(), e.what());
+        return nullptr;
+    }
+}
+
+bool write_module_cache(const std::string& cache_filename, const std::string& filename, const module& mod) {
+    source_key key;
+    if (!get_source_key(filename, key)) {
+        return false;
+    }
+
+    cache_writer w;
+    std::vector<cached_instrument> instruments;
+    std::vector<cached_sample> samples;
+    std::vector<const sample*> sample_data;
+    for (const auto& inst : mod.instruments) {
+        cached_instrument ci{};
+        ci.volume_fadeout = inst.volume_fadeout();
+        ci.first_sample   = static_cast<uint32_t>(samples.size());
+        ci.num_samples    = static_cast<uint32_t>(inst.samples().size());
+        memcpy(ci.sample_mapping, inst.sample_mapping(), sizeof(ci.sample_mapping));
+        ci.volume_envelope  = add_envelope(w, inst.volume_envelope());
+        ci.panning_envelope = add_envelope(w, inst.panning_envelope());
+        ci.name             = w.add(inst.name());
+        instruments.push_back(ci);
+        for (const auto& s : inst.samples()) {
+            const auto& d = s.data();
+            assert(d.ready());
+            cached_sample cs{};
+            cs.name          = w.add(d.name());
+            cs.length        = d.length();
+            cs.volume        = s.default_volume();
+            cs.relative_note = s.relative_note();
+            cs.loop_type     = static_cast<int32_t>(d.loop_type());
+            cs.loop_start    = d.loop_start();
+            cs.loop_length   = d.loop_length();
+            cs.c5_rate       = d.c5_rate();
+            samples.push_back(cs);
+            sample_data.push_back(&d);
+        }
+    }
+
+    cached_module m{};
+    m.type                  = static_cast<uint32_t>(mod.type);
+    m.initial_speed         = mod.initial_speed;
+    m.initial_tempo         = mod.initial_tempo;
+    m.num_channels          = mod.num_channels;
+    m.use_linear_frequency  = mod.type == module_type::xm && mod.xm.use_linear_frequency;
+    m.unpacked_pattern_size = mod.patterns.unpacked_memory_used();
+    m.name                  = w.add(mod.name);
+    m.order                 = w.add(mod.order);
+    m.channel_panning       = mod.type == module_type::s3m ? w.add(mod.s3m.channel_panning) : cache_section{};
+    m.cells                 = w.add(mod.patterns.cells());
+    m.columns               = w.add(mod.patterns.columns());
+    m.rows                  = w.add(mod.patterns.rows());
+    m.instruments           = w.add(instruments);
+    m.samples               = w.add(samples); // The frames and peaks sections are filled in below
+    w.mod() = m;
+
+    // The sample data goes after the module data, so loading doesn't have to read it
+    const uint64_t sample_data_offset = w.data().size();
+    std::vector<float> frames;
+    std::vector<peak_summary> peaks;
+    for (size_t i = 0; i < sample_data.size(); ++i) {
+        const auto& d = *sample_data[i];
+        frames.resize(d.length());
+        for (int pos = 0; pos < d.length(); ++pos) {
+            frames[pos] = d.get(pos);
+        }
+        peak_pyramid pyramid;
+        pyramid.build(frames.data(), d.length());
+        peaks.assign(pyramid.summaries(), pyramid.summaries() + peak_pyramid::num_summaries(d.length()));
+        const auto frames_section = w.add(frames);
+        const auto peaks_section  = w.add(peaks);
+        auto& cs  = w.at<cached_sample>(m.samples)[i];
+        cs.frames = frames_section;
+        cs.peaks  = peaks_section;
+    }
+
+    auto& data = w.data();
+    auto& h = w.header();
+    memcpy(h.magic, cache_magic, sizeof(cache_magic));
+    h.version      = module_cache_version;
+    h.file_size    = data.size();
+    h.source_size  = key.size;
+    h.source_mtime = key.mtime;
+    h.sample_data  = sample_data_offset;
+    h.checksum     = checksum(data.data() + sizeof(cache_header), static_cast<size_t>(sample_data_offset) - sizeof(cache_header));
+
+    // Write to a temporary file first so a partially written cache is never picked up
+    const std::string temp_filename = cache_filename + ".tmp";
+    {
+        std::ofstream out(temp_filename, std::ofstream::binary | std::ofstream::trunc);
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!out) {
+            out.close();
+            std::remove(temp_filename.c_str());
+            return false;
+        }
+    }
+    std::remove(cache_filename.c_str());
+    return std::rename(temp_filename.c_str(), cache_filename.c_str()) == 0;
+}
@@ -0,0 +1,31 @@
+#ifndef SAMPEDIT_MODULE_CACHE_H
+#define SAMPEDIT_MODULE_CACHE_H
+
+#include <memory>
+#include <string>
+#include "module.h"
+
+// Fully decoded modules stored on disk for fast startup. A cache file is memory mapped and the sample frames are
+// used directly from the mapping, only the (small) pattern and instrument data is copied out.
+//
+// Layout (native byte order, all offsets from the start of the file, every section aligned to 32 bytes):
+//   header         Magic, module_cache_version, checksum of the module data, size and modification time of the
+//                  module file it was made from
+//   module data    Module record (module fields and the offset and size of each section), name, order list,
+//                  S3M channel panning, pattern arena cells/columns/rows, instrument and sample records, envelope
+//                  values and sample names
+//   sample data    The float frames and the peak_pyramid summaries of each sample
+// Only the module data is checksummed (and read) when loading, the sample data is only paged in when it's played or
+// displayed. The module data is checked before use, damaged sample data can only make the samples sound wrong.
+constexpr uint32_t module_cache_version = 3;
+
+// Name of the cache file for the module filename in cache_directory
+std::string module_cache_filename(const std::string& cache_directory, const std::string& filename);
+
+// Returns the module in cache_filename if it's a valid cache of the current version of filename, otherwise nullptr
+std::unique_ptr<module> read_module_cache(const std::string& cache_filename, const std::string& filename);
+
+// Writes mod, loaded from filename with all samples decoded, to cache_filename. Returns false if it couldn't be written.
+bool write_module_cache(const std::string& cache_filename, const std::string& filename, const module& mod);
+
+#endif
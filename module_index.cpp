@@ -0,0 +1,456 @@
+#include "module_index.h"
+#include "module_sequencer.h"
+#include "xm.h"
+#include <win32/mapped_file.h>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+#include <cassert>
+
+namespace {
+
+// Songs that never repeat (or loop forever within a pattern) are cut off here
+constexpr int max_dry_run_rows = 1 << 20;
+
+constexpr char     index_magic[4]  = { 'S', 'E', 'M', 'I' };
+constexpr size_t   index_alignment = 32;
+
+struct index_header {
+    char     magic[4];
+    uint32_t version;
+    uint32_t num_entries;
+    uint32_t num_names;     // Offsets in the name table
+    uint32_t strings_size;  // Bytes in the string table
+    uint32_t reserved[3];
+};
+static_assert(sizeof(index_header) == index_alignment, "The entries must start aligned");
+
+struct index_entry {
+    uint32_t filename;      // Offset in the string table
+    uint32_t name;          // Offset in the string table
+    uint32_t first_name;    // Index in the name table of the instrument names followed by the sample names
+    uint32_t duration_ms;
+    uint32_t file_size;
+    uint16_t num_orders;
+    uint16_t num_patterns;
+    uint16_t num_instruments;
+    uint16_t num_samples;
+    uint8_t  type;
+    uint8_t  num_channels;
+    uint16_t reserved;
+};
+static_assert(sizeof(index_entry) == 32, "Unexpected index entry padding");
+
+size_t align_section(size_t offset) {
+    return (offset + index_alignment - 1) & ~(index_alignment - 1);
+}
+
+// Where the sections of an index with the given header end
+struct index_layout {
+    explicit index_layout(const index_header& h)
+        : names(align_section(sizeof(index_header) + static_cast<size_t>(h.num_entries) * sizeof(index_entry)))
+        , strings(align_section(names + static_cast<size_t>(h.num_names) * sizeof(uint32_t)))
+        , file_size(strings + h.strings_size) {
+    }
+
+    size_t names;
+    size_t strings;
+    size_t file_size;
+};
+
+char to_lower(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// Compares at most n characters of a and b (both NUL terminated) ignoring (ASCII) case
+int compare_nocase(const char* a, const char* b, size_t n = SIZE_MAX) {
+    for (; n; --n, ++a, ++b) {
+        const int d = static_cast<unsigned char>(to_lower(*a)) - static_cast<unsigned char>(to_lower(*b));
+        if (d || !*a) return d;
+    }
+    return 0;
+}
+
+// lower_text must be in lower case
+bool contains_nocase(const char* s, size_t len, const std::string& lower_text) {
+    if (lower_text.size() > len) return false;
+    const char first = lower_text[0];
+    for (size_t i = 0, last = len - lower_text.size(); i <= last; ++i) {
+        if (to_lower(s[i]) != first) continue;
+        size_t j = 1;
+        while (j < lower_text.size() && to_lower(s[i + j]) == lower_text[j]) ++j;
+        if (j == lower_text.size()) return true;
+    }
+    return false;
+}
+
+std::string trim_right(const std::string& s) {
+    const auto end = s.find_last_not_of(' ');
+    return end == std::string::npos ? std::string{} : s.substr(0, end + 1);
+}
+
+uint16_t count16(size_t n) {
+    assert(n <= UINT16_MAX);
+    return static_cast<uint16_t>(n);
+}
+
+class string_table {
+public:
+    string_table() {
+        add("");
+    }
+
+    uint32_t add(const std::string& s) {
+        auto it = offsets_.find(s);
+        if (it == offsets_.end()) {
+            it = offsets_.emplace(s, static_cast<uint32_t>(data_.size())).first;
+            data_.insert(data_.end(), s.c_str(), s.c_str() + s.size() + 1);
+        }
+        return it->second;
+    }
+
+    const std::vector<char>& data() const { return data_; }
+
+private:
+    std::vector<char>                         data_;
+    std::unordered_map<std::string, uint32_t> offsets_;
+};
+
+void write_padding(std::ostream& out) {
+    static const char zeros[index_alignment] = {};
+    const size_t pos = static_cast<size_t>(out.tellp());
+    out.write(zeros, align_section(pos) - pos);
+}
+
+}
+
+int module_duration_ms(const module& mod)
+{
+    const int num_orders = static_cast<int>(mod.order.size());
+    if (!num_orders) {
+        return 0;
+    }
+    std::vector<bool> visited(num_orders * module::max_rows);
+    module_sequencer sequencer{mod};
+    double ms = 0;
+    for (int num_rows = 0;;) {
+        if (sequencer.next_tick()) {
+            // Rows are played again inside a pattern loop, otherwise the song has started repeating
+            const int pos = sequencer.order() * module::max_rows + sequencer.row();
+            if ((visited[pos] && !sequencer.in_pattern_loop()) || ++num_rows > max_dry_run_rows) break;
+            visited[pos] = true;
+            sequencer.process_row_effects(mod.events_at(sequencer.order(), sequencer.row()));
+        }
+        ms += 1000.0 / std::max(1, sequencer.tempo() * 2 / 5);
+    }
+    return static_cast<int>(ms + 0.5);
+}
+
+bool read_module_info(const std::string& filename, module_info& info)
+{
+    uint32_t file_size;
+    {
+        std::ifstream in(filename, std::ifstream::binary);
+        if (!in || !in.is_open()) {
+            throw std::runtime_error("Could not open " + filename);
+        }
+        if (!is_xm(in) && !is_s3m(in) && !is_mod(in)) {
+            return false;
+        }
+        in.seekg(0, std::ios_base::end);
+        file_size = static_cast<uint32_t>(std::min<std::streamoff>(in.tellg(), UINT32_MAX));
+    }
+
+    // The sample frames are skipped, only their names and lengths are read
+    std::vector<deferred_sample> deferred;
+    const module mod{load_module(filename.c_str(), &deferred)};
+
+    info.filename     = filename;
+    info.type         = mod.type;
+    info.name         = trim_right(mod.name);
+    info.num_channels = mod.num_channels;
+    info.num_orders   = static_cast<int>(mod.order.size());
+    info.num_patterns = mod.patterns.size();
+    info.instrument_names.clear();
+    info.sample_names.clear();
+    for (const auto& ins : mod.instruments) {
+        info.instrument_names.push_back(trim_right(ins.name()));
+        for (const auto& s : ins.samples()) {
+            info.sample_names.push_back(trim_right(s.data().name()));
+        }
+    }
+    info.duration_ms = module_duration_ms(mod);
+    info.file_size   = file_size;
+    return true;
+}
+
+std::vector<module_info> read_module_infos(const std::vector<std::string>& filenames, int num_threads, std::vector<std::string>& failed)
+{
+    if (num_threads <= 0) {
+        num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+
+    std::vector<module_info> infos;
+    std::mutex mutex;
+    std::atomic<size_t> next{0};
+    auto read_files = [&] {
+        module_info info;
+        for (size_t i; (i = next++) < filenames.size();) {
+            bool loaded = false;
+            try {
+                if (!read_module_info(filenames[i], info)) {
+                    continue;
+                }
+                loaded = true;
+            } catch (const std::exception&) {
+            }
+            std::lock_guard<std::mutex> lock{mutex};
+            if (loaded) {
+                infos.push_back(std::move(info));
+            } else {
+                failed.push_back(filenames[i]);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < num_threads; ++i) {
+        threads.emplace_back(read_files);
+    }
+    read_files();
+    for (auto& t : threads) {
+        t.join();
+    }
+    return infos;
+}
+
+bool write_module_index(const std::string& index_filename, std::vector<module_info> modules)
+{
+    std::sort(modules.begin(), modules.end(), [](const module_info& l, const module_info& r) {
+        const int c = compare_nocase(l.name.c_str(), r.name.c_str());
+        return c ? c < 0 : l.filename < r.filename;
+    });
+
+    string_table strings;
+    std::vector<index_entry> entries;
+    std::vector<uint32_t> names;
+    for (const auto& m : modules) {
+        index_entry e{};
+        e.filename        = strings.add(m.filename);
+        e.name            = strings.add(m.name);
+        e.first_name      = static_cast<uint32_t>(names.size());
+        e.duration_ms     = static_cast<uint32_t>(m.duration_ms);
+        e.file_size       = m.file_size;
+        e.num_orders      = count16(m.num_orders);
+        e.num_patterns    = count16(m.num_patterns);
+        e.num_instruments = count16(m.instrument_names.size());
+        e.num_samples     = count16(m.sample_names.size());
+        e.type            = static_cast<uint8_t>(m.type);
+        e.num_channels    = static_cast<uint8_t>(m.num_channels);
+        entries.push_back(e);
+        for (const auto& n : m.instrument_names) names.push_back(strings.add(n));
+        for (const auto& n : m.sample_names) names.push_back(strings.add(n));
+    }
+
+    index_header h{};
+    memcpy(h.magic, index_magic, sizeof(index_magic));
+    h.version      = module_index_version;
+    h.num_entries  = static_cast<uint32_t>(entries.size());
+    h.num_names    = static_cast<uint32_t>(names.size());
+    h.strings_size = static_cast<uint32_t>(strings.data().size());
+
+    // Write to a temporary file first so a partially written index is never picked up
+    const std::string temp_filename = index_filename + ".tmp";
+    {
+        std::ofstream out(temp_filename, std::ofstream::binary | std::ofstream::trunc);
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(index_entry));
+        write_padding(out);
+        out.write(reinterpret_cast<const char*>(names.data()), names.size() * sizeof(uint32_t));
+        write_padding(out);
+        out.write(strings.data().data(), strings.data().size());
+        if (!out) {
+            out.close();
+            std::remove(temp_filename.c_str());
+            return false;
+        }
+    }
+    std::remove(index_filename.c_str());
+    return std::rename(temp_filename.c_str(), index_filename.c_str()) == 0;
+}
+
+class module_index::impl {
+public:
+    explicit impl(const std::shared_ptr<const mapped_file>& file) : file_(file) {
+    }
+
+    // Checks that the whole index can be accessed without further bounds checks
+    bool validate() {
+        if (file_->size() < sizeof(index_header)) return false;
+        const auto& h = *reinterpret_cast<const index_header*>(file_->data());
+        if (memcmp(h.magic, index_magic, sizeof(index_magic)) || h.version != module_index_version) return false;
+        const index_layout layout{h};
+        if (layout.file_size != file_->size() || !h.strings_size) return false;
+
+        num_entries_  = static_cast<int>(h.num_entries);
+        num_names_    = h.num_names;
+        strings_size_ = h.strings_size;
+        entries_      = reinterpret_cast<const index_entry*>(file_->data() + sizeof(index_header));
+        names_        = reinterpret_cast<const uint32_t*>(file_->data() + layout.names);
+        strings_      = reinterpret_cast<const char*>(file_->data() + layout.strings);
+        if (strings_[strings_size_ - 1]) return false;
+        for (int i = 0; i < num_entries_; ++i) {
+            const auto& e = entries_[i];
+            if (e.filename >= strings_size_ || e.name >= strings_size_ || e.type > static_cast<uint8_t>(module_type::xm)) return false;
+            if (e.first_name > num_names_ || static_cast<uint32_t>(e.num_instruments) + e.num_samples > num_names_ - e.first_name) return false;
+        }
+        for (uint32_t i = 0; i < num_names_; ++i) {
+            if (names_[i] >= strings_size_) return false;
+        }
+        return true;
+    }
+
+    int size() const {
+        return num_entries_;
+    }
+
+    const index_entry& entry(int index) const {
+        assert(index >= 0 && index < num_entries_);
+        return entries_[index];
+    }
+
+    const char* string(uint32_t offset) const {
+        assert(offset < strings_size_);
+        return strings_ + offset;
+    }
+
+    const uint32_t* names(const index_entry& e) const {
+        return names_ + e.first_name;
+    }
+
+    std::pair<int, int> find_name(const std::string& prefix) const {
+        // First entry for which pred is false, pred must be true for a prefix of the entries
+        auto partition_point = [this](auto pred) {
+            int first = 0;
+            for (int count = num_entries_; count > 0;) {
+                const int step = count / 2;
+                if (pred(first + step)) {
+                    first += step + 1;
+                    count -= step + 1;
+                } else {
+                    count = step;
+                }
+            }
+            return first;
+        };
+        auto compare = [&](int index) { return compare_nocase(string(entries_[index].name), prefix.c_str(), prefix.size()); };
+        const int first = partition_point([&](int index) { return compare(index) < 0; });
+        const int last  = partition_point([&](int index) { return compare(index) <= 0; });
+        return {first, last};
+    }
+
+    std::vector<int> search(const std::string& text) const {
+        std::vector<int> result;
+        std::string lower_text{text};
+        std::transform(lower_text.begin(), lower_text.end(), lower_text.begin(), to_lower);
+        if (lower_text.empty()) {
+            for (int i = 0; i < num_entries_; ++i) result.push_back(i);
+            return result;
+        }
+
+        // Every string is only in the table once, so search the table and then look for entries using the matches
+        std::vector<bool> matches(strings_size_);
+        for (uint32_t offset = 0; offset < strings_size_;) {
+            const size_t len = strlen(strings_ + offset);
+            if (contains_nocase(strings_ + offset, len, lower_text)) {
+                matches[offset] = true;
+            }
+            offset += static_cast<uint32_t>(len + 1);
+        }
+        for (int i = 0; i < num_entries_; ++i) {
+            const auto& e = entries_[i];
+            bool match = matches[e.filename] || matches[e.name];
+            const uint32_t* n = names(e);
+            for (int j = 0, count = e.num_instruments + e.num_samples; j < count && !match; ++j) {
+                match = matches[n[j]];
+            }
+            if (match) {
+                result.push_back(i);
+            }
+        }
+        return result;
+    }
+
+private:
+    std::shared_ptr<const mapped_file> file_;
+    int                                num_entries_ = 0;
+    uint32_t                           num_names_ = 0;
+    uint32_t                           strings_size_ = 0;
+    const index_entry*                 entries_ = nullptr;
+    const uint32_t*                    names_ = nullptr;
+    const char*                        strings_ = nullptr;
+};
+
+std::unique_ptr<module_index> module_index::open(const std::string& index_filename) {
+    const auto file = mapped_file::open(index_filename);
+    if (!file) {
+        return nullptr;
+    }
+    std::unique_ptr<impl> i{new impl{file}};
+    if (!i->validate()) {
+        return nullptr;
+    }
+    return std::unique_ptr<module_index>{new module_index{std::move(i)}};
+}
+
+module_index::module_index(std::unique_ptr<impl> i) : impl_(std::move(i)) {
+}
+
+module_index::~module_index() = default;
+
+int module_index::size() const {
+    return impl_->size();
+}
+
+const char* module_index::filename(int index) const {
+    return impl_->string(impl_->entry(index).filename);
+}
+
+const char* module_index::name(int index) const {
+    return impl_->string(impl_->entry(index).name);
+}
+
+module_info module_index::info(int index) const {
+    const auto& e = impl_->entry(index);
+    module_info info;
+    info.filename     = impl_->string(e.filename);
+    info.type         = static_cast<module_type>(e.type);
+    info.name         = impl_->string(e.name);
+    info.num_channels = e.num_channels;
+    info.num_orders   = e.num_orders;
+    info.num_patterns = e.num_patterns;
+    const uint32_t* names = impl_->names(e);
+    for (int i = 0; i < e.num_instruments; ++i) {
+        info.instrument_names.push_back(impl_->string(*names++));
+    }
+    for (int i = 0; i < e.num_samples; ++i) {
+        info.sample_names.push_back(impl_->string(*names++));
+    }
+    info.duration_ms  = static_cast<int>(e.duration_ms);
+    info.file_size    = e.file_size;
+    return info;
+}
+
+std::pair<int, int> module_index::find_name(const std::string& prefix) const {
+    return impl_->find_name(prefix);
+}
+
+std::vector<int> module_index::search(const std::string& text) const {
+    return impl_->search(text);
+}
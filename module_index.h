@@ -0,0 +1,70 @@
+#ifndef SAMPEDIT_MODULE_INDEX_H
+#define SAMPEDIT_MODULE_INDEX_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include "module.h"
+
+// What the module index stores about a module file
+struct module_info {
+    std::string              filename;
+    module_type              type = module_type::mod;
+    std::string              name;
+    int                      num_channels = 0;
+    int                      num_orders = 0;
+    int                      num_patterns = 0;
+    std::vector<std::string> instrument_names;
+    std::vector<std::string> sample_names;
+    int                      duration_ms = 0;
+    uint32_t                 file_size = 0;
+};
+
+// Milliseconds it takes to play mod from the start until it starts repeating. Only the speed, tempo and
+// sequencing effects are followed (with module_sequencer like mod_player), nothing is mixed.
+int module_duration_ms(const module& mod);
+
+// Fills info from filename without decoding the samples, the names have their trailing spaces removed.
+// Returns false if filename isn't a MOD, S3M or XM file and throws std::runtime_error if it is one but can't be loaded.
+bool read_module_info(const std::string& filename, module_info& info);
+
+// Reads the modules among filenames on num_threads threads (0 = one per core), in no particular order.
+// The names of the files that couldn't be loaded are added to failed.
+std::vector<module_info> read_module_infos(const std::vector<std::string>& filenames, int num_threads, std::vector<std::string>& failed);
+
+// Writes an index of modules to index_filename. Returns false if it couldn't be written.
+//
+// Layout (native byte order, every section aligned to 32 bytes):
+//   header         Magic, module_index_version, number of entries and size of each section
+//   entries        One fixed size record per module sorted by song name (case insensitive) and then filename
+//   name table     String table offsets of the instrument names followed by the sample names of each entry
+//   string table   Every distinct string once, NUL terminated
+bool write_module_index(const std::string& index_filename, std::vector<module_info> modules);
+
+constexpr uint32_t module_index_version = 1;
+
+// Memory mapped module index written by write_module_index
+class module_index {
+public:
+    // Returns nullptr if index_filename doesn't exist or isn't a valid index of the current version
+    static std::unique_ptr<module_index> open(const std::string& index_filename);
+    ~module_index();
+
+    int size() const;
+    const char* filename(int index) const;
+    const char* name(int index) const;
+    module_info info(int index) const;
+
+    // Range [first, last) of the entries with a song name starting with prefix (case insensitive)
+    std::pair<int, int> find_name(const std::string& prefix) const;
+    // Entries with text in the filename, song name or an instrument or sample name (case insensitive), in index order
+    std::vector<int> search(const std::string& text) const;
+
+private:
+    class impl;
+    explicit module_index(std::unique_ptr<impl> i);
+    const std::unique_ptr<impl> impl_;
+};
+
+#endif
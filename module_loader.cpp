@@ -0,0 +1,338 @@
+#include "module_loader.h"
+#include "module_cache.h"
+#include <base/sample_store.h>
+#include <win32/semaphore.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cassert>
+#include <cwchar>
+
+class module_loader::impl {
+public:
+    explicit impl(const std::string& filename, int num_threads, sample_decoding decoding, const std::string& cache_directory)
+        : filename_(filename)
+        , num_threads_(num_threads > 0 ? num_threads : std::max(1, static_cast<int>(std::thread::hardware_concurrency())))
+        , decoding_(decoding)
+        , cache_directory_(cache_directory)
+        , structure_thread_([this] { read_structure(); }) {
+    }
+
+    ~impl() {
+        cancel();
+        structure_thread_.join();
+        // No more decode threads are started once the structure thread is done
+        for (auto& t : decode_threads_) {
+            t.join();
+        }
+    }
+
+    module_load_progress progress() const {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return progress_;
+    }
+
+    void cancel() {
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (progress_.state == module_load_state::reading_structure || progress_.state == module_load_state::decoding_samples) {
+            progress_.state = module_load_state::cancelled;
+            cv_.notify_all();
+            wake_decode_threads();
+        }
+    }
+
+    module take_playable(int order) {
+        std::unique_lock<std::mutex> lock{mutex_};
+        cv_.wait(lock, [this] { return progress_.state != module_load_state::reading_structure; });
+        check_state();
+        if (!mod_) {
+            throw std::runtime_error("Module " + filename_ + " has already been handed over");
+        }
+        if (order < 0 || order >= static_cast<int>(mod_->order.size())) {
+            throw std::runtime_error("Invalid start order " + std::to_string(order) + " for " + filename_);
+        }
+
+        // Move the samples of the instruments in the pattern to the front of the queue
+        const auto used = instruments_used(*mod_, order);
+        for (size_t i = 0; i < used.size(); ++i) {
+            if (used[i]) request(static_cast<int>(i));
+        }
+        take_requests();
+        const auto needed_decoded = [&] {
+            for (size_t i = 0; i < deferred_.size(); ++i) {
+                if (used[deferred_[i].instrument] && !decoded_[i]) return false;
+            }
+            return true;
+        };
+        cv_.wait(lock, [&] { return needed_decoded() || progress_.state != module_load_state::decoding_samples; });
+        check_state();
+
+        module mod{std::move(*mod_)};
+        mod_.reset();
+        return mod;
+    }
+
+    void request(int instrument) {
+        assert(requested_ && instrument >= 0 && instrument < num_instruments_);
+        if (!requested_[instrument].exchange(true)) {
+            requests_pending_.store(true);
+            wakeup_.signal();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock{mutex_};
+        cv_.wait(lock, [this] { return progress_.state != module_load_state::reading_structure && progress_.state != module_load_state::decoding_samples; });
+        check_state();
+    }
+
+private:
+    const std::string                filename_;
+    const int                        num_threads_;
+    const sample_decoding            decoding_;
+    const std::string                cache_directory_;
+    mutable std::mutex               mutex_;
+    std::condition_variable          cv_;
+    module_load_progress             progress_{module_load_state::reading_structure, 0, 0, 0, 0};
+    std::string                      error_;
+    std::unique_ptr<module>          mod_;
+    // Set once by the structure thread before the decode threads are started
+    std::vector<deferred_sample>     deferred_;
+    // Protected by mutex_
+    std::deque<int>                  queue_;   // Indices in deferred_ in decode order
+    std::vector<bool>                queued_;
+    std::vector<bool>                decoded_;
+    std::vector<bool>                handled_; // Requests moved to the queue, by instrument
+    // Every sample is queued (requests still go first) when decoding up front or when the cache has to be written
+    bool                             decode_all_ = false;
+    // Set when cache_directory_ didn't have the module: A copy sharing the sample frames, written to cache_filename_ by
+    // the thread decoding the last sample
+    std::string                      cache_filename_;
+    std::unique_ptr<module>          cache_copy_;
+    // Set by request from any thread, consumed by take_requests
+    std::unique_ptr<std::atomic<bool>[]> requested_;
+    int                              num_instruments_ = 0;
+    std::atomic<bool>                requests_pending_{false};
+    // Wakes idle decode threads when decoding on demand. Signalled by request without taking mutex_ (it may be the
+    // audio thread), a signal arriving just before a thread waits is kept rather than lost.
+    semaphore                        wakeup_;
+    std::vector<std::thread>         decode_threads_;
+    // must be last
+    std::thread                      structure_thread_;
+
+    void check_state() const {
+        if (progress_.state == module_load_state::failed) {
+            throw std::runtime_error(error_);
+        } else if (progress_.state == module_load_state::cancelled) {
+            throw std::runtime_error("Loading " + filename_ + " was cancelled");
+        }
+    }
+
+    // Indexed by instrument index (module_note::instrument - 1)
+    static std::vector<bool> instruments_used(const module& mod, int order) {
+        std::vector<bool> used(mod.instruments.size());
+        for (int row = 0; row < mod.num_rows(order); ++row) {
+            const auto r = mod.at(order, row);
+            for (int ch = 0; ch < mod.num_channels; ++ch) {
+                const int ins = r[ch].instrument;
+                if (ins && ins <= static_cast<int>(used.size())) {
+                    used[ins - 1] = true;
+                }
+            }
+        }
+        return used;
+    }
+
+    void read_structure() {
+        std::unique_ptr<module> mod;
+        std::vector<deferred_sample> deferred;
+        std::string cache_filename;
+        std::unique_ptr<module> cache_copy;
+        try {
+            if (!cache_directory_.empty()) {
+                cache_filename = module_cache_filename(cache_directory_, filename_);
+                mod = read_module_cache(cache_filename, filename_);
+            }
+            if (!mod) {
+                // Not cached (or cached for another version of the file), decode the samples as usual and write the
+                // cache once they're all decoded
+                mod.reset(new module{load_module(filename_.c_str(), &deferred)});
+                if (!cache_filename.empty()) {
+                    cache_copy.reset(new module{*mod});
+                }
+            }
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (progress_.state == module_load_state::reading_structure) {
+                progress_.state = module_load_state::failed;
+                error_ = e.what();
+            }
+            cv_.notify_all();
+            return;
+        }
+
+        // Decode the samples in the order they're first used in the song
+        const int no_use = static_cast<int>(mod->order.size());
+        std::vector<int> first_use(mod->instruments.size(), no_use);
+        for (int order = no_use - 1; order >= 0; --order) {
+            const auto used = instruments_used(*mod, order);
+            for (size_t i = 0; i < used.size(); ++i) {
+                if (used[i]) first_use[i] = order;
+            }
+        }
+
+        std::unique_lock<std::mutex> lock{mutex_};
+        if (progress_.state != module_load_state::reading_structure) {
+            return; // Cancelled
+        }
+        deferred_   = std::move(deferred);
+        decode_all_ = decoding_ == sample_decoding::up_front || cache_copy;
+        if (cache_copy) {
+            cache_filename_ = cache_filename;
+            cache_copy_     = std::move(cache_copy);
+        }
+        if (decode_all_) {
+            for (int i = 0; i < static_cast<int>(deferred_.size()); ++i) {
+                queue_.push_back(i);
+            }
+            std::stable_sort(queue_.begin(), queue_.end(), [&](int l, int r) { return first_use[deferred_[l].instrument] < first_use[deferred_[r].instrument]; });
+        }
+        queued_.assign(deferred_.size(), decode_all_);
+        decoded_.assign(deferred_.size(), false);
+        num_instruments_ = static_cast<int>(mod->instruments.size());
+        handled_.assign(num_instruments_, false);
+        requested_.reset(new std::atomic<bool>[num_instruments_]);
+        for (int i = 0; i < num_instruments_; ++i) {
+            requested_[i].store(false);
+        }
+        mod_ = std::move(mod);
+        progress_.num_patterns    = mod_->patterns.size();
+        progress_.num_instruments = static_cast<int>(mod_->instruments.size());
+        progress_.num_samples     = static_cast<int>(deferred_.size());
+        progress_.state           = deferred_.empty() ? module_load_state::done : module_load_state::decoding_samples;
+        for (int i = 0; i < std::min(num_threads_, progress_.num_samples); ++i) {
+            decode_threads_.emplace_back([this] { decode_samples(); });
+        }
+        cv_.notify_all();
+        write_cache(lock);
+    }
+
+    // Writes the cache if it's wanted and all samples are decoded (only once). Must hold mutex_ on entry, releases it
+    // while writing.
+    void write_cache(std::unique_lock<std::mutex>& lock) {
+        if (progress_.state != module_load_state::done || !cache_copy_) {
+            return;
+        }
+        const std::unique_ptr<module> mod{std::move(cache_copy_)};
+        lock.unlock();
+        if (!write_module_cache(cache_filename_, filename_, *mod)) {
+            wprintf(L"Could not write module cache '%S'\n", cache_filename_.c_str());
+        }
+        lock.lock();
+    }
+
+    // Must hold mutex_
+    void wake_decode_threads() {
+        if (!decode_threads_.empty()) {
+            wakeup_.signal(static_cast<int>(decode_threads_.size()));
+        }
+    }
+
+    // Moves the samples of newly requested instruments to the front of the queue (adding them when decoding on demand)
+    // and wakes the decode threads to decode them. Must hold mutex_.
+    void take_requests() {
+        if (!requests_pending_.exchange(false)) {
+            return;
+        }
+        std::vector<bool> fresh(num_instruments_);
+        for (int ins = 0; ins < num_instruments_; ++ins) {
+            if (!handled_[ins] && requested_[ins].load()) {
+                handled_[ins] = true;
+                fresh[ins]    = true;
+            }
+        }
+        for (int i = 0; i < static_cast<int>(deferred_.size()); ++i) {
+            if (fresh[deferred_[i].instrument] && !queued_[i]) {
+                queued_[i] = true;
+                queue_.push_back(i);
+            }
+        }
+        std::stable_partition(queue_.begin(), queue_.end(), [&](int i) { return fresh[deferred_[i].instrument]; });
+        if (!queue_.empty()) {
+            wake_decode_threads();
+        }
+    }
+
+    void decode_samples() {
+        std::ifstream in(filename_, std::ifstream::binary);
+        std::unique_lock<std::mutex> lock{mutex_};
+        while (progress_.state == module_load_state::decoding_samples) {
+            take_requests();
+            if (queue_.empty()) {
+                if (decode_all_) {
+                    break;
+                }
+                // Until a request, new work from another thread or the end of loading
+                lock.unlock();
+                wakeup_.wait();
+                lock.lock();
+                continue;
+            }
+            const int index = queue_.front();
+            queue_.pop_front();
+            lock.unlock();
+
+            auto& d = deferred_[index];
+            in.clear();
+            auto data = decode_sample(in, d.source, d.samp.length());
+            const bool ok = !in.fail() || in.eof(); // Truncated files leave the rest of the sample silent, like the loaders
+            d.samp.set_data(sample_store::instance().intern(std::move(data)));
+
+            lock.lock();
+            if (!ok && progress_.state == module_load_state::decoding_samples) {
+                progress_.state = module_load_state::failed;
+                error_ = "Could not read sample data from " + filename_;
+            }
+            decoded_[index] = true;
+            if (++progress_.samples_decoded == progress_.num_samples && progress_.state == module_load_state::decoding_samples) {
+                progress_.state = module_load_state::done;
+            }
+            if (progress_.state != module_load_state::decoding_samples) {
+                wake_decode_threads();
+            }
+            cv_.notify_all();
+        }
+        write_cache(lock);
+    }
+};
+
+module_loader::module_loader(const std::string& filename, int num_threads, sample_decoding decoding, const std::string& cache_directory)
+    : impl_(std::make_unique<impl>(filename, num_threads, decoding, cache_directory)) {
+}
+
+module_loader::~module_loader() = default;
+
+module_load_progress module_loader::progress() const {
+    return impl_->progress();
+}
+
+void module_loader::cancel() {
+    impl_->cancel();
+}
+
+module module_loader::take_playable(int order) {
+    return impl_->take_playable(order);
+}
+
+void module_loader::request(int instrument) {
+    impl_->request(instrument);
+}
+
+void module_loader::wait() {
+    impl_->wait();
+}
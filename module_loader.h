@@ -0,0 +1,70 @@
+#ifndef SAMPEDIT_MODULE_LOADER_H
+#define SAMPEDIT_MODULE_LOADER_H
+
+#include <memory>
+#include <string>
+#include "module.h"
+
+enum class module_load_state {
+    reading_structure, // Headers, patterns and instrument headers
+    decoding_samples,
+    done,
+    failed,
+    cancelled,
+};
+
+enum class sample_decoding {
+    up_front,  // Decode every sample in the background
+    on_demand, // Only decode the samples of requested instruments
+};
+
+struct module_load_progress {
+    module_load_state state;
+    int               num_patterns;     // Valid once the structure has been read
+    int               num_instruments;
+    int               samples_decoded;
+    int               num_samples;
+};
+
+// Loads a module in the background. The module structure is read first, then the sample frames are decoded on
+// a pool of threads, starting with the samples needed first. The module can be handed over and played as soon
+// as the samples of the first pattern to play are ready, the remaining samples play silently until decoded.
+// When decoding on demand only the file offsets and formats of the samples are recorded up front, the frames of
+// the instruments that are never requested are never decoded (or allocated). Loading then stays in the
+// decoding_samples state until every sample has been requested and decoded.
+class module_loader {
+public:
+    // Starts loading filename, decoding samples on num_threads threads (0 = one per core).
+    // A module found in cache_directory (see load_module) is ready to play with all its samples right away. A module
+    // that isn't is loaded as without the cache, except that every sample is decoded (requested ones first) even when
+    // decoding on demand, and the cache is written once they are.
+    explicit module_loader(const std::string& filename, int num_threads = 0, sample_decoding decoding = sample_decoding::up_front, const std::string& cache_directory = std::string{});
+    // Cancels loading if still in progress and waits for the threads
+    ~module_loader();
+
+    module_loader(const module_loader&) = delete;
+    module_loader& operator=(const module_loader&) = delete;
+
+    module_load_progress progress() const;
+
+    // Stops decoding as soon as possible. Samples that haven't been decoded stay silent.
+    void cancel();
+
+    // Blocks until the structure has been read and the samples used by the pattern at order are decoded, then
+    // hands over the module (only once). Throws std::runtime_error if loading failed or was cancelled.
+    module take_playable(int order = 0);
+
+    // Decodes the samples of instrument (index in module::instruments) ahead of the others, or at all when
+    // decoding on demand. Only valid once take_playable has returned. Never blocks or allocates, so it can be
+    // called from the audio thread.
+    void request(int instrument);
+
+    // Blocks until all samples have been decoded (when decoding on demand: requested and decoded). Throws std::runtime_error if loading failed or was cancelled.
+    void wait();
+
+private:
+    class impl;
+    std::unique_ptr<impl> impl_;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "module_sequencer.h"
+#include <cassert>
+
+module_sequencer::module_sequencer(const module& mod)
+    : mod_(mod)
+    , speed_(mod.initial_speed)
+    , tempo_(mod.initial_tempo)
+    , tick_(mod.initial_speed + 1)
+{
+}
+
+void module_sequencer::skip_to_order(int order)
+{
+    assert(order >= 0 && order < static_cast<int>(mod_.order.size()));
+    order_             = order;
+    row_               = -1;
+    tick_              = speed_;
+    pattern_jump_      = -1;
+    pattern_break_row_ = -1;
+}
+
+bool module_sequencer::next_tick()
+{
+    if (++tick_ < speed_) {
+        return false;
+    }
+    tick_ = 0;
+    if (pattern_delay_ > 0) {
+        --pattern_delay_;
+        return false;
+    }
+    pattern_delay_ = -1;
+
+    if (pattern_jump_ != -1) {
+        order_ = pattern_jump_ < static_cast<int>(mod_.order.size()) ? pattern_jump_ : 0;
+        row_   = pattern_break_row_ == -1 ? -1 : break_row() - 1;
+    } else if (pattern_break_row_ != -1) {
+        next_order();
+        row_   = break_row() - 1;
+    }
+    pattern_jump_      = -1;
+    pattern_break_row_ = -1;
+
+    if (pattern_loop_) {
+        pattern_loop_ = false;
+        if (pattern_loop_counter_ > 0) {
+            assert(pattern_loop_row_ >= 0 && pattern_loop_row_ < module::max_rows);
+            row_ = pattern_loop_row_ - 1;
+            pattern_loop_row_ = -1;
+            --pattern_loop_counter_;
+        } else if (pattern_loop_counter_ == 0) {
+            pattern_loop_counter_ = -1;
+            pattern_loop_row_     = -1;
+        }
+    }
+
+    if (++row_ >= mod_.num_rows(order_)) {
+        row_ = 0;
+        next_order();
+    }
+    return true;
+}
+
+void module_sequencer::process_row_effects(module_event_range events)
+{
+    for (const auto& e : events) {
+        const int x = e.effect_param >> 4;
+        const int y = e.effect_param & 0xf;
+        if (mod_.type == module_type::s3m) {
+            switch (e.effect_op) {
+            case s3m_effect_op('A'): // Axy Set speed
+                speed_ = e.effect_param;
+                break;
+            case s3m_effect_op('B'): // Bxy Pattern jump
+                pattern_jump(e.effect_param);
+                pattern_break(x * 10 + y); // Bxy is also handled as Cxy
+                break;
+            case s3m_effect_op('C'): // Cxy Pattern break
+                pattern_break(x * 10 + y);
+                break;
+            case extended_effect_op(0xB): // SBy Pattern loop
+                pattern_loop(y);
+                break;
+            case s3m_effect_op('T'): // Txy Set tempo
+                assert(e.effect_param >= 0x20);
+                tempo_ = e.effect_param;
+                break;
+            }
+        } else {
+            switch (e.effect_op) {
+            case effect_op(0xB): // Bxy Pattern jump (not played in XMs)
+                if (mod_.type == module_type::mod) pattern_jump(e.effect_param);
+                break;
+            case effect_op(0xD): // Dxy Pattern break
+                pattern_break(x * 10 + y);
+                break;
+            case extended_effect_op(0x6): // E6y Pattern loop
+                pattern_loop(y);
+                break;
+            case extended_effect_op(0xE): // EEy Pattern delay (not played in XMs)
+                if (mod_.type == module_type::mod) pattern_delay(y);
+                break;
+            case effect_op(0xF): // Fxy Set speed/tempo
+                if (e.effect_param < 0x20) {
+                    speed_ = e.effect_param;
+                } else {
+                    tempo_ = e.effect_param;
+                }
+                break;
+            }
+        }
+    }
+}
+
+void module_sequencer::next_order()
+{
+    if (++order_ >= static_cast<int>(mod_.order.size())) {
+        order_ = 0; // TODO: Use restart pos
+    }
+}
+
+// Row to continue from after a pattern break, breaks past the end of the (possibly shorter) new pattern go to its first row
+int module_sequencer::break_row() const
+{
+    return pattern_break_row_ < mod_.num_rows(order_) ? pattern_break_row_ : 0;
+}
+
+void module_sequencer::pattern_break(int row)
+{
+    assert(row >= 0 && row < module::max_rows);
+    pattern_break_row_ = row; // The last break in a row wins
+}
+
+void module_sequencer::pattern_jump(int order)
+{
+    pattern_jump_      = order; // Jumps past the end of the order list go to the start
+    pattern_break_row_ = -1;    // A pattern jump after a pattern break makes the break have no effect
+}
+
+void module_sequencer::pattern_delay(int delay_notes)
+{
+    if (pattern_delay_ == -1) {
+        pattern_delay_ = delay_notes;
+    }
+}
+
+void module_sequencer::pattern_loop(int x)
+{
+    if (x == 0) {
+        pattern_loop_row_ = row_;
+    } else {
+        if (pattern_loop_counter_ == -1 && pattern_loop_row_ != -1) {
+            pattern_loop_counter_ = x;
+        }
+        pattern_loop_ = true;
+    }
+}
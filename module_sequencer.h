@@ -0,0 +1,53 @@
+#ifndef SAMPEDIT_MODULE_SEQUENCER_H
+#define SAMPEDIT_MODULE_SEQUENCER_H
+
+#include "module.h"
+
+// Position in a module and the speed, tempo and sequencing effects (pattern jump, break, delay and loop) that move it.
+// mod_player plays modules with it and module_duration_ms times them with it without playing anything.
+class module_sequencer {
+public:
+    explicit module_sequencer(const module& mod);
+
+    int order() const { return order_; }
+    int row() const { return row_; }        // -1 before the first row
+    int tick() const { return tick_; }
+    int speed() const { return speed_; }    // Ticks per row
+    int tempo() const { return tempo_; }    // BPM, 2*bpm/5 ticks per second
+
+    // True while rows are being played again by a pattern loop
+    bool in_pattern_loop() const { return pattern_loop_counter_ != -1; }
+
+    // Starts order on the next tick
+    void skip_to_order(int order);
+
+    // Moves to the next tick. Returns true if a row starts, the caller then processes it (and passes its events to
+    // process_row_effects). Tick 0 of a row repeated by a pattern delay doesn't start a row.
+    bool next_tick();
+
+    // Handles the speed, tempo and sequencing effects of the row that just started
+    void process_row_effects(module_event_range events);
+
+private:
+    const module& mod_;
+    int           speed_;
+    int           tempo_;
+    int           order_ = 0;
+    int           row_ = -1;
+    int           tick_;
+    int           pattern_jump_ = -1;
+    int           pattern_break_row_ = -1;
+    int           pattern_delay_ = -1;
+    int           pattern_loop_row_ = -1;
+    int           pattern_loop_counter_ = -1;
+    bool          pattern_loop_ = false;
+
+    void next_order();
+    int break_row() const;
+    void pattern_break(int row);
+    void pattern_jump(int order);
+    void pattern_delay(int delay_notes);
+    void pattern_loop(int x);
+};
+
+#endif
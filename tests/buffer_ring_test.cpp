@@ -0,0 +1,138 @@
+#include <base/buffer_ring.h>
+#include "test.h"
+#include <deque>
+#include <functional>
+#include <stdint.h>
+
+namespace {
+
+constexpr int buffer_frames = 64;
+
+// A render thread filling the ring and a sound device playing the buffers in real time, on a simulated clock counting
+// frames. The device starts playing as soon as it has a buffer and stops when it runs out.
+class simulation {
+public:
+    // render_frames(now): How long rendering a buffer started at now takes
+    explicit simulation(const buffer_ring_config& config, std::function<int (int64_t)> render_frames)
+        : ring_(config), render_frames_(std::move(render_frames)) {
+    }
+
+    const buffer_ring& ring() const { return ring_; }
+
+    void run_until(int64_t end) {
+        for (; now_ < end; ++now_) {
+            if (play_end_ == now_) {
+                CHECK(ring_.buffer_returned() == device_.front());
+                device_.pop_front();
+                play_end_ = device_.empty() ? -1 : now_ + buffer_frames;
+            }
+            if (render_end_ == now_) {
+                ring_.end_fill();
+                device_.push_back(render_slot_);
+                render_end_ = -1;
+                if (play_end_ == -1) {
+                    play_end_ = now_ + buffer_frames;
+                }
+            }
+            if (render_end_ == -1 && ring_.can_fill()) {
+                render_slot_ = ring_.begin_fill();
+                render_end_  = now_ + render_frames_(now_);
+            }
+            CHECK(ring_.queued() <= ring_.num_slots());
+            CHECK(ring_.frames_ahead() == static_cast<int>(device_.size()) * buffer_frames);
+        }
+    }
+
+private:
+    buffer_ring                   ring_;
+    std::function<int (int64_t)>  render_frames_;
+    std::deque<int>               device_; // Slots handed to the device, the first one is playing
+    int64_t                       now_ = 0;
+    int64_t                       play_end_ = -1;
+    int64_t                       render_end_ = -1;
+    int                           render_slot_ = -1;
+};
+
+buffer_ring_config adaptive_config() {
+    buffer_ring_config config;
+    config.buffer_frames = buffer_frames;
+    config.num_buffers   = 2;
+    config.adaptive      = true;
+    config.min_buffers   = 2;
+    config.max_buffers   = 5;
+    config.shrink_after  = 100;
+    return config;
+}
+
+void test_fixed() {
+    buffer_ring_config config;
+    config.buffer_frames = buffer_frames;
+    config.num_buffers   = 3;
+
+    // Rendering faster than real time never runs out
+    simulation fast{config, [](int64_t) { return buffer_frames / 4; }};
+    fast.run_until(1000 * buffer_frames);
+    CHECK(fast.ring().underruns() == 0);
+    CHECK(fast.ring().target() == 3);
+    CHECK(fast.ring().num_slots() == 3);
+
+    // Slower than real time runs out on every buffer, but the ring doesn't grow
+    simulation slow{config, [](int64_t) { return 2 * buffer_frames; }};
+    slow.run_until(1000 * buffer_frames);
+    CHECK(slow.ring().underruns() >= 400);
+    CHECK(slow.ring().target() == 3);
+}
+
+void test_grow_and_shrink() {
+    const auto config = adaptive_config();
+    // The first render started 200 buffers in takes three buffers
+    constexpr int64_t hiccup = 200 * buffer_frames;
+    bool hiccup_done = false;
+    simulation sim{config, [&hiccup_done](int64_t now) {
+        if (now < hiccup || hiccup_done) return buffer_frames / 4;
+        hiccup_done = true;
+        return 3 * buffer_frames;
+    }};
+    sim.run_until(hiccup);
+    CHECK(sim.ring().underruns() == 0);
+    CHECK(sim.ring().target() == 2);
+
+    // The device runs dry once and gets a buffer more
+    sim.run_until(hiccup + 10 * buffer_frames);
+    CHECK(sim.ring().underruns() == 1);
+    CHECK(sim.ring().target() == 3);
+
+    // And gives it back after shrink_after buffers without underruns
+    sim.run_until(hiccup + (config.shrink_after - 10) * buffer_frames);
+    CHECK(sim.ring().target() == 3);
+    sim.run_until(hiccup + (config.shrink_after + 10) * buffer_frames);
+    CHECK(sim.ring().target() == 2);
+    CHECK(sim.ring().underruns() == 1);
+}
+
+void test_slow_phase() {
+    const auto config = adaptive_config();
+    // Rendering slower than real time for a while, grows to max_buffers and shrinks back to min_buffers afterwards
+    constexpr int64_t slow_start = 100 * buffer_frames;
+    constexpr int64_t slow_end   = 200 * buffer_frames;
+    simulation sim{config, [](int64_t now) { return now >= slow_start && now < slow_end ? 3 * buffer_frames / 2 : buffer_frames / 4; }};
+    sim.run_until(slow_end);
+    CHECK(sim.ring().underruns() >= 3);
+    CHECK(sim.ring().target() == config.max_buffers);
+    CHECK(sim.ring().num_slots() == config.max_buffers);
+
+    sim.run_until(slow_end + 10 * buffer_frames);
+    const uint32_t underruns = sim.ring().underruns();
+    sim.run_until(slow_end + 10 * buffer_frames + config.shrink_after * (config.max_buffers - config.min_buffers + 1) * buffer_frames);
+    CHECK(sim.ring().underruns() == underruns);
+    CHECK(sim.ring().target() == config.min_buffers);
+}
+
+}
+
+int main() {
+    test_fixed();
+    test_grow_and_shrink();
+    test_slow_phase();
+    return test_result();
+}
@@ -0,0 +1,148 @@
+#include <base/grid_text_cache.h>
+#include "test.h"
+#include <string>
+#include <vector>
+#include <cstring>
+
+namespace {
+
+// Grid whose cells show the key, row, column and an edit count, counting the cells it formats
+class mock_grid : public virtual_grid {
+public:
+    int  rows_      = 16;
+    int  key_       = 0;
+    int  edits_     = 0;
+    std::vector<int> widths_{3, 5, 8};
+    mutable int formatted_ = 0;
+
+private:
+    int do_rows() const override { return rows_; }
+    int do_columns() const override { return static_cast<int>(widths_.size()); }
+    int do_column_width(int column) const override { return widths_[column]; }
+    int do_content_key() const override { return key_; }
+
+    void do_format_cell(int row, int column, char* buffer) const override {
+        ++formatted_;
+        char cell[virtual_grid::max_column_width * 2];
+        std::snprintf(cell, sizeof(cell), "%d%c%d%c%d%-*s", key_, 'a' + column, row, 'a' + edits_, column, virtual_grid::max_column_width, "");
+        std::memcpy(buffer, cell, widths_[column]);
+    }
+};
+
+// Text formatted directly with format_cell, laid out like grid_text_cache
+std::string expected_text(const mock_grid& grid) {
+    std::string text;
+    for (int r = 0; r < grid.rows(); ++r) {
+        for (int c = 0; c < grid.columns(); ++c) {
+            char cell[virtual_grid::max_column_width];
+            grid.format_cell(r, c, cell);
+            text.append(cell, grid.column_width(c));
+        }
+    }
+    return text;
+}
+
+bool text_matches(grid_text_cache& cache, const mock_grid& grid) {
+    const char* text = cache.text(grid);
+    int offset = 0;
+    for (int c = 0; c < grid.columns(); ++c) {
+        if (cache.column_offset(c) != offset) return false;
+        offset += grid.column_width(c);
+    }
+    if (cache.row_stride() != offset) return false;
+    const int formatted = grid.formatted_;
+    const auto expected = expected_text(grid);
+    grid.formatted_ = formatted;
+    return std::string(text, grid.rows() * cache.row_stride()) == expected;
+}
+
+void test_cached() {
+    grid_text_cache cache;
+    mock_grid grid;
+    const int cells = grid.rows() * grid.columns();
+
+    // Each key is formatted the first time it's shown
+    CHECK(text_matches(cache, grid));
+    CHECK(grid.formatted_ == cells);
+    grid.key_ = 1;
+    grid.rows_ = 64;
+    CHECK(text_matches(cache, grid));
+    CHECK(grid.formatted_ == cells + 64 * grid.columns());
+
+    // And not again
+    grid.formatted_ = 0;
+    for (int i = 0; i < 3; ++i) {
+        grid.key_  = i % 2;
+        grid.rows_ = i % 2 ? 64 : 16;
+        CHECK(text_matches(cache, grid));
+    }
+    CHECK(grid.formatted_ == 0);
+}
+
+void test_invalidate() {
+    grid_text_cache cache;
+    mock_grid grid;
+    CHECK(text_matches(cache, grid));
+    grid.key_ = 1;
+    CHECK(text_matches(cache, grid));
+
+    // An edit of key 0 reformats only key 0
+    grid.formatted_ = 0;
+    grid.key_   = 0;
+    grid.edits_ = 1;
+    cache.invalidate(0);
+    CHECK(text_matches(cache, grid));
+    CHECK(grid.formatted_ == grid.rows() * grid.columns());
+    grid.formatted_ = 0;
+    grid.key_ = 1;
+    grid.edits_ = 0;
+    CHECK(text_matches(cache, grid));
+    CHECK(grid.formatted_ == 0);
+
+    // Keys never shown are ignored
+    cache.invalidate(100);
+    cache.invalidate(-1);
+    CHECK(text_matches(cache, grid));
+    CHECK(grid.formatted_ == 0);
+}
+
+void test_layout_change() {
+    grid_text_cache cache;
+    mock_grid grid;
+    CHECK(text_matches(cache, grid));
+
+    // A wider column or a column more reformats everything
+    grid.formatted_ = 0;
+    grid.widths_[1] = 6;
+    CHECK(text_matches(cache, grid));
+    CHECK(grid.formatted_ == grid.rows() * grid.columns());
+
+    grid.formatted_ = 0;
+    grid.widths_.push_back(2);
+    CHECK(text_matches(cache, grid));
+    CHECK(grid.formatted_ == grid.rows() * grid.columns());
+
+    grid.formatted_ = 0;
+    CHECK(text_matches(cache, grid));
+    CHECK(grid.formatted_ == 0);
+}
+
+void test_uncached() {
+    // Content without a key is formatted every time
+    grid_text_cache cache;
+    mock_grid grid;
+    grid.key_ = -1;
+    CHECK(text_matches(cache, grid));
+    CHECK(text_matches(cache, grid));
+    CHECK(grid.formatted_ == 2 * grid.rows() * grid.columns());
+}
+
+}
+
+int main() {
+    test_cached();
+    test_invalidate();
+    test_layout_change();
+    test_uncached();
+    return test_result();
+}
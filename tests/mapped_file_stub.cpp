@@ -0,0 +1,9 @@
+// Stand-in for win32/mapped_file.cpp, the tests load modules without the module cache so nothing is ever mapped
+#include <win32/mapped_file.h>
+
+std::shared_ptr<const mapped_file> mapped_file::open(const std::string&) {
+    return nullptr;
+}
+
+mapped_file::~mapped_file() {
+}
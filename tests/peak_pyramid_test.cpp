@@ -0,0 +1,156 @@
+#include <base/peak_pyramid.h>
+#include "test.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+namespace {
+
+// Deterministic frames in [-1; 1]
+class frame_generator {
+public:
+    explicit frame_generator(uint32_t seed) : state_(seed) {}
+
+    float operator()() {
+        state_ = state_ * 1664525u + 1013904223u;
+        return static_cast<float>(state_ >> 8) / (1 << 23) - 1.0f;
+    }
+
+    int range(int n) {
+        (*this)();
+        return static_cast<int>((state_ >> 8) % static_cast<uint32_t>(n));
+    }
+
+private:
+    uint32_t state_;
+};
+
+peak_summary brute_force(const std::vector<float>& data, int first, int last) {
+    peak_summary s;
+    for (int i = first; i < last; ++i) {
+        s.add(data[i]);
+    }
+    return s;
+}
+
+bool same_summary(const peak_summary& a, const peak_summary& b) {
+    // The sums of squares are added up in a different order
+    return a.count == b.count && a.min == b.min && a.max == b.max && std::abs(a.sum_squares - b.sum_squares) <= 1e-5f * (1.0f + b.sum_squares);
+}
+
+void check_range(const peak_pyramid& p, const std::vector<float>& data, int first, int last) {
+    if (!same_summary(p.summarize(data.data(), first, last), brute_force(data, first, last))) {
+        std::fprintf(stderr, "Summary of [%d; %d[ of %d frames differs from the brute force scan\n", first, last, static_cast<int>(data.size()));
+        CHECK(false);
+    }
+}
+
+// Every range for short data, the ranges starting or ending on and around block boundaries and some random ones for long data
+void check_ranges(const peak_pyramid& p, const std::vector<float>& data, frame_generator& gen) {
+    const int length = static_cast<int>(data.size());
+    if (length <= 80) {
+        for (int first = 0; first <= length; ++first) {
+            for (int last = first; last <= length; ++last) {
+                check_range(p, data, first, last);
+            }
+        }
+        return;
+    }
+    for (int edge = 0; edge <= length; edge += peak_pyramid::block_size) {
+        for (int d = -1; d <= 1; ++d) {
+            const int pos = edge + d;
+            if (pos < 0 || pos > length) continue;
+            check_range(p, data, 0, pos);
+            check_range(p, data, pos, length);
+            check_range(p, data, pos, std::min(length, pos + 3 * peak_pyramid::block_size + 1));
+        }
+    }
+    for (int i = 0; i < 2000; ++i) {
+        const int a = gen.range(length + 1), b = gen.range(length + 1);
+        check_range(p, data, std::min(a, b), std::max(a, b));
+    }
+}
+
+void test_levels() {
+    const std::vector<float> data(100, 0.5f);
+    const struct { int length, levels; } cases[] = { {0, 0}, {1, 1}, {15, 1}, {16, 1}, {17, 2}, {32, 2}, {33, 3}, {100, 4} };
+    for (const auto& c : cases) {
+        peak_pyramid p;
+        p.build(data.data(), c.length);
+        CHECK(p.num_levels() == c.levels);
+    }
+}
+
+void test_build(int length) {
+    frame_generator gen{static_cast<uint32_t>(length) + 1};
+    std::vector<float> data(length);
+    for (auto& f : data) f = gen();
+    peak_pyramid p;
+    p.build(data.data(), length);
+    check_ranges(p, data, gen);
+}
+
+// A view of stored summaries summarizes like the pyramid they were saved from, a copy of it can be updated
+void test_view(int length) {
+    frame_generator gen{static_cast<uint32_t>(length) + 2000};
+    std::vector<float> data(length);
+    for (auto& f : data) f = gen();
+    std::vector<peak_summary> stored;
+    {
+        peak_pyramid built;
+        built.build(data.data(), length);
+        stored.assign(built.summaries(), built.summaries() + peak_pyramid::num_summaries(length));
+    }
+    peak_pyramid view;
+    view.view(stored.data(), length);
+    CHECK(view.summaries() == stored.data());
+    check_ranges(view, data, gen);
+
+    peak_pyramid copy{view};
+    CHECK(copy.num_levels() == view.num_levels() && (!length || copy.summaries() != stored.data()));
+    if (length) {
+        data[length / 2] = 3.0f;
+        copy.update(data.data(), length / 2, length / 2 + 1);
+        CHECK(copy.summarize(data.data(), 0, length).max == 3.0f);
+        CHECK(std::equal(stored.begin(), stored.end(), view.summaries(), [](const peak_summary& a, const peak_summary& b) { return same_summary(a, b); }));
+    }
+    check_ranges(copy, data, gen);
+}
+
+void test_update(int length) {
+    frame_generator gen{static_cast<uint32_t>(length) + 1000};
+    std::vector<float> data(length);
+    for (auto& f : data) f = gen();
+    peak_pyramid p;
+    p.build(data.data(), length);
+    // Changes within a block, across block boundaries, at the ends and of the whole data
+    for (int i = 0; i < 20; ++i) {
+        int first, last;
+        if (i == 0) {
+            first = 0, last = length;
+        } else if (i == 1) {
+            first = length ? length - 1 : 0, last = length;
+        } else {
+            const int a = gen.range(length + 1), b = gen.range(length + 1);
+            first = std::min(a, b), last = std::max(a, b);
+        }
+        for (int pos = first; pos < last; ++pos) {
+            data[pos] = 2.0f * gen(); // Beyond the old extremes
+        }
+        p.update(data.data(), first, last);
+    }
+    check_ranges(p, data, gen);
+}
+
+}
+
+int main() {
+    test_levels();
+    for (int length : { 0, 1, 2, 15, 16, 17, 31, 32, 33, 48, 63, 64, 65, 80, 100, 257, 1000, 4096, 4097, 12345 }) {
+        test_build(length);
+        test_view(length);
+        test_update(length);
+    }
+    return test_result();
+}
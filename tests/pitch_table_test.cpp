@@ -0,0 +1,71 @@
+#include <module.h>
+#include <base/note.h>
+#include "test.h"
+#include <vector>
+#include <algorithm>
+
+namespace {
+
+constexpr int sample_rate = 44100;
+
+module make_module(module_type type, bool linear_frequency) {
+    module mod{type};
+    if (type == module_type::xm) {
+        mod.xm.use_linear_frequency = linear_frequency;
+    }
+    return mod;
+}
+
+// The periods of all notes the module can play, every period in between (the slides) and some past the table
+std::vector<int> test_periods(const module& mod) {
+    int lowest = 1 << 30, highest = 0;
+    for (int n = 0; n <= static_cast<int>(piano_key::C_9); ++n) {
+        const int period = mod.note_to_period(piano_key::C_0 + n);
+        if (period > 0) {
+            lowest  = std::min(lowest, period);
+            highest = std::max(highest, period);
+        }
+    }
+    std::vector<int> periods;
+    for (int period = std::max(1, lowest / 2); period <= highest * 2; ++period) {
+        periods.push_back(period);
+    }
+    for (int period = 1 << 15; period < (1 << 15) + 1000; period += 7) {
+        periods.push_back(period);
+    }
+    return periods;
+}
+
+void check_module(const char* description, const module& mod) {
+    const pitch_table table{mod, sample_rate};
+    int increment_errors = 0, transpose_errors = 0;
+    for (const int period : test_periods(mod)) {
+        if (table.period_to_increment(period) != mod.period_to_freq(period) / sample_rate) {
+            ++increment_errors;
+        }
+        for (int semitones = 0; semitones < pitch_table::max_semitones; ++semitones) {
+            const int expected = mod.freq_to_period(mod.period_to_freq(period) * note_difference_to_scale(static_cast<float>(semitones)));
+            if (expected < 1) {
+                continue; // Transposed past the highest pitch (the rounding differs for the negative linear periods)
+            }
+            if (table.transpose_period(period, semitones) != expected) {
+                ++transpose_errors;
+            }
+        }
+    }
+    if (increment_errors || transpose_errors) {
+        std::fprintf(stderr, "%s: %d increment and %d transpose mismatches\n", description, increment_errors, transpose_errors);
+    }
+    CHECK(increment_errors == 0);
+    CHECK(transpose_errors == 0);
+}
+
+}
+
+int main() {
+    check_module("MOD", make_module(module_type::mod, false));
+    check_module("S3M", make_module(module_type::s3m, false));
+    check_module("XM amiga", make_module(module_type::xm, false));
+    check_module("XM linear", make_module(module_type::xm, true));
+    return test_result();
+}
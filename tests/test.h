@@ -0,0 +1,22 @@
+#ifndef SAMPEDIT_TESTS_TEST_H
+#define SAMPEDIT_TESTS_TEST_H
+
+#include <cstdio>
+
+// Checks for the unit tests. A failed check prints where it failed and the test carries on, main returns
+// test_result() so the test fails if any check did.
+inline int& test_failures() {
+    static int failures = 0;
+    return failures;
+}
+
+inline int test_result() {
+    if (test_failures()) {
+        std::fprintf(stderr, "%d check(s) failed\n", test_failures());
+    }
+    return test_failures() ? 1 : 0;
+}
+
+#define CHECK(expr) do { if (!(expr)) { std::fprintf(stderr, "%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #expr); ++test_failures(); } } while (0)
+
+#endif
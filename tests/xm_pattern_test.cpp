@@ -0,0 +1,174 @@
+#include <module.h>
+#include <module_sequencer.h>
+#include <xm.h>
+#include "test.h"
+#include <sstream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+namespace {
+
+struct test_pattern {
+    int num_rows;
+    // Effects as (row, effect << 8 | param) in the first channel
+    std::vector<std::pair<int, int>> effects;
+};
+
+class xm_builder {
+public:
+    static constexpr int num_channels = 2;
+
+    void u8(int v) { data_.push_back(static_cast<char>(v)); }
+    void u16(int v) { u8(v & 0xff); u8(v >> 8); }
+    void u32(uint32_t v) { u16(v & 0xffff); u16(v >> 16); }
+    void text(const char* s, size_t size) { std::string str{s}; str.resize(size, ' '); data_ += str; }
+
+    // An XM with the patterns played in order and no instruments (speed 1, so each tick plays a row)
+    std::string build(const std::vector<test_pattern>& patterns, const std::vector<int>& order) {
+        data_.clear();
+        text("Extended Module: ", 17);
+        text("Pattern test", 20);
+        u8(0x1a);
+        text("sampedit", 20);
+        u16(0x0104);
+        u32(276); // Header size
+        u16(static_cast<int>(order.size()));
+        u16(0); // Restart position
+        u16(num_channels);
+        u16(static_cast<int>(patterns.size()));
+        u16(0); // Instruments
+        u16(1); // Linear frequency table
+        u16(1); // Speed
+        u16(125);
+        for (int i = 0; i < 256; ++i) u8(i < static_cast<int>(order.size()) ? order[i] : 0);
+
+        for (const auto& p : patterns) {
+            std::string cells;
+            for (int row = 0; row < p.num_rows; ++row) {
+                int effect = 0;
+                for (const auto& e : p.effects) {
+                    if (e.first == row) effect = e.second;
+                }
+                if (effect) {
+                    cells += static_cast<char>(0x80 | 0x08 | 0x10);
+                    cells += static_cast<char>(effect >> 8);
+                    cells += static_cast<char>(effect & 0xff);
+                } else {
+                    cells += static_cast<char>(0x80);
+                }
+                cells += static_cast<char>(0x80); // Second channel
+            }
+            u32(9); // Pattern header size
+            u8(0);  // Packing type
+            u16(p.num_rows);
+            u16(static_cast<int>(cells.size()));
+            data_ += cells;
+        }
+        return data_;
+    }
+
+private:
+    std::string data_;
+};
+
+module load(const std::vector<test_pattern>& patterns, const std::vector<int>& order) {
+    std::istringstream in{xm_builder{}.build(patterns, order)};
+    module mod{module_type::xm};
+    load_xm(in, "test.xm", mod);
+    mod.compile_patterns();
+    return mod;
+}
+
+// (order, row) of the rows started by the sequencer, until the song would repeat or after max_rows_played rows
+std::vector<std::pair<int, int>> play(const module& mod, int max_rows_played) {
+    std::vector<std::pair<int, int>> rows;
+    module_sequencer sequencer{mod};
+    while (static_cast<int>(rows.size()) < max_rows_played) {
+        if (!sequencer.next_tick()) continue;
+        const std::pair<int, int> pos{sequencer.order(), sequencer.row()};
+        if (!rows.empty() && pos == rows.front()) break;
+        rows.push_back(pos);
+        sequencer.process_row_effects(mod.events_at(sequencer.order(), sequencer.row()));
+    }
+    return rows;
+}
+
+void test_row_counts() {
+    const auto mod = load({ {1, {}}, {256, {{255, 0xF02}}}, {64, {}} }, { 1, 0, 2, 1 });
+    CHECK(mod.patterns.size() == 3);
+    CHECK(mod.patterns.num_rows(0) == 1);
+    CHECK(mod.patterns.num_rows(1) == 256);
+    CHECK(mod.patterns.num_rows(2) == 64);
+    CHECK(mod.num_rows(0) == 256);
+    CHECK(mod.num_rows(1) == 1);
+    CHECK(mod.num_rows(2) == 64);
+
+    // Only the last row of the 256-row pattern has an event
+    for (int row = 0; row < 256; ++row) {
+        const auto events = mod.events_at(0, row);
+        CHECK((events.begin() != events.end()) == (row == 255));
+    }
+    const auto last = mod.events_at(0, 255);
+    CHECK(last.begin() != last.end() && last.begin()->effect_op == effect_op(0xF) && last.begin()->effect_param == 2);
+    const auto one_row = mod.at(1, 0);
+    CHECK(one_row[0].effect == 0 && one_row[1].effect == 0);
+}
+
+void test_row_advance() {
+    const auto mod = load({ {1, {}}, {256, {}}, {64, {}} }, { 0, 1, 2, 0 });
+    std::vector<std::pair<int, int>> expected{{0, 0}};
+    for (int row = 0; row < 256; ++row) expected.emplace_back(1, row);
+    for (int row = 0; row < 64; ++row) expected.emplace_back(2, row);
+    expected.emplace_back(3, 0);
+    CHECK(play(mod, 1000) == expected);
+}
+
+void test_break_row() {
+    // A break to a row the next pattern has continues there, a break past its end goes to its first row
+    const auto mod = load({
+        {1,   {{0, 0xD10}}},    // Break to row 10 of the 256-row pattern
+        {256, {{20, 0xD99}}},   // Break to row 99, past the end of the 64-row and the 1-row pattern
+        {64,  {{0, 0xD50}}},    // Break to row 50, past the end of the 1-row pattern
+    }, { 0, 1, 2, 0, 1 });
+    std::vector<std::pair<int, int>> expected{{0, 0}};
+    for (int row = 10; row <= 20; ++row) expected.emplace_back(1, row);
+    expected.emplace_back(2, 0);
+    expected.emplace_back(3, 0);
+    for (int row = 10; row <= 20; ++row) expected.emplace_back(4, row);
+    CHECK(play(mod, 1000) == expected);
+
+    // Breaking from the last order continues at the first
+    const auto wrap = load({ {256, {{3, 0xD99}}}, {64, {}} }, { 1, 0 });
+    std::vector<std::pair<int, int>> expected_wrap;
+    for (int row = 0; row < 64; ++row) expected_wrap.emplace_back(0, row);
+    for (int row = 0; row <= 3; ++row) expected_wrap.emplace_back(1, row);
+    CHECK(play(wrap, 1000) == expected_wrap);
+}
+
+
+void test_unknown_effects() {
+    // Effect types past Z (only in damaged files) decode to effect_op_unknown and show as '?'
+    const auto mod = load({ {4, {{0, 0x2301}, {1, 0x2402}, {2, 0x3003}, {3, 0xFF04}}} }, { 0 });
+    const uint8_t expected[] = { effect_op(0x23), effect_op_unknown, effect_op_unknown, effect_op_unknown };
+    for (int row = 0; row < 4; ++row) {
+        const auto events = mod.events_at(0, row);
+        CHECK(events.begin() != events.end() && events.begin()->effect_op == expected[row] && events.begin()->effect_param == row + 1);
+    }
+    CHECK(effect_type_char(module_type::xm, 0x23) == 'Z');
+    CHECK(effect_type_char(module_type::xm, 0x24) == '?');
+    CHECK(effect_type_char(module_type::s3m, 'Z' - 'A' + 1) == 'Z');
+    CHECK(effect_type_char(module_type::s3m, 'Z' - 'A' + 2) == '?');
+}
+
+}
+
+int main() {
+    print_load_messages(false);
+    test_row_counts();
+    test_row_advance();
+    test_break_row();
+    test_unknown_effects();
+    return test_result();
+}
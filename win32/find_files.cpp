@@ -0,0 +1,40 @@
+#include "find_files.h"
+#include <Windows.h>
+#include <memory>
+
+namespace {
+
+struct find_closer {
+    void operator()(HANDLE h) const { FindClose(h); }
+};
+using find_handle_ptr = std::unique_ptr<void, find_closer>;
+
+void find_files(const std::string& directory, std::vector<std::string>& files) {
+    WIN32_FIND_DATAA data;
+    find_handle_ptr find{FindFirstFileA((directory + "\\*").c_str(), &data)};
+    if (find.get() == INVALID_HANDLE_VALUE) {
+        find.release();
+        return;
+    }
+    do {
+        const std::string name = data.cFileName;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+                find_files(directory + "\\" + name, files);
+            }
+        } else {
+            files.push_back(directory + "\\" + name);
+        }
+    } while (FindNextFileA(find.get(), &data));
+}
+
+}
+
+std::vector<std::string> find_files(const std::string& directory) {
+    std::vector<std::string> files;
+    find_files(directory, files);
+    return files;
+}
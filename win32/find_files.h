@@ -0,0 +1,11 @@
+#ifndef SAMPEDIT_WIN32_FIND_FILES_H
+#define SAMPEDIT_WIN32_FIND_FILES_H
+
+#include <string>
+#include <vector>
+
+// Names (prefixed by directory) of the files in directory and all its subdirectories.
+// Directory links (junctions etc.) aren't followed.
+std::vector<std::string> find_files(const std::string& directory);
+
+#endif
@@ -17,6 +17,11 @@ public:
         pos_ = pos;
         update_pos();
     }
+
+    void render_stats_changed(const render_stats_snapshot& stats) {
+        stats_ = stats;
+        update_pos();
+    }
 private:
     friend window_base<info_window_impl>;
     static const wchar_t* class_name() { return L"info_window_impl"; }
@@ -25,6 +30,7 @@ private:
     HWND            info_label_wnd_;
     const module*   mod_ = nullptr;
     module_position pos_;
+    render_stats_snapshot stats_{};
     static constexpr int font_height_ = 12;
 
     explicit info_window_impl() {
@@ -32,14 +38,18 @@ private:
 
     void update_pos() {
         std::wstringstream wss;
-        wss << "Order: " << pos_.order << " Pattern: " << pos_.pattern << " Row: " << pos_.row << "\n";
+        wss << "Order: " << pos_.order << " Pattern: " << pos_.pattern << " Row: " << pos_.row;
+        wss << std::fixed << std::setprecision(1);
+        wss << " \tCPU: " << 100.0f * stats_.cpu_load() << "% (max " << 100.0f * stats_.max_cpu_load() << "%)";
+        wss << " Voices: " << stats_.active_voices << " Underruns: " << stats_.underruns << "\n";
         SetWindowText(pos_label_wnd_, wss.str().c_str());
     }
 
     void update_info() {
         assert(mod_);
         std::wstringstream wss;
-        wss << mod_->num_channels << " channel " << module_type_name[static_cast<int>(mod_->type)] << " module name: " << mod_->name.c_str() << ", initial speed " << mod_->initial_speed << ", initial tempo " << mod_->initial_tempo << "\n";
+        wss << mod_->num_channels << " channel " << module_type_name[static_cast<int>(mod_->type)] << " module name: " << mod_->name.c_str() << ", initial speed " << mod_->initial_speed << ", initial tempo " << mod_->initial_tempo;
+        wss << ", pattern data " << mod_->patterns.memory_used() << " bytes (" << mod_->patterns.unpacked_memory_used() << " unpacked)\n";
         wss << "# \tVolume \t";
         if (mod_->type == module_type::xm) {
             wss << "Fadeout \tRelNote \t";
@@ -105,4 +115,8 @@ void info_window::set_module(const module& mod) {
 
 void info_window::position_changed(const module_position& pos) {
     info_window_impl::from_hwnd(hwnd())->position_changed(pos);
+}
+
+void info_window::render_stats_changed(const render_stats_snapshot& stats) {
+    info_window_impl::from_hwnd(hwnd())->render_stats_changed(stats);
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define SAMPEDIT_WIN32_INFO_WINDOW_H
 
 #include <win32/base.h>
+#include <base/render_stats.h>
 #include "module.h"
 
 class info_window {
@@ -13,6 +14,7 @@ public:
 
     void set_module(const module& mod);
     void position_changed(const module_position& pos);
+    void render_stats_changed(const render_stats_snapshot& stats);
 private:
     explicit info_window(HWND hwnd) : hwnd_(hwnd) {}
 
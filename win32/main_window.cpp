@@ -34,6 +34,10 @@ public:
         on_piano_key_pressed_.subscribe(cb);
     }
 
+    void on_sample_selected(const callback_function_type<int>& cb) {
+        on_sample_selected_.subscribe(cb);
+    }
+
     int current_sample_index() const {
         return sample_index_;
     }
@@ -62,6 +66,7 @@ private:
     int                        sample_index_= -1;
 
     event<piano_key>           on_piano_key_pressed_;
+    event<int>                 on_sample_selected_;
 
     int sample_max() const {
         assert(module_);
@@ -86,6 +91,7 @@ private:
             default: assert(false);
             }
             sample_index_ = index;
+            on_sample_selected_(index);
         } else {
             sample_wnd_.set_sample(nullptr);
             wss << "No sample selected\n";
@@ -199,6 +205,10 @@ public:
         sample_edit_->on_piano_key_pressed(cb);
     }
 
+    void on_sample_selected(const callback_function_type<int>& cb) {
+        sample_edit_->on_sample_selected(cb);
+    }
+
     void on_start_stop(const callback_function_type<>& cb) {
         on_start_stop_.subscribe(cb);
     }
@@ -212,6 +222,10 @@ public:
         info_window_.position_changed(pos);
     }
 
+    void render_stats_changed(const render_stats_snapshot& stats) {
+        info_window_.render_stats_changed(stats);
+    }
+
     void on_order_selected(const callback_function_type<int>& cb) {
         pattern_edit_.on_order_selected(cb);
     }
@@ -364,6 +378,10 @@ void main_window::on_piano_key_pressed(const callback_function_type<piano_key>&
     main_window_impl::from_hwnd(hwnd())->on_piano_key_pressed(cb);
 }
 
+void main_window::on_sample_selected(const callback_function_type<int>& cb) {
+    main_window_impl::from_hwnd(hwnd())->on_sample_selected(cb);
+}
+
 void main_window::on_start_stop(const callback_function_type<>& cb) {
     main_window_impl::from_hwnd(hwnd())->on_start_stop(cb);
 }
@@ -374,4 +392,8 @@ void main_window::on_order_selected(const callback_function_type<int>& cb) {
 
 void main_window::position_changed(const module_position& pos) {
     main_window_impl::from_hwnd(hwnd())->position_changed(pos);
+}
+
+void main_window::render_stats_changed(const render_stats_snapshot& stats) {
+    main_window_impl::from_hwnd(hwnd())->render_stats_changed(stats);
 }
\ No newline at end of file
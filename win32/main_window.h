@@ -4,6 +4,7 @@
 #include <base/sample.h>
 #include <base/note.h>
 #include <base/virtual_grid.h>
+#include <base/render_stats.h>
 #include <win32/base.h>
 #include "module.h"
 
@@ -18,9 +19,11 @@ public:
 
     void on_exiting(const callback_function_type<>& cb);
     void on_piano_key_pressed(const callback_function_type<piano_key>& cb);
+    void on_sample_selected(const callback_function_type<int>& cb);
     void on_start_stop(const callback_function_type<>& cb);
     void on_order_selected(const callback_function_type<int>& cb);
     void position_changed(const module_position& pos);
+    void render_stats_changed(const render_stats_snapshot& stats);
 
 private:
     explicit main_window(HWND hwnd) : hwnd_(hwnd) {}
@@ -0,0 +1,37 @@
+#include "mapped_file.h"
+#include <Windows.h>
+
+namespace {
+
+struct handle_closer {
+    void operator()(HANDLE h) const { CloseHandle(h); }
+};
+using handle_ptr = std::unique_ptr<void, handle_closer>;
+
+}
+
+std::shared_ptr<const mapped_file> mapped_file::open(const std::string& filename) {
+    handle_ptr file{CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr)};
+    if (file.get() == INVALID_HANDLE_VALUE) {
+        file.release();
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file.get(), &size) || size.QuadPart <= 0 || static_cast<unsigned long long>(size.QuadPart) > SIZE_MAX) {
+        return nullptr;
+    }
+    // The view keeps the mapping (and file) open after the handles are closed
+    handle_ptr mapping{CreateFileMapping(file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr)};
+    if (!mapping) {
+        return nullptr;
+    }
+    const void* view = MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        return nullptr;
+    }
+    return std::shared_ptr<const mapped_file>{new mapped_file{static_cast<const uint8_t*>(view), static_cast<size_t>(size.QuadPart)}};
+}
+
+mapped_file::~mapped_file() {
+    UnmapViewOfFile(data_);
+}
@@ -0,0 +1,28 @@
+#ifndef SAMPEDIT_WIN32_MAPPED_FILE_H
+#define SAMPEDIT_WIN32_MAPPED_FILE_H
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+// Read-only view of a whole file mapped into memory. The file can't be replaced while it's mapped.
+class mapped_file {
+public:
+    // Returns nullptr if filename doesn't exist, is empty or can't be mapped
+    static std::shared_ptr<const mapped_file> open(const std::string& filename);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    explicit mapped_file(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    const uint8_t* data_;
+    size_t         size_;
+};
+
+#endif
@@ -209,8 +209,7 @@ public:
     }
 
     void position_changed(const module_position& pos) {
-        text_grid_.centered_row(pos.row);
-        InvalidateRect(text_grid_.hwnd(), nullptr, TRUE); // Force text grid to repaint
+        text_grid_.centered_row(pos.row); // Repaints everything if the pattern changed, otherwise scrolls
         order_view_->position_changed(pos);
     }
 
@@ -52,6 +52,10 @@ private:
         menu_id_undo_zoom,
     };
 
+    // Repaints the sample once it has been decoded
+    static constexpr uintptr_t decode_timer_id = 1;
+    static constexpr UINT decode_timer_interval_ms = 50;
+
     explicit sample_window_impl() : background_brush_(create_background_brush()) {
         menu_.insert(menu_id_zoom, L"Zoom");
         menu_.insert(menu_id_undo_zoom, L"Undo Zoom");
@@ -77,6 +81,7 @@ private:
 
     const int x_border = 10;
     const int y_border = 10;
+    static constexpr COLORREF sample_rms_color = RGB(0x8a, 0xaa, 0xf0);
 
     void undo_zoom() {
         assert(state_ == state::normal);
@@ -111,7 +116,11 @@ private:
         //
         // Sample data
         //
-        {
+        const int num_columns = size_.x - 2 * x_border;
+        if (!sample_->ready()) {
+            SetTimer(hwnd(), decode_timer_id, decode_timer_interval_ms, nullptr);
+        } else if (zoom_.size() <= num_columns) {
+            // At most one frame per column, connect them
             pen_ptr pen{CreatePen(PS_SOLID, 1, default_text_color)};
             auto old_pen{select(hdc, pen)};
 
@@ -125,6 +134,32 @@ private:
                     LineTo(hdc, x, y);
                 }
             }
+        } else {
+            // Min/max envelope of the frames in each column with the RMS drawn on top
+            std::vector<peak_summary> columns(num_columns);
+            for (int i = 0; i < num_columns; ++i) {
+                columns[i] = sample_->peaks(x_to_sample_pos(i), x_to_sample_pos(i + 1));
+            }
+            {
+                pen_ptr pen{CreatePen(PS_SOLID, 1, default_text_color)};
+                auto old_pen{select(hdc, pen)};
+                for (int i = 0; i < num_columns; ++i) {
+                    MoveToEx(hdc, x_border + i, sample_val_to_y(columns[i].max), nullptr);
+                    LineTo(hdc, x_border + i, sample_val_to_y(columns[i].min) + 1);
+                }
+            }
+            {
+                pen_ptr pen{CreatePen(PS_SOLID, 1, sample_rms_color)};
+                auto old_pen{select(hdc, pen)};
+                for (int i = 0; i < num_columns; ++i) {
+                    const float rms = columns[i].rms();
+                    const float top = std::min(rms, columns[i].max), bottom = std::max(-rms, columns[i].min);
+                    if (top > bottom) {
+                        MoveToEx(hdc, x_border + i, sample_val_to_y(top), nullptr);
+                        LineTo(hdc, x_border + i, sample_val_to_y(bottom) + 1);
+                    }
+                }
+            }
         }
 
         //
@@ -165,6 +200,13 @@ private:
         size_ = POINT{cx, cy};
     }
 
+    void on_timer(uintptr_t id) {
+        if (id == decode_timer_id && (!sample_ || sample_->ready())) {
+            KillTimer(hwnd(), decode_timer_id);
+            InvalidateRect(hwnd(), nullptr, TRUE);
+        }
+    }
+
     void on_lbutton_down(int x, int, unsigned) {
         assert(state_ == state::normal);
         if (!sample_ || sample_->length() < 1) return;
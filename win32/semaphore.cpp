@@ -0,0 +1,29 @@
+#include "semaphore.h"
+#include <Windows.h>
+#include <climits>
+#include <stdexcept>
+#include <string>
+#include <cassert>
+
+semaphore::semaphore(int initial_count) : handle_(CreateSemaphore(nullptr, initial_count, LONG_MAX, nullptr)) {
+    if (!handle_) {
+        throw std::runtime_error("CreateSemaphore failed: " + std::to_string(GetLastError()));
+    }
+}
+
+semaphore::~semaphore() {
+    CloseHandle(handle_);
+}
+
+void semaphore::signal(int count) {
+    assert(count > 0);
+    auto ret = ReleaseSemaphore(handle_, count, nullptr);
+    assert(ret);
+    (void)ret;
+}
+
+void semaphore::wait() {
+    auto ret = WaitForSingleObject(handle_, INFINITE);
+    assert(ret == WAIT_OBJECT_0);
+    (void)ret;
+}
@@ -0,0 +1,24 @@
+#ifndef SAMPEDIT_WIN32_SEMAPHORE_H
+#define SAMPEDIT_WIN32_SEMAPHORE_H
+
+// Counting semaphore. A signal is never lost: It's kept until a wait consumes it. Signalling doesn't take any lock in
+// user mode (or allocate), so it can be done from the audio thread.
+class semaphore {
+public:
+    explicit semaphore(int initial_count = 0);
+    ~semaphore();
+
+    semaphore(const semaphore&) = delete;
+    semaphore& operator=(const semaphore&) = delete;
+
+    // Adds count to the semaphore, releasing up to count waiting threads
+    void signal(int count = 1);
+
+    // Blocks until the count is non-zero and decrements it
+    void wait();
+
+private:
+    void* handle_;
+};
+
+#endif
@@ -1,20 +1,37 @@
 #include "text_grid.h"
 #include <win32/gdi.h>
+#include <base/grid_text_cache.h>
 #include <algorithm>
+#include <cstdlib>
+#include <vector>
 
 class text_grid_view_impl : public window_base<text_grid_view_impl>, public double_buffered_paint<text_grid_view_impl> {
 public:
     void column_offset(int offset) {
         if (offset != column_offset_) {
-            assert(offset >= 0 && offset < static_cast<int>(grid_.column_widths().size()));
+            assert(offset >= 0 && offset < grid_.columns());
             column_offset_ = offset;
             InvalidateRect(hwnd(), nullptr, TRUE);
         }
     }
 
     void centered_row(int row) {
-        if (row != centered_row_) {
-            centered_row_ = row;
+        const int key = grid_.content_key();
+        if (row == centered_row_ && key == painted_key_) {
+            return;
+        }
+        const int delta = row - centered_row_;
+        centered_row_ = row;
+        if (key >= 0 && key == painted_key_ && line_height_ > 0) {
+            scroll_rows(delta);
+        } else {
+            InvalidateRect(hwnd(), nullptr, TRUE);
+        }
+    }
+
+    void content_changed(int key) {
+        text_cache_.invalidate(key);
+        if (key == painted_key_) {
             InvalidateRect(hwnd(), nullptr, TRUE);
         }
     }
@@ -24,6 +41,10 @@ private:
     font_ptr        font_;
     int             column_offset_ = 0;
     int             centered_row_ = 0;
+    std::vector<int> colx_; // Reused between paints
+    grid_text_cache text_cache_;
+    int             painted_key_ = -1; // Content key of the last paint
+    int             line_height_ = 0;  // From the last paint
 
     friend window_base<text_grid_view_impl>;
     friend double_buffered_paint<text_grid_view_impl>;
@@ -37,6 +58,29 @@ private:
         return true;
     }
 
+    // Moves the already painted rows instead of repainting them. Only the uncovered rows and the middle lines,
+    // which stay in place, are painted again.
+    void scroll_rows(int delta) {
+        RECT client_rect;
+        GetClientRect(hwnd(), &client_rect);
+        const int dy = delta * line_height_;
+        if (std::abs(dy) >= client_rect.bottom) {
+            InvalidateRect(hwnd(), nullptr, TRUE);
+            return;
+        }
+
+        RECT scroll_rect = client_rect;
+        scroll_rect.top = line_height_; // keep the column headers
+        ScrollWindowEx(hwnd(), 0, -dy, &scroll_rect, &scroll_rect, nullptr, nullptr, SW_INVALIDATE);
+        UpdateWindow(hwnd());
+
+        const int mid_y = client_rect.bottom/2;
+        RECT middle_rect = client_rect;
+        middle_rect.top    = mid_y - line_height_/2 - std::abs(dy);
+        middle_rect.bottom = mid_y + line_height_/2 + std::abs(dy) + 1;
+        InvalidateRect(hwnd(), &middle_rect, FALSE);
+    }
+
     void on_key_down(int vk, unsigned /*extra*/) {
         constexpr int rows_per_page = 16;
         if (vk == VK_UP) {
@@ -49,7 +93,7 @@ private:
         } else if (vk == VK_NEXT) {
             centered_row(std::min(centered_row_ + rows_per_page, grid_.rows() - 1));
         } else if (vk == VK_TAB) {
-            const int num_cols = static_cast<int>(grid_.column_widths().size());
+            const int num_cols = grid_.columns();
             if (GetKeyState(VK_SHIFT)) {
                 column_offset(column_offset_ ? column_offset_ - 1 : num_cols - 1);
             } else {
@@ -75,35 +119,21 @@ private:
         const int y_spacing = 1;
 
         const int line_height = font_size.cy + 2 * y_spacing;
+        line_height_ = line_height;
 
         RECT client_rect;
         GetClientRect(hwnd(), &client_rect);
         const int mid_y = client_rect.bottom/2;
 
-        //
-        // Draw middle line
-        //
-        {
-            pen_ptr pen{CreatePen(PS_SOLID, 1, RGB(255, 255, 255))};
-            auto old_pen{select(hdc, pen)};
-
-            const int y0 = mid_y - line_height/2;
-            const int y1 = mid_y + line_height/2;
-
-            MoveToEx(hdc, 0, y0, nullptr);
-            LineTo(hdc, client_rect.right, y0);
-            MoveToEx(hdc, 0, y1, nullptr);
-            LineTo(hdc, client_rect.right, y1);
-        }
-
         //
         // Draw column headers and calculate colx[]
         //
-        const auto colw = grid_.column_widths();
+        const int num_cols = grid_.columns();
         const int row_label_width = 2*font_size.cx + x_spacing;
-        std::vector<int> colx(colw.size());
-        int col_min = -1, col_max = static_cast<int>(colw.size());
-        for (int c = column_offset_, x = row_label_width; c < static_cast<int>(colw.size()); ++c) {
+        colx_.resize(num_cols);
+        int col_min = -1, col_max = num_cols;
+        for (int c = column_offset_, x = row_label_width; c < num_cols; ++c) {
+            const int width = grid_.column_width(c);
             const bool visible = x >= paint_rect_.left;
             if (col_min == -1 && visible) {
                 col_min = c;
@@ -114,44 +144,69 @@ private:
             }
             if (visible) {
                 const char column_header[2] = { static_cast<char>(((c+1)/10)+'0'), static_cast<char>(((c+1)%10)+'0') };
-                TextOutA(hdc, x + font_size.cx * (colw[c] - sizeof(column_header))/2, 0, column_header, sizeof(column_header));
+                TextOutA(hdc, x + font_size.cx * (width - static_cast<int>(sizeof(column_header)))/2, 0, column_header, sizeof(column_header));
             }
-            colx[c] = x;
-            x += colw[c] * font_size.cx + x_spacing;
+            colx_[c] = x;
+            x += width * font_size.cx + x_spacing;
         }
 
-        if (col_min < 0 || col_min == col_max) {
-            return;
+        if (col_min < 0) {
+            col_min = col_max; // Only the row labels need painting
         }
 
-        assert(col_min >= 0 && col_min < col_max && col_max <= colw.size());
+        assert(col_min >= 0 && col_min <= col_max && col_max <= num_cols);
 
         //
         // Draw grid
         //
+        const char* text = text_cache_.text(grid_); // Only formats the content the first time it's shown
+        painted_key_ = grid_.content_key();
+        const int row_stride = text_cache_.row_stride();
+
+        // Clip rows partially covered by the column headers
         RECT paint_rect = paint_rect_;
-        paint_rect.top += line_height; // offset paint rectangle to avoid painting over the column headers
+        paint_rect.top = std::max<int>(paint_rect.top, line_height);
         paint_rect.bottom = std::max(paint_rect.bottom, paint_rect.top);
+        IntersectClipRect(hdc, paint_rect.left, paint_rect.top, paint_rect.right, paint_rect.bottom);
+
+        // Row r is drawn at y0 + (r - centered_row_) * line_height, so only the rows overlapping the paint rectangle are drawn
         SetTextAlign(hdc, TA_LEFT|TA_TOP);
-        const int rows  = grid_.rows();
-        const int row_offset = centered_row_ - mid_y / line_height + 1;
-        const int row_min = std::max<int>(paint_rect.top / line_height + row_offset, 0);
-        const int row_max = std::min<int>((paint_rect.bottom + line_height - 1) / line_height + row_offset, rows);
+        const int rows = grid_.rows();
+        const int y0 = mid_y - line_height/2 + y_spacing;
+        const auto floor_div = [](int a, int b) { return a >= 0 ? a / b : -((-a + b - 1) / b); };
+        const int row_min = std::max(centered_row_ + floor_div(paint_rect.top - y0, line_height), 0);
+        const int row_max = std::min(centered_row_ - floor_div(y0 - paint_rect.bottom, line_height), rows);
         const bool row_label_visible = true; // TODO: only draw if needed
-        //wprintf(L"row_offset = %+2d, row_min = %2d, row_max = %2d\n", row_offset, row_min, row_max);
         for (int r = row_min; r < row_max; ++r) {
-            const int y = y_spacing + (r - row_offset) * line_height + (mid_y + line_height/2) % line_height;
+            const int y = y0 + (r - centered_row_) * line_height;
             if (row_label_visible) {
                 const char row_label[2] = { static_cast<char>((r/10)+'0'), static_cast<char>((r%10)+'0') };
                 TextOutA(hdc, 0, y, row_label, sizeof(row_label));
             }
+            const char* row_text = text + r * row_stride;
             for (int c = col_min; c < col_max; ++c) {
-                const int x = colx[c];
+                const int x = colx_[c];
                 assert(x >= paint_rect.left && x < paint_rect.right);
-                const auto s = grid_.cell_value(r, c);
-                TextOutA(hdc, x, y, s.c_str(), static_cast<int>(s.length()));
+                TextOutA(hdc, x, y, row_text + text_cache_.column_offset(c), grid_.column_width(c));
             }
         }
+        SelectClipRgn(hdc, nullptr);
+
+        //
+        // Draw middle line (last, as the rows may overlap it)
+        //
+        {
+            pen_ptr pen{CreatePen(PS_SOLID, 1, RGB(255, 255, 255))};
+            auto old_pen{select(hdc, pen)};
+
+            const int y0 = mid_y - line_height/2;
+            const int y1 = mid_y + line_height/2;
+
+            MoveToEx(hdc, 0, y0, nullptr);
+            LineTo(hdc, client_rect.right, y0);
+            MoveToEx(hdc, 0, y1, nullptr);
+            LineTo(hdc, client_rect.right, y1);
+        }
     }
 };
 
@@ -161,4 +216,8 @@ text_grid_view text_grid_view::create(HWND parent_wnd, virtual_grid& grid) {
 
 void text_grid_view::centered_row(int row) {
     text_grid_view_impl::from_hwnd(hwnd())->centered_row(row);
+}
+
+void text_grid_view::content_changed(int key) {
+    text_grid_view_impl::from_hwnd(hwnd())->content_changed(key);
 }
\ No newline at end of file
@@ -13,6 +13,9 @@ public:
 
     void centered_row(int row);
 
+    // Call after editing the grid content with the key (see virtual_grid::content_key)
+    void content_changed(int key);
+
 private:
     explicit text_grid_view(HWND hwnd) : hwnd_(hwnd) {}
 
@@ -13,16 +13,15 @@ using waveout = std::unique_ptr<HWAVEOUT__, decltype(&::waveOutClose)>;
 
 class wavedev::impl {
 public:
-    explicit impl(unsigned sample_rate, unsigned buffer_size, callback_t callback) 
+    explicit impl(unsigned sample_rate, const buffer_ring_config& config, callback_t callback, underrun_callback_t underrun_callback)
         : sample_rate_(sample_rate)
-        , buffer_size_(buffer_size)
         , callback_(callback)
+        , underrun_callback_(underrun_callback)
+        , ring_(config)
+        , hdr_(ring_.num_slots())
         , waveout_(create_waveout())
         , exiting_(false)
-        , num_buffers_to_play_(2)
-        , next_buffer_(0)
-        , data_(buffer_size_ * 2)
-        , t_(&impl::double_buffer_thread, this) {
+        , t_(&impl::buffer_thread, this) {
     }
 
     ~impl() {
@@ -33,20 +32,23 @@ public:
         cv_.notify_one();
         waveOutReset(waveout_.get());
         t_.join();
+        for (auto& hdr : hdr_) {
+            if (hdr.dwFlags & WHDR_PREPARED) {
+                waveOutUnprepareHeader(waveout_.get(), &hdr, sizeof(WAVEHDR));
+            }
+        }
     }
 
 private:
     const unsigned              sample_rate_;
-    const unsigned              buffer_size_;
     callback_t                  callback_;
+    underrun_callback_t         underrun_callback_;
+    buffer_ring                 ring_;  // Protected by mutex_ (except for the data of the slot being filled)
+    std::vector<WAVEHDR>        hdr_;
     waveout                     waveout_;
     std::mutex                  mutex_;
     std::condition_variable     cv_;
     bool                        exiting_;
-    int                         num_buffers_to_play_;
-    int                         next_buffer_;
-    std::vector<short>          data_;
-    WAVEHDR                     hdr_[2];
     std::thread                 t_;
 
     waveout create_waveout() {
@@ -77,11 +79,13 @@ private:
         if (uMsg == MM_WOM_DONE) {
             {
                 std::lock_guard<std::mutex> lock(instance.mutex_);
-                assert(instance.num_buffers_to_play_ >= 0 && instance.num_buffers_to_play_ < 2);
-                instance.num_buffers_to_play_++;
                 if (instance.exiting_) {
+                    // waveOutReset returning the buffers, not an underrun
                     return;
                 }
+                const int slot = instance.ring_.buffer_returned();
+                assert(reinterpret_cast<WAVEHDR*>(dwParam1) == &instance.hdr_[slot]);
+                (void)slot;
             }
             instance.cv_.notify_one();
         }
@@ -90,33 +94,52 @@ private:
         (void)dwParam2;
     }
 
-    void double_buffer_thread() {
+    // Keeps the ring filled up to its target, rendering every free buffer each time the thread wakes up
+    void buffer_thread() {
         assert(waveout_.get());
+        const DWORD buffer_bytes = ring_.buffer_frames() * 2 * sizeof(short);
+        for (int slot = 0; slot < ring_.num_slots(); ++slot) {
+            auto& hdr = hdr_[slot];
+            memset(&hdr, 0, sizeof(WAVEHDR));
+            hdr.lpData         = reinterpret_cast<LPSTR>(ring_.data(slot));
+            hdr.dwBufferLength = buffer_bytes;
+            auto ret = waveOutPrepareHeader(waveout_.get(), &hdr, sizeof(WAVEHDR));
+            assert(ret == MMSYSERR_NOERROR);
+            (void)ret;
+        }
+
+        uint32_t reported_underruns = 0;
         for (;;) {
-            int buffer;
+            int slot;
+            int frames_ahead;
+            uint32_t underruns;
             {
                 std::unique_lock<std::mutex> lock(mutex_);
-                cv_.wait(lock, [this] { return exiting_ || num_buffers_to_play_; });
+                cv_.wait(lock, [this] { return exiting_ || ring_.can_fill(); });
                 if (exiting_) break;
-                assert(num_buffers_to_play_ >= 1 && num_buffers_to_play_ <= 2);
-                buffer = next_buffer_;
-                num_buffers_to_play_--;
-                next_buffer_ = !next_buffer_;
+                slot         = ring_.begin_fill();
+                frames_ahead = ring_.frames_ahead();
+                underruns    = ring_.underruns();
             }
-            callback_(&data_[buffer * buffer_size_], buffer_size_ / 2);
-            memset(&hdr_[buffer], 0, sizeof(WAVEHDR));
-            hdr_[buffer].lpData  = (LPSTR)&data_[buffer * buffer_size_];
-            hdr_[buffer].dwBufferLength = buffer_size_ * 2;
-            auto ret = waveOutPrepareHeader(waveout_.get(), &hdr_[buffer], sizeof(WAVEHDR));
-            assert(ret == MMSYSERR_NOERROR);
-            ret = waveOutWrite(waveout_.get(), &hdr_[buffer], sizeof(WAVEHDR));
+            // Several buffers may have run dry since the last buffer was filled
+            for (; reported_underruns != underruns; ++reported_underruns) {
+                if (underrun_callback_) underrun_callback_();
+            }
+            callback_(ring_.data(slot), ring_.buffer_frames(), frames_ahead);
+            {
+                // Before the write, the buffer can be returned as soon as it has been written
+                std::lock_guard<std::mutex> lock(mutex_);
+                ring_.end_fill();
+            }
+            auto ret = waveOutWrite(waveout_.get(), &hdr_[slot], sizeof(WAVEHDR));
             assert(ret == MMSYSERR_NOERROR);
+            (void)ret;
         }
     }
 };
 
-wavedev::wavedev(unsigned sample_rate, unsigned buffer_size, callback_t callback)
-    : impl_(new impl(sample_rate, buffer_size, callback))
+wavedev::wavedev(unsigned sample_rate, const buffer_ring_config& config, callback_t callback, underrun_callback_t underrun_callback)
+    : impl_(new impl(sample_rate, config, callback, underrun_callback))
 {
 }
 
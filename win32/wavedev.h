@@ -3,12 +3,16 @@
 
 #include <memory>
 #include <functional>
+#include <base/buffer_ring.h>
 
 class wavedev {
 public:
-    using callback_t = std::function<void(short* /*buffer*/, size_t /*num_stereo_samples*/)>;
+    using callback_t = std::function<void(short* /*buffer*/, size_t /*num_stereo_samples*/, size_t /*frames_ahead*/)>;
+    using underrun_callback_t = std::function<void(void)>;
 
-    explicit wavedev(unsigned sample_rate, unsigned buffer_size, callback_t callback);
+    // callback fills buffer, which starts playing after the frames_ahead frames already queued to the device.
+    // underrun_callback (if any) is called from the device thread each time the device ran out of data to play.
+    explicit wavedev(unsigned sample_rate, const buffer_ring_config& config, callback_t callback, underrun_callback_t underrun_callback = nullptr);
     ~wavedev();
 
     wavedev(const wavedev&) = delete;
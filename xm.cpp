@@ -1,6 +1,7 @@
 #include "xm.h"
 #include "module.h"
 #include <base/stream_util.h>
+#include <cstring>
 
 constexpr int  xm_signature_length = 17;
 constexpr char xm_signature[xm_signature_length+1] = "Extended Module: ";
@@ -235,6 +236,28 @@ bool check(xm_instrument_header& ins_hdr) {
     return true;
 }
 
+constexpr uint8_t xm_envelope_on_mask      = 1;
+constexpr uint8_t xm_envelope_sustain_mask = 2;
+constexpr uint8_t xm_envelope_loop_mask    = 4;
+
+module_envelope convert_envelope(const uint8_t (&data)[48], int num_points, uint8_t type, int sustain_point, int loop_start, int loop_end) {
+    if (!(type & xm_envelope_on_mask) || num_points < 1 || num_points > 12) {
+        return module_envelope{};
+    }
+    // 12 (x, y) pairs of 16-bit little endian values
+    std::vector<module_envelope_point> points;
+    for (int i = 0; i < num_points; ++i) {
+        const int x = data[i * 4 + 0] | data[i * 4 + 1] << 8;
+        const int y = data[i * 4 + 2] | data[i * 4 + 3] << 8;
+        if ((i ? x <= points.back().x : x != 0) || y > module_envelope::max_value) {
+            load_message(L"Ignoring invalid envelope point %d (%d, %d)\n", i, x, y);
+            return module_envelope{};
+        }
+        points.push_back(module_envelope_point{x, y});
+    }
+    return module_envelope{points, type & xm_envelope_sustain_mask ? sustain_point : -1, type & xm_envelope_loop_mask ? loop_start : -1, type & xm_envelope_loop_mask ? loop_end : -1};
+}
+
 struct xm_sample_header {
     uint32_t length;
     uint32_t loop_start;
@@ -275,7 +298,7 @@ bool is_xm(std::istream& in)
     return read_string(in, xm_signature_length) == xm_signature;
 }
 
-void load_xm(std::istream& in, const char* filename, module& mod)
+void load_xm(std::istream& in, const char* filename, module& mod, std::vector<deferred_sample>* deferred)
 {
     assert(mod.type == module_type::xm);
     assert(is_xm(in));
@@ -291,11 +314,11 @@ void load_xm(std::istream& in, const char* filename, module& mod)
         in.seekg(60+xm.header_size, std::ios_base::beg);
     }
 
-    wprintf(L"Song name:    %20.20S\n", xm.name);
-    wprintf(L"Tracker:      %20.20S\n", xm.tracker);
-    wprintf(L"#Channels:    %d\n", xm.num_channels);
-    wprintf(L"#Patterns:    %d\n", xm.num_patterns);
-    wprintf(L"#Instruments: %d\n", xm.num_instruments);
+    load_message(L"Song name:    %20.20S\n", xm.name);
+    load_message(L"Tracker:      %20.20S\n", xm.tracker);
+    load_message(L"#Channels:    %d\n", xm.num_channels);
+    load_message(L"#Patterns:    %d\n", xm.num_patterns);
+    load_message(L"#Instruments: %d\n", xm.num_instruments);
 
     mod.name            = std::string(xm.name, xm.name+sizeof(xm.name));
     sanitize(mod.name);
@@ -329,7 +352,7 @@ void load_xm(std::istream& in, const char* filename, module& mod)
         } else {
             this_pattern.resize(num_notes);
         }
-        mod.patterns.push_back(std::move(this_pattern));
+        mod.patterns.add_pattern(this_pattern, pat_hdr.num_rows, xm.num_channels);
         assert(in.tellg() - pat_start == pat_hdr.data_size);
     }
 
@@ -343,14 +366,18 @@ void load_xm(std::istream& in, const char* filename, module& mod)
             throw std::runtime_error("Invalid/Unsupported XM: " + std::string(filename) + " Instrument " + std::to_string(ins) + " is invalid");
         }
 
-        wprintf(L"%2.2d: %22.22S\n", ins, ins_hdr.name);
+        load_message(L"%2.2d: %22.22S\n", ins, ins_hdr.name);
+
+        std::string ins_name = std::string(ins_hdr.name, ins_hdr.name + sizeof(ins_hdr.name));
+        sanitize(ins_name);
 
         if (!ins_hdr.num_samples) {
             mod.instruments.push_back(module_instrument{});
+            mod.instruments.back().name(ins_name);
             continue;
         }
 
-#define EXPECT(elem, val) if (ins_hdr.elem != (val)) wprintf(L"%d != %d -- ins_hdr.%S != %S\n", ins_hdr.elem, val, #elem, #val);
+#define EXPECT(elem, val) if (ins_hdr.elem != (val)) load_message(L"%d != %d -- ins_hdr.%S != %S\n", ins_hdr.elem, val, #elem, #val);
         //EXPECT(num_volume_points, 0);
         //EXPECT(num_panning_points, 0);
         //EXPECT(volume_sustain_point, 0);
@@ -359,14 +386,13 @@ void load_xm(std::istream& in, const char* filename, module& mod)
         //EXPECT(panning_sustain_point, 0);
         //EXPECT(panning_loop_start, 0);
         //EXPECT(panning_loop_end, 0);
-        EXPECT(volume_type, 0);  // bit 0: On; 1: Sustain; 2: Loop
-        EXPECT(panning_type, 0); // bit 0: On; 1: Sustain; 2: Loop
         EXPECT(vibrato_type, 0);
         EXPECT(vibrato_sweep, 0);
         EXPECT(vibrato_depth, 0);
         EXPECT(vibrato_rate, 0);
 
         module_instrument inst{ins_hdr.volume_fadeout};
+        inst.name(ins_name);
         std::vector<xm_sample_header> sample_headers;
         for (unsigned samp_num = 0; samp_num < ins_hdr.num_samples; ++samp_num) {
             xm_sample_header samp_hdr;
@@ -379,37 +405,27 @@ void load_xm(std::istream& in, const char* filename, module& mod)
             const int loop_type = samp_hdr.type & xm_sample_type_loop_mask;
             const bool is_16bit = (samp_hdr.type & xm_sample_type_16bit_mask) != 0;
 
-            wprintf(L"  %2.2d: %22.22S len %6d type %02X ", samp_num, samp_hdr.name, samp_hdr.length, samp_hdr.type);
-            if (loop_type) wprintf(L"Loop %6d %6d ", samp_hdr.loop_start, samp_hdr.loop_length);
-            wprintf(L"\n");
+            load_message(L"  %2.2d: %22.22S len %6d type %02X ", samp_num, samp_hdr.name, samp_hdr.length, samp_hdr.type);
+            if (loop_type) load_message(L"Loop %6d %6d ", samp_hdr.loop_start, samp_hdr.loop_length);
+            load_message(L"\n");
 
-            short last = 0;
-            std::vector<short> sample_data(samp_hdr.length);
             const int len = is_16bit ? samp_hdr.length/2 : samp_hdr.length;
-            for (int i = 0; i < len; ++i) {
-                short cur = 0;
-                if (is_16bit) {
-                    cur = static_cast<short>(read_le_u16(in));
-                } else {
-                    cur = static_cast<short>(static_cast<signed char>(read_le_u8(in)) << 8);
-                }
-                cur += last;
-                sample_data[i] = cur;
-                last = cur;
-            }
+            const sample_source source{static_cast<uint32_t>(in.tellg()), len, is_16bit ? sample_encoding::s16_delta : sample_encoding::s8_delta};
 
             std::string name = std::string(samp_hdr.name, samp_hdr.name + sizeof(samp_hdr.name));
             sanitize(name);
 
-            module_sample samp{sample{sample_data, amiga_c5_rate * note_difference_to_scale(samp_hdr.finetune/128.0f), name}, samp_hdr.volume, samp_hdr.relative_note};
+            module_sample samp{load_sample(in, mod, source, static_cast<int>(samp_hdr.length), amiga_c5_rate * note_difference_to_scale(samp_hdr.finetune/128.0f), name, deferred), samp_hdr.volume, samp_hdr.relative_note};
             if (loop_type) {
                 samp.data().loop(samp_hdr.loop_start, samp_hdr.loop_length, loop_type == xm_sample_loop_type_forward ? ::loop_type::forward : ::loop_type::pingpong);
             }
             inst.add_sample(std::move(samp));
         }
         inst.sample_mapping(ins_hdr.sample_number);
+        inst.volume_envelope(convert_envelope(ins_hdr.volume_points, ins_hdr.num_volume_points, ins_hdr.volume_type, ins_hdr.volume_sustain_point, ins_hdr.volume_loop_start, ins_hdr.volume_loop_end));
+        inst.panning_envelope(convert_envelope(ins_hdr.panning_points, ins_hdr.num_panning_points, ins_hdr.panning_type, ins_hdr.panning_sustain_point, ins_hdr.panning_loop_start, ins_hdr.panning_loop_end));
         mod.instruments.push_back(std::move(inst));
     }
 
-    wprintf(L"Using %S frequency table\n", mod.xm.use_linear_frequency ? "linear" : "amiga");
+    load_message(L"Using %S frequency table\n", mod.xm.use_linear_frequency ? "linear" : "amiga");
 }
\ No newline at end of file
@@ -2,10 +2,12 @@
 #define SAMPEDIT_XM_H
 
 #include <iosfwd>
+#include <vector>
 
 struct module;
+struct deferred_sample;
 
 bool is_xm(std::istream& in);
-void load_xm(std::istream& in, const char* filename, module& mod);
+void load_xm(std::istream& in, const char* filename, module& mod, std::vector<deferred_sample>* deferred = nullptr);
 
 #endif
\ No newline at end of file